@@ -0,0 +1,396 @@
+#include "include/veloc.h"
+#include "common/config.hpp"
+#include "common/command.hpp"
+#include "common/ipc_queue.hpp"
+#include "modules/module_manager.hpp"
+#include "modules/transfer_module.hpp"
+#include "modules/rs_module.hpp"
+#include "modules/rs_codec.hpp"
+
+#include "er.h"
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+
+#include <mpi.h>
+
+namespace tl = thallium;
+
+typedef std::chrono::steady_clock bench_clock_t;
+
+static double elapsed(const bench_clock_t::time_point &start) {
+    return std::chrono::duration<double>(bench_clock_t::now() - start).count();
+}
+
+// one JSON object per measurement: {"benchmark": ..., "params": {...}, "metrics": {...}}
+class report_t {
+    std::vector<std::string> entries;
+public:
+    typedef std::vector<std::pair<std::string, double> > fields_t;
+
+    static std::string object(const fields_t &fields) {
+	std::ostringstream out;
+	out << "{";
+	for (unsigned int i = 0; i < fields.size(); i++)
+	    out << (i > 0 ? ", " : "") << "\"" << fields[i].first << "\": " << fields[i].second;
+	out << "}";
+	return out.str();
+    }
+    void add(const std::string &name, const fields_t &params, const fields_t &metrics) {
+	entries.push_back("{\"benchmark\": \"" + name + "\", \"params\": " + object(params) +
+			  ", \"metrics\": " + object(metrics) + "}");
+	std::cerr << entries.back() << std::endl;
+    }
+    void write(std::ostream &out) const {
+	char host[256] = "";
+	gethostname(host, sizeof(host));
+	out << "{\n  \"host\": \"" << host << "\",\n  \"timestamp\": "
+	    << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count()
+	    << ",\n  \"results\": [\n";
+	for (unsigned int i = 0; i < entries.size(); i++)
+	    out << "    " << entries[i] << (i + 1 < entries.size() ? ",\n" : "\n");
+	out << "  ]\n}\n";
+    }
+};
+
+static double percentile(std::vector<double> &v, double p) {
+    if (v.empty())
+	return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+static std::string write_config(const std::string &dir, const std::string &name, const std::string &body) {
+    std::string fname = dir + "/" + name + ".cfg";
+    std::ofstream f(fname);
+    f << "scratch = " << dir << "/scratch\n"
+      << "persistent = " << dir << "/persistent\n"
+      << body;
+    return fname;
+}
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+// checkpoint_mem/recover_mem throughput through the C API in sync mode (no backend, no flush, no EC)
+static void bench_checkpoint(report_t &report, const std::string &cfg_file, bool quick) {
+    std::vector<size_t> totals = quick ? std::vector<size_t>{1 << 20, 16 << 20} :
+	std::vector<size_t>{1 << 20, 64 << 20, 512 << 20};
+    std::vector<int> counts = {1, 16, 256};
+    int reps = quick ? 3 : 5;
+
+    if (VELOC_Init(MPI_COMM_WORLD, cfg_file.c_str()) != VELOC_SUCCESS) {
+	std::cerr << "VELOC_Init failed, skipping checkpoint benchmark" << std::endl;
+	return;
+    }
+    for (auto total : totals)
+	for (auto count : counts) {
+	    size_t region_size = total / count;
+	    std::vector<std::vector<char> > regions(count, std::vector<char>(region_size, 1));
+	    for (int i = 0; i < count; i++)
+		VELOC_Mem_protect(i, regions[i].data(), region_size, 1);
+	    double ckpt_time = 0, recover_time = 0;
+	    for (int r = 0; r < reps; r++) {
+		VELOC_Checkpoint_begin("bench", 1);
+		auto start = bench_clock_t::now();
+		VELOC_Checkpoint_mem();
+		ckpt_time += elapsed(start);
+		VELOC_Checkpoint_end(1);
+
+		VELOC_Restart_begin("bench", 1);
+		start = bench_clock_t::now();
+		VELOC_Recover_mem();
+		recover_time += elapsed(start);
+		VELOC_Restart_end(1);
+	    }
+	    for (int i = 0; i < count; i++)
+		VELOC_Mem_unprotect(i);
+	    double bytes = (double)region_size * count * reps;
+	    report.add("checkpoint_mem",
+		       {{"regions", (double)count}, {"total_bytes", (double)region_size * count}, {"reps", (double)reps}},
+		       {{"checkpoint_mb_s", bytes / ckpt_time / 1e6}, {"recover_mb_s", bytes / recover_time / 1e6}});
+	}
+    VELOC_Finalize(1);
+}
+
+// enqueue -> dequeue latency of shm_queue_t through the RPC path, with a variable number of clients
+static void bench_queue(report_t &report, const std::string &address, bool quick) {
+    const uint16_t provider_id = 23;
+    std::vector<int> clients = quick ? std::vector<int>{1, 16, 64} : std::vector<int>{1, 4, 16, 64, 256};
+    int per_client = quick ? 50 : 200;
+
+    tl::engine engine(address, THALLIUM_SERVER_MODE);
+    veloc_ipc::shm_queue_t<command_t> queue(engine, provider_id);
+    tl::remote_procedure enqueue = engine.define("enqueue").disable_response();
+    tl::remote_procedure init = engine.define("init");
+    tl::provider_handle ph(engine.self(), provider_id);
+
+    for (auto n : clients) {
+	size_t total = (size_t)n * per_client;
+	std::vector<std::atomic<uint64_t> > sent(total);
+	std::vector<double> latency;
+	latency.reserve(total);
+	for (int i = 0; i < n; i++)
+	    init.on(ph)(std::to_string(i));
+
+	std::thread consumer([&]() {
+	    command_t c;
+	    for (size_t i = 0; i < total; i++) {
+		auto f = queue.dequeue_any(c);
+		uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		    bench_clock_t::now().time_since_epoch()).count();
+		latency.push_back((now - sent[c.unique_id * per_client + c.version]) / 1e3);
+		f(VELOC_SUCCESS);
+	    }
+	});
+	// emulate the clients from a bounded number of threads, interleaving their commands
+	unsigned int threads = std::min((unsigned int)n, std::max(1u, std::thread::hardware_concurrency() / 2));
+	auto start = bench_clock_t::now();
+	std::vector<std::thread> producers;
+	for (unsigned int t = 0; t < threads; t++)
+	    producers.emplace_back([&, t]() {
+		for (int v = 0; v < per_client; v++)
+		    for (int id = t; id < n; id += threads) {
+			sent[id * per_client + v] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			    bench_clock_t::now().time_since_epoch()).count();
+			enqueue.on(ph)(command_t(id, command_t::CHECKPOINT, v, "bench"));
+		    }
+	    });
+	for (auto &p : producers)
+	    p.join();
+	consumer.join();
+	double duration = elapsed(start);
+	double mean = 0;
+	for (auto l : latency)
+	    mean += l;
+	mean /= latency.size();
+	report.add("queue_latency", {{"clients", (double)n}, {"commands", (double)total}},
+		   {{"mean_us", mean}, {"p50_us", percentile(latency, 0.5)}, {"p99_us", percentile(latency, 0.99)},
+		    {"max_us", percentile(latency, 1.0)}, {"commands_per_s", total / duration}});
+    }
+}
+
+// per-command overhead of module_manager_t::notify_command
+static void bench_notify(report_t &report, const config_t &cfg, bool quick) {
+    int iterations = quick ? 10000 : 100000;
+    command_t cmd(0, command_t::CHECKPOINT, 1, "bench");
+
+    // independent modules run concurrently on the worker pool, threads = 0 runs them in series
+    for (int threads : {0, 4})
+	for (int n : {1, 4, 16}) {
+	    module_manager_t modules;
+	    modules.set_parallelism(threads);
+	    for (int i = 0; i < n; i++)
+		modules.add_module("noop-" + std::to_string(i), [](const command_t &) { return VELOC_SUCCESS; });
+	    auto start = bench_clock_t::now();
+	    for (int i = 0; i < iterations; i++)
+		modules.notify_command(cmd);
+	    report.add("notify_command", {{"noop_modules", (double)n}, {"threads", (double)threads},
+					  {"iterations", (double)iterations}},
+		       {{"ns_per_call", elapsed(start) * 1e9 / iterations}});
+	}
+
+    // default modules with EC off and flushes disabled: measures bookkeeping only
+    module_manager_t modules;
+    modules.add_default_modules(cfg, MPI_COMM_SELF, false);
+    modules.notify_command(command_t(0, command_t::INIT, 0, ""));
+    auto start = bench_clock_t::now();
+    for (int i = 0; i < iterations; i++)
+	modules.notify_command(cmd);
+    report.add("notify_command", {{"default_modules", 1}, {"iterations", (double)iterations}},
+	       {{"ns_per_call", elapsed(start) * 1e9 / iterations}});
+}
+
+// bandwidth of the POSIX flush path of transfer_module_t (scratch -> persistent)
+static void bench_transfer(report_t &report, const config_t &cfg, bool quick) {
+    std::vector<size_t> sizes = quick ? std::vector<size_t>{16 << 20, 64 << 20} :
+	std::vector<size_t>{16 << 20, 256 << 20, (size_t)1 << 30};
+    int reps = 3;
+    transfer_module_t transfer(cfg);
+    std::vector<char> buffer(1 << 20, 1);
+
+    for (auto size : sizes) {
+	command_t c(0, command_t::CHECKPOINT, 1, "xfer");
+	std::string local = c.filename(cfg.get_scratch()), remote = c.filename(cfg.get_persistent());
+	int fd = open(local.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	for (size_t written = 0; written < size; written += buffer.size())
+	    if (write(fd, buffer.data(), std::min(buffer.size(), size - written)) == -1)
+		break;
+	fsync(fd);
+	close(fd);
+	double duration = 0;
+	int status = VELOC_SUCCESS;
+	for (int r = 0; r < reps; r++) {
+	    unlink(remote.c_str());
+	    auto start = bench_clock_t::now();
+	    status = std::min(status, transfer.process_command(c));
+	    duration += elapsed(start);
+	}
+	unlink(local.c_str());
+	unlink(remote.c_str());
+	report.add("transfer_file_posix", {{"bytes", (double)size}, {"reps", (double)reps}},
+		   {{"mb_s", (double)size * reps / duration / 1e6}, {"status", (double)status}});
+    }
+}
+
+// GF(2^8) encode throughput of the native Reed-Solomon codec, in memory, for each SIMD kernel of this CPU
+static void bench_ec_codec(report_t &report, bool quick) {
+    size_t shard = quick ? 4 << 20 : 32 << 20;
+    std::vector<std::pair<int, int> > schemes = {{4, 1}, {4, 2}, {8, 2}, {10, 4}};
+    std::string best = rs_codec_t::get_kernel();
+    std::vector<std::string> kernels = {"scalar", "avx2", "avx512"};
+
+    for (unsigned int kid = 0; kid < kernels.size(); kid++) {
+	if (!rs_codec_t::set_kernel(kernels[kid]))
+	    continue;
+	for (auto &s : schemes) {
+	    rs_codec_t codec(s.first, s.second);
+	    std::vector<std::vector<uint8_t> > data(s.first, std::vector<uint8_t>(shard, 1)),
+		parity(s.second, std::vector<uint8_t>(shard));
+	    std::vector<const uint8_t *> in;
+	    std::vector<uint8_t *> out;
+	    for (auto &d : data)
+		in.push_back(d.data());
+	    for (auto &p : parity)
+		out.push_back(p.data());
+	    codec.encode(in.data(), out.data(), shard);
+	    int reps = 3;
+	    auto start = bench_clock_t::now();
+	    for (int r = 0; r < reps; r++)
+		codec.encode(in.data(), out.data(), shard);
+	    report.add("ec_codec_" + kernels[kid], {{"k", (double)s.first}, {"m", (double)s.second},
+						     {"shard_bytes", (double)shard}},
+		       {{"encode_gb_s", (double)shard * s.first * reps / elapsed(start) / 1e9}});
+	}
+    }
+    rs_codec_t::set_kernel(best);
+}
+
+// distributed encode of one checkpoint file per process: native module vs. ER (every process is a failure domain)
+static void bench_ec_distributed(report_t &report, const std::string &dir, bool quick) {
+    int rank, ranks, m = 1;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    size_t size = quick ? 16 << 20 : 256 << 20;
+    std::string domain = dir + "/domain-" + std::to_string(rank);
+    mkdir(domain.c_str(), 0755);
+    std::string cfg_file = write_config(domain, "ec", "mode = async\nec_engine = native\nec_parity = 1\n");
+    config_t cfg(cfg_file);
+    std::vector<command_t> cmds = {command_t(rank, command_t::CHECKPOINT, 1, "ec_bench")};
+    std::string fname = cmds[0].filename(cfg.get_scratch());
+    {
+	std::vector<char> buffer(size, (char)rank);
+	std::ofstream f(fname, std::ofstream::binary);
+	f.write(buffer.data(), buffer.size());
+    }
+
+    double native_time = 0, er_time = 0;
+    int native_status, er_status = VELOC_FAILURE;
+    {
+	rs_module_t native(cfg, MPI_COMM_WORLD);
+	MPI_Barrier(MPI_COMM_WORLD);
+	auto start = bench_clock_t::now();
+	native_status = native.process_commands(cmds);
+	MPI_Barrier(MPI_COMM_WORLD);
+	native_time = elapsed(start);
+    }
+    if (ER_Init(cfg_file.c_str()) == ER_SUCCESS) {
+	int scheme = ER_Create_Scheme(MPI_COMM_WORLD, ("domain-" + std::to_string(rank)).c_str(), ranks - m, m);
+	std::string name = cfg.get_scratch() + "/ec_bench-er-1";
+	MPI_Barrier(MPI_COMM_WORLD);
+	auto start = bench_clock_t::now();
+	int set = scheme < 0 ? -1 : ER_Create(MPI_COMM_WORLD, MPI_COMM_SELF, name.c_str(), ER_DIRECTION_ENCODE, scheme);
+	if (set != -1) {
+	    ER_Add(set, fname.c_str());
+	    ER_Dispatch(set);
+	    er_status = ER_Wait(set) == ER_SUCCESS ? VELOC_SUCCESS : VELOC_FAILURE;
+	    ER_Free(set);
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+	er_time = elapsed(start);
+	if (scheme >= 0)
+	    ER_Free_Scheme(scheme);
+	ER_Finalize();
+    }
+    double total = (double)size * ranks;
+    report.add("ec_encode", {{"domains", (double)ranks}, {"m", (double)m}, {"bytes_per_domain", (double)size}},
+	       {{"native_gb_s", total / native_time / 1e9}, {"native_status", (double)native_status},
+		{"er_gb_s", er_status == VELOC_SUCCESS ? total / er_time / 1e9 : 0}, {"er_status", (double)er_status}});
+}
+
+int main(int argc, char *argv[]) {
+    std::string filter, output, address = "tcp://127.0.0.1:1240", dir = "/tmp/veloc-bench-" + std::to_string(getpid());
+    bool quick = false;
+
+    for (int i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "--quick"))
+	    quick = true;
+	else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+	    filter = argv[++i];
+	else if (!strcmp(argv[i], "--output") && i + 1 < argc)
+	    output = argv[++i];
+	else if (!strcmp(argv[i], "--address") && i + 1 < argc)
+	    address = argv[++i];
+	else if (!strcmp(argv[i], "--dir") && i + 1 < argc)
+	    dir = argv[++i];
+	else {
+	    std::cout << "Usage: " << argv[0] << " [--quick] [--filter checkpoint|queue|notify|transfer|ec] "
+		      << "[--output <file.json>] [--address <thallium_address>] [--dir <work_dir>]" << std::endl;
+	    return 1;
+	}
+    }
+    MPI_Init(&argc, &argv);
+    // with several processes (mpirun -np <k + m> on one node), only the distributed EC benchmark makes sense
+    int rank, ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    auto selected = [&filter, ranks](const std::string &name) {
+	return (filter.empty() || name.find(filter) != std::string::npos) && (ranks == 1 || name == "ec");
+    };
+
+    mkdir(dir.c_str(), 0755);
+    report_t report;
+    try {
+	std::string sync_cfg = write_config(dir, "sync", "mode = sync\nec_interval = -1\npersistent_interval = -1\n");
+	std::string flush_cfg = write_config(dir, "flush", "mode = async\nec_interval = -1\npersistent_interval = 0\n");
+	std::string noflush_cfg = write_config(dir, "noflush", "mode = async\nec_interval = -1\npersistent_interval = -1\n");
+	if (selected("checkpoint"))
+	    bench_checkpoint(report, sync_cfg, quick);
+	if (selected("queue"))
+	    bench_queue(report, address, quick);
+	if (selected("notify"))
+	    bench_notify(report, config_t(noflush_cfg), quick);
+	if (selected("transfer"))
+	    bench_transfer(report, config_t(flush_cfg), quick);
+	if (selected("ec") && ranks == 1)
+	    bench_ec_codec(report, quick);
+	if (selected("ec") && ranks > 1)
+	    bench_ec_distributed(report, dir, quick);
+    } catch (std::exception &e) {
+	std::cerr << "benchmark failed: " << e.what() << std::endl;
+    }
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+
+    if (rank == 0 && output.empty())
+	report.write(std::cout);
+    else if (rank == 0) {
+	std::ofstream f(output);
+	report.write(f);
+    }
+    MPI_Finalize();
+    return 0;
+}
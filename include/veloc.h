@@ -2,6 +2,7 @@
 #define __VELOC_H
 
 #include <string.h>
+#include <sys/uio.h>
 #include <mpi.h>
 
 /*---------------------------------------------------------------------------
@@ -24,6 +25,10 @@
 #define VELOC_RECOVER_SOME (1)
 #define VELOC_RECOVER_REST (2)
 
+#define VELOC_PHASE_COMPUTE (0)
+#define VELOC_PHASE_COMMUNICATE (1)
+#define VELOC_PHASE_IO (2)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -56,6 +61,20 @@ int VELOC_Finalize(int cleanup);
 //   IN base_size - size of each element in memory region
 int VELOC_Mem_protect(int id, void *ptr, size_t count, size_t base_size);
 
+// registers a strided memory region (e.g. an array section), only the blocks are saved
+//   IN id         - application defined integer label for memory region
+//   IN base       - pointer to the first block
+//   IN count      - number of blocks
+//   IN block_size - size of each block in bytes
+//   IN stride     - distance in bytes between the start of consecutive blocks (>= block_size)
+int VELOC_Mem_protect_strided(int id, void *base, size_t count, size_t block_size, size_t stride);
+
+// registers a memory region made of several segments, saved one after the other
+//   IN id         - application defined integer label for memory region
+//   IN iov        - array of segments (address and length in bytes)
+//   IN iovcnt     - number of segments
+int VELOC_Mem_protect_iov(int id, const struct iovec *iov, int iovcnt);
+
 // unregisters a memory region
 //   IN id        - application defined integer label for memory region
 int VELOC_Mem_unprotect(int id);
@@ -90,6 +109,11 @@ int VELOC_Checkpoint_end(int success);
 // Only valid in async mode. Typically called before beginning a new checkpoint.
 int VELOC_Checkpoint_wait();
 
+// Number of checkpoint requests of the calling process that are not yet finished by the backend.
+// Always 0 in sync mode.
+//   OUT depth - the number of unfinished requests
+int VELOC_Checkpoint_queue_depth(int *depth);
+
 int VELOC_Checkpoint(const char *name, int version);
     
 /**************************
@@ -124,6 +148,15 @@ int VELOC_Recover_mem();
 int VELOC_Restart_end(int success);
 
 int VELOC_Restart(const char *name, int version);
+
+/**************************
+ * Phase hints
+ *************************/
+
+// tell the backend which phase the application enters, so that it flushes the checkpoints when they disturb it
+// least: the flushes pause during communication and I/O phases, and go at full speed during compute phases
+//   IN phase - VELOC_PHASE_COMPUTE, VELOC_PHASE_COMMUNICATE or VELOC_PHASE_IO
+int VELOC_Hint_phase(int phase);
     
 #ifdef __cplusplus
 }
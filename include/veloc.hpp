@@ -0,0 +1,107 @@
+#ifndef __VELOC_HPP
+#define __VELOC_HPP
+
+#include "veloc.h"
+
+#include <vector>
+#include <array>
+#include <iterator>
+#include <type_traits>
+#include <sys/uio.h>
+
+#if __cplusplus > 201703L && __has_include(<span>)
+#include <span>
+#endif
+
+/*---------------------------------------------------------------------------
+                           VELOC C++ interface
+---------------------------------------------------------------------------*/
+
+// Typed memory registration on top of the C interface. A region can be made of several segments (e.g. the
+// rows of a std::vector<std::vector<T>> or the arrays of a structure of arrays): they are written into the
+// checkpoint one after the other with gather I/O and read back with scatter I/O, without packing them into a
+// temporary buffer. Like VELOC_Mem_protect, the addresses are captured at registration time: protect the
+// region again after resizing any of its containers.
+
+namespace veloc {
+
+#if defined(__cpp_lib_span)
+template <class T> using span = std::span<T>;
+#else
+// minimal replacement for std::span (C++20)
+template <class T> class span {
+    T *ptr = nullptr;
+    size_t len = 0;
+public:
+    span() = default;
+    span(T *p, size_t n) : ptr(p), len(n) { }
+    template <class C, class = decltype(std::data(std::declval<C &>()))>
+    span(C &c) : ptr(std::data(c)), len(std::size(c)) { }
+    T *data() const {
+	return ptr;
+    }
+    size_t size() const {
+	return len;
+    }
+    size_t size_bytes() const {
+	return len * sizeof(T);
+    }
+};
+#endif
+
+namespace detail {
+// implemented by the client library
+int mem_protect_segments(int id, const struct iovec *segments, size_t no_segments);
+
+template <class T> void check_type() {
+    static_assert(std::is_trivially_copyable<T>::value, "VELOC can only protect trivially copyable types");
+}
+
+template <class T> struct iovec segment(span<T> s) {
+    check_type<typename std::remove_cv<T>::type>();
+    return {(void *)s.data(), s.size_bytes()};
+}
+}
+
+// registers a contiguous range of elements
+template <class T> int protect(int id, span<T> s) {
+    struct iovec seg = detail::segment(s);
+    return detail::mem_protect_segments(id, &seg, 1);
+}
+
+template <class T> int protect(int id, T *ptr, size_t count) {
+    return protect(id, span<T>(ptr, count));
+}
+
+template <class T> int protect(int id, std::vector<T> &v) {
+    return protect(id, span<T>(v.data(), v.size()));
+}
+
+// registers a single object
+template <class T> int protect(int id, T &obj) {
+    return protect(id, span<T>(&obj, 1));
+}
+
+// registers a list of vectors as a single region made of one segment per vector
+template <class T> int protect(int id, std::vector<std::vector<T> > &vv) {
+    detail::check_type<T>();
+    std::vector<struct iovec> segs;
+    segs.reserve(vv.size());
+    for (auto &v : vv)
+	segs.push_back(detail::segment(span<T>(v.data(), v.size())));
+    return detail::mem_protect_segments(id, segs.data(), segs.size());
+}
+
+// registers several arrays (e.g. the members of a structure of arrays) as a single region
+template <class T, class... Ts> int protect_all(int id, span<T> first, span<Ts>... rest) {
+    std::array<struct iovec, 1 + sizeof...(Ts)> segs = {{detail::segment(first), detail::segment(rest)...}};
+    return detail::mem_protect_segments(id, segs.data(), segs.size());
+}
+
+inline int unprotect(int id) {
+    return VELOC_Mem_unprotect(id);
+}
+
+}
+
+#endif /* ----- #ifndef __VELOC_HPP  ----- */
@@ -1,14 +1,21 @@
 #include "common/config.hpp"
 #include "common/command.hpp"
 #include "common/ipc_queue.hpp"
+#include "common/command_log.hpp"
+#include "common/stream_writer.hpp"
+#include "common/journal.hpp"
 
 #include "modules/module_manager.hpp"
 
-#include <queue>
-#include <future>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/stat.h>
 #define __DEBUG
 #include "common/debug.hpp"
 const unsigned int MAX_PARALLELISM = 64;
+const size_t STAGING_BLOCK_SIZE = 2 << 20;
 typedef std::function<int (void)> ft;
 int main(int argc, char *argv[]) {
 	bool ec_active = true;
@@ -31,42 +38,200 @@ int main(int argc, char *argv[]) {
 	if (ec_active) {
 	}
 
+	std::string trace_dir;
+	if (cfg.get_optional("trace_dir", trace_dir)) {
+		int trace_interval;
+		if (!cfg.get_optional("trace_interval", trace_interval))
+			trace_interval = 100;
+		veloc_trace::init(trace_dir, trace_interval);
+	}
+
 	veloc_ipc::cleanup();
-	tl::engine myServ("tcp://127.0.0.1:1234",THALLIUM_SERVER_MODE);
+	// RPC handlers and commands run as ULTs on their own execution streams: a client waiting for completion only
+	// parks its ULT, while the progress loop and the other handlers keep going
+	int rpc_threads, worker_threads;
+	if (!cfg.get_optional("rpc_threads", rpc_threads) || rpc_threads <= 0)
+		rpc_threads = 4;
+	if (!cfg.get_optional("worker_threads", worker_threads) || worker_threads <= 0)
+		worker_threads = 16;
+	worker_threads = std::min(worker_threads, (int)MAX_PARALLELISM);
+	tl::engine myServ("tcp://127.0.0.1:1234",THALLIUM_SERVER_MODE,true,rpc_threads);
 	uint16_t provider_id=22;
-	std::cout<<"Server before running at"<<myServ.self()<<std::endl; 
+	INFO("backend listening at " << myServ.self() << " with " << rpc_threads << " handler and "
+	     << worker_threads << " worker execution streams");
 	veloc_ipc::shm_queue_t<command_t> command_queue(myServ,provider_id);
-	int hah=command_queue.get();
-	std::cout<<"non RPC call"<<hah<<std::endl;	
+	// checkpoint requests beyond the capacity of the queue are throttled according to queue_full_policy
+	int queue_capacity, queue_global_capacity;
+	if (!cfg.get_optional("queue_capacity", queue_capacity) || queue_capacity < 0)
+		queue_capacity = 64;
+	if (!cfg.get_optional("queue_global_capacity", queue_global_capacity) || queue_global_capacity < 0)
+		queue_global_capacity = 0;
+	std::string policy_name = "block";
+	veloc_ipc::full_policy_t full_policy = veloc_ipc::BLOCK_WHEN_FULL;
+	if (cfg.get_optional("queue_full_policy", policy_name) && !veloc_ipc::parse_full_policy(policy_name, full_policy))
+		ERROR("unknown queue_full_policy " << policy_name << ", requests will wait for room instead");
+	command_queue.set_capacity(queue_capacity, queue_global_capacity, full_policy);
+	tl::managed<tl::pool> workers = tl::pool::create(tl::pool::access::mpmc);
+	std::vector<tl::managed<tl::xstream> > worker_streams;
+	for (int i = 0; i < worker_threads; i++)
+		worker_streams.push_back(tl::xstream::create(tl::scheduler::predef::basic_wait, *workers));
+	// restarts and tests have execution streams of their own, so that they never wait behind the flushes, and
+	// so does the dispatcher
+	int interactive_threads;
+	if (!cfg.get_optional("interactive_threads", interactive_threads) || interactive_threads <= 0)
+		interactive_threads = 2;
+	tl::managed<tl::pool> interactive = tl::pool::create(tl::pool::access::mpmc),
+		dispatch = tl::pool::create(tl::pool::access::mpmc);
+	for (int i = 0; i < interactive_threads; i++)
+		worker_streams.push_back(tl::xstream::create(tl::scheduler::predef::basic_wait, *interactive));
+	worker_streams.push_back(tl::xstream::create(tl::scheduler::predef::basic_wait, *dispatch));
+	int priority_aging;
+	if (cfg.get_optional("priority_aging", priority_aging) && priority_aging > 0)
+		command_queue.set_priority_aging(std::chrono::milliseconds(priority_aging));
 
+	staging_t staging;
+	int staging_size;
+	if (cfg.get_optional("staging_size", staging_size) && staging_size > 0) {
+		if (staging.create((size_t)staging_size << 20, STAGING_BLOCK_SIZE))
+			command_queue.set_staging_info(staging.get_info());
+		else
+			ERROR("cannot create staging arenas, clients will use the scratch directory only");
+	}
 
-	auto backend=[&command_queue,&argc,&argv](const config_t& cfg,bool ec_active){
+	// chunks of streamed checkpoints arrive in the staging arenas and are written straight to the persistent storage
+	stream_writer_t streamer(cfg);
+	myServ.define("stream_chunk", [&staging, &streamer](const tl::request &req, const command_t &c, size_t offset,
+							  int node, uint64_t buf, size_t len) {
+		staging_arena_t *arena = staging.get(node);
+		int ret = VELOC_FAILURE;
+		// the buffer comes from the client: it must be one the client allocated, within the arena
+		if (arena == NULL || !arena->allocated(buf, len))
+			ERROR("invalid chunk of " << c << " at offset " << offset << ": arena " << node << ", buffer " << buf
+			      << ", length " << len);
+		else {
+			ret = streamer.write(c, offset, {{arena->address(buf), len}});
+			arena->release(buf, len);
+		}
+		req.respond(ret);
+	});
+	myServ.define("stream_commit", [&streamer](const tl::request &req, const command_t &c, size_t size, bool success) {
+		req.respond(streamer.commit(c, size, success));
+	});
 
-		int rank;
-		MPI_Init(&argc, &argv);
-		MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-		DBG("Active backend rank = " << rank);
-		module_manager_t modules;
-		modules.add_default_modules(cfg, MPI_COMM_WORLD, ec_active);
-		std::queue<std::future<void> > work_queue;
-		command_t c;
-		while (true) {
-			std::cout<<"I am executing inside the loop"<<std::endl;
-			auto f=	command_queue.dequeue_any(c);
-			work_queue.push(std::async(std::launch::async, [=, &modules] {
-						f(modules.notify_command(c));
-						}));
-			if (work_queue.size() > MAX_PARALLELISM) {
-				work_queue.front().wait();
-				work_queue.pop();
-			}
+	// accepted commands and flush progress survive a crash of the backend, so that its successor can resume
+	std::unique_ptr<journal_t> journal;
+	std::string journal_file;
+	if (cfg.get_optional("journal_file", journal_file)) {
+		int journal_size;
+		if (!cfg.get_optional("journal_size", journal_size) || journal_size <= 0)
+			journal_size = 16;
+		journal.reset(new journal_t(journal_file, (size_t)journal_size << 20));
+		INFO("journaling accepted commands and flush progress to " << journal_file);
+	}
+
+	std::unique_ptr<command_log_t> command_log;
+	std::string log_file;
+	if (cfg.get_optional("record_commands", log_file)) {
+		command_log.reset(new command_log_t(log_file));
+		INFO("recording command stream to " << log_file);
+	}
+	auto record = [&cfg, &command_log, &journal](const command_t &c) {
+		if (journal)
+			journal->accepted(c);
+		if (command_log) {
+			struct stat st;
+			size_t size = 0;
+			if (c.command == command_t::CHECKPOINT && stat(c.filename(cfg.get_scratch()).c_str(), &st) == 0)
+				size = st.st_size;
+			command_log->append(c, size);
 		}
+	};
+	if (journal || command_log)
+		command_queue.set_enqueue_hook(record);
 
 
+	// polls the configuration file for changes, until the backend shuts down
+	std::thread reload_thread;
+	std::mutex reload_mutex;
+	std::condition_variable reload_cond;
+	bool reload_stopping = false;
 
+	auto backend=[&cfg,&command_queue,&journal,&workers,&interactive,&dispatch,worker_threads,record,&argc,&argv,
+		      &reload_thread,&reload_mutex,&reload_cond,&reload_stopping](bool ec_active){
+
+		int rank, provided;
+		// the modules, the aggregators and the flushes of different clients issue MPI calls from several threads
+		MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+		MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+		if (provided != MPI_THREAD_MULTIPLE) {
+			ERROR("the MPI library does not support MPI_THREAD_MULTIPLE, which the backend requires");
+			MPI_Abort(MPI_COMM_WORLD, 4);
+		}
+		DBG("Active backend rank = " << rank);
+		std::shared_ptr<module_manager_t> modules(new module_manager_t());
+		modules->add_default_modules(cfg, MPI_COMM_WORLD, ec_active);
+		modules->set_journal(journal.get());
+		// the modules learn about new commands as soon as they are accepted, e.g. to cancel superseded flushes
+		command_queue.set_enqueue_hook([record, modules](const command_t &c) {
+			record(c);
+			modules->announce(c);
+		});
+		command_queue.set_stats_hook([modules](backend_stats_t &s) { modules->get_stats(s); });
+		command_queue.set_heartbeat_hook([modules](int id) { modules->heartbeat(id); });
+		command_queue.set_phase_hook([modules](int id, int phase, uint64_t seq) { modules->hint_phase(id, phase, seq); });
+		auto reload = [cfg, modules]() {
+			if (!cfg.reload())
+				return VELOC_FAILURE;
+			modules->set_parallelism(cfg.get_tuning().module_threads);
+			return VELOC_SUCCESS;
+		};
+		command_queue.set_reload_hook(reload);
+		int reload_interval;
+		if (cfg.get_optional("reload_interval", reload_interval) && reload_interval > 0) {
+			// poll the configuration file and reload the tuning parameters when it changes
+			reload_thread = std::thread([cfg, reload, reload_interval, &reload_mutex, &reload_cond, &reload_stopping]() {
+				struct stat st;
+				time_t last = stat(cfg.get_cfg_file().c_str(), &st) == 0 ? st.st_mtime : 0;
+				std::unique_lock<std::mutex> lock(reload_mutex);
+				while (!reload_cond.wait_for(lock, std::chrono::seconds(reload_interval),
+							     [&reload_stopping] { return reload_stopping; })) {
+					if (stat(cfg.get_cfg_file().c_str(), &st) == 0 && st.st_mtime != last) {
+						last = st.st_mtime;
+						lock.unlock();
+						reload();
+						lock.lock();
+					}
+				}
+			});
+		}
+		// the dispatcher hands every interactive command to a ULT of the interactive pool and every checkpoint to a
+		// ULT of the worker pool; the queue holds back the checkpoints while all the worker execution streams are busy
+		command_queue.set_max_inflight(worker_threads);
+		dispatch->make_thread([modules, &command_queue, &journal, &workers, &interactive]() {
+			command_t c;
+			while (true) {
+				auto f = command_queue.dequeue_any(c);
+				auto &pool = c.priority() == command_t::INTERACTIVE ? interactive : workers;
+				pool->make_thread([=, &journal] {
+					int status = modules->notify_command(c);
+					if (journal)
+						journal->completed(c);
+					f(status);
+				}, tl::anonymous());
+			}
+		}, tl::anonymous());
 	};
-	std::thread back(backend,cfg,ec_active);
-	back.detach();
+	std::thread back(backend,ec_active);
+	// keep the queue alive for the backend thread until the engine is shut down
+	myServ.wait_for_finalize();
+	// the backend thread only sets up the dispatcher and the reload thread, it is done by now
+	back.join();
+	std::unique_lock<std::mutex> lock(reload_mutex);
+	reload_stopping = true;
+	reload_cond.notify_one();
+	lock.unlock();
+	if (reload_thread.joinable())
+		reload_thread.join();
 	//		if (ec_active) {
 	//		MPI_Finalize();
 	//	}
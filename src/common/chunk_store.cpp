@@ -0,0 +1,345 @@
+#include "chunk_store.hpp"
+#include "sha256.hpp"
+#include "status.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <limits.h>
+
+//#define __DEBUG
+#include "debug.hpp"
+
+static const std::string MANIFEST_MAGIC = "veloc-manifest 1";
+
+// random values for the gear hash, the same on every node so that chunk boundaries agree
+static const uint64_t *gear_table() {
+    static uint64_t table[256];
+    static std::once_flag once;
+    std::call_once(once, [] {
+	uint64_t x = 0x9e3779b97f4a7c15ull;
+	for (auto &g : table) {
+	    // splitmix64
+	    uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+	    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	    g = z ^ (z >> 31);
+	}
+    });
+    return table;
+}
+
+static void mkdirs(const std::string &dir) {
+    for (size_t pos = dir.find('/', 1); ; pos = dir.find('/', pos + 1)) {
+	mkdir(dir.substr(0, pos).c_str(), 0755);
+	if (pos == std::string::npos)
+	    break;
+    }
+}
+
+static bool copy_file(int fi, int fo, size_t size) {
+    for (size_t remaining = size; remaining > 0; ) {
+	ssize_t transferred = sendfile(fo, fi, NULL, remaining);
+	if (transferred <= 0)
+	    return false;
+	remaining -= transferred;
+    }
+    return true;
+}
+
+static std::string hidden(const std::string &fname, const std::string &suffix) {
+    size_t slash = fname.rfind('/');
+    return fname.substr(0, slash + 1) + "." + fname.substr(slash + 1) + suffix;
+}
+
+chunk_store_t::chunk_store_t(const config_t &cfg) : persistent(cfg.get_persistent()), scratch(cfg.get_scratch()) {
+    std::string mode;
+    if (!cfg.get_optional("dedup", mode) || mode == "none")
+	return;
+    char host[HOST_NAME_MAX + 1] = "localhost";
+    gethostname(host, HOST_NAME_MAX);
+    if (mode == "node")
+	root = std::string(".chunks/") + host;
+    else if (mode == "job")
+	root = ".chunks/job";
+    else {
+	ERROR("dedup = " << mode << " is invalid, must be one of none, node, job; deduplication deactivated");
+	return;
+    }
+    int avg_size;
+    if (!cfg.get_optional("dedup_chunk_size", avg_size) || avg_size < 4096)
+	avg_size = 1 << 20;
+    // chunk sizes are in [avg / 4, avg * 4], a boundary is found with probability 1 / (avg - min) at each byte
+    min_size = avg_size / 4;
+    max_size = (size_t)avg_size * 4;
+    threshold = std::numeric_limits<uint64_t>::max() / (avg_size - min_size);
+    mkdirs(persistent + "/" + root);
+    private_store = mode == "node";
+    if (!private_store)
+	return;
+    // the node owns its store and collects the chunks no longer referenced by the manifests
+    DIR *dir = opendir(persistent.c_str());
+    if (dir == NULL)
+	return;
+    struct dirent *dentry;
+    while ((dentry = readdir(dir)) != NULL) {
+	std::string fname(dentry->d_name);
+	size_t size;
+	std::vector<chunk_t> chunks;
+	if (fname.size() > manifest_name("").size() && fname[0] != '.' &&
+	    fname.compare(fname.size() - manifest_name("").size(), std::string::npos, manifest_name("")) == 0 &&
+	    read_manifest(persistent + "/" + fname, size, chunks))
+	    for (auto &chunk : chunks)
+		if (chunk.path.compare(0, root.size() + 1, root + "/") == 0)
+		    refs[chunk.path]++;
+    }
+    closedir(dir);
+    INFO("node chunk store " << root << " holds " << refs.size() << " referenced chunks");
+}
+
+bool chunk_store_t::read_manifest(const std::string &manifest, size_t &size, std::vector<chunk_t> &chunks) {
+    std::ifstream f(manifest);
+    std::string magic;
+    size_t count, total = 0;
+    if (!std::getline(f, magic) || magic != MANIFEST_MAGIC || !(f >> size >> count))
+	return false;
+    chunks.resize(count);
+    for (auto &chunk : chunks) {
+	if (!(f >> chunk.path >> chunk.size))
+	    return false;
+	total += chunk.size;
+    }
+    return total == size;
+}
+
+bool chunk_store_t::store_chunk(const std::string &path, const char *data, size_t size, bool &written) {
+    std::promise<bool> promise;
+    std::shared_future<bool> done;
+    {
+	std::unique_lock<std::mutex> lock(store_mutex);
+	// the reference is taken first, so that the chunk cannot be collected meanwhile
+	if (private_store)
+	    refs[path]++;
+	auto it = stored.find(path);
+	if (it != stored.end())
+	    done = it->second;
+	else
+	    stored[path] = promise.get_future().share();
+    }
+    written = false;
+    if (done.valid())
+	return done.get();
+
+    // another node, or a previous backend, may have stored the chunk already
+    std::string fname = persistent + "/" + path;
+    struct stat st;
+    bool success = stat(fname.c_str(), &st) == 0 && (size_t)st.st_size == size;
+    if (!success) {
+	char host[HOST_NAME_MAX + 1] = "localhost";
+	gethostname(host, HOST_NAME_MAX);
+	std::string tmp = hidden(fname, "." + std::string(host) + "." + std::to_string(getpid()) + ".tmp");
+	mkdirs(fname.substr(0, fname.rfind('/')));
+	int fd = open(tmp.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	success = fd != -1;
+	for (size_t offset = 0; success && offset < size; ) {
+	    ssize_t ret = write(fd, data + offset, size - offset);
+	    if (ret <= 0)
+		success = false;
+	    else
+		offset += ret;
+	}
+	if (fd != -1 && close(fd) != 0)
+	    success = false;
+	// chunks are immutable: a concurrent writer on another node renames the same content
+	if (success && rename(tmp.c_str(), fname.c_str()) != 0)
+	    success = false;
+	if (!success) {
+	    ERROR("cannot store chunk " << fname << ", error = " << std::strerror(errno));
+	    unlink(tmp.c_str());
+	}
+	written = success;
+    }
+    if (!success) {
+	std::unique_lock<std::mutex> lock(store_mutex);
+	stored.erase(path);
+    }
+    promise.set_value(success);
+    return success;
+}
+
+int chunk_store_t::flush(const std::string &source, const std::string &manifest) {
+    int fd = open(source.c_str(), O_RDONLY);
+    if (fd == -1) {
+	ERROR("cannot open source " << source << ", error = " << std::strerror(errno));
+	return VELOC_FAILURE;
+    }
+    struct stat st;
+    char *data = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+	data = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+	    data = NULL;
+	else
+	    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    size_t size = st.st_size;
+    if (size > 0 && data == NULL) {
+	ERROR("cannot map source " << source << ", error = " << std::strerror(errno));
+	return VELOC_FAILURE;
+    }
+
+    const uint64_t *gear = gear_table();
+    std::vector<chunk_t> chunks;
+    bool success = true;
+    for (size_t start = 0; success && start < size; ) {
+	size_t end = std::min(start + max_size, size), i = std::min(start + min_size, end);
+	// gear hash: the top bits depend on the last 64 bytes
+	for (uint64_t h = 0; i < end; i++) {
+	    h = (h << 1) + gear[(unsigned char)data[i]];
+	    if (h < threshold) {
+		i++;
+		break;
+	    }
+	}
+	std::string hash = sha256_t::hex_digest(data + start, i - start);
+	chunk_t chunk = {root + "/" + hash.substr(0, 2) + "/" + hash, i - start};
+	bool written;
+	success = store_chunk(chunk.path, data + start, chunk.size, written);
+	chunks.push_back(chunk);
+	if (success && !written)
+	    bytes_deduplicated += chunk.size;
+	start = i;
+    }
+    if (data != NULL)
+	munmap(data, size);
+
+    size_t old_size;
+    std::vector<chunk_t> old_chunks;
+    if (!read_manifest(manifest, old_size, old_chunks))
+	old_chunks.clear();
+    if (success) {
+	std::string tmp = hidden(manifest, ".tmp");
+	std::ofstream f(tmp, std::ofstream::trunc);
+	f << MANIFEST_MAGIC << "\n" << size << " " << chunks.size() << "\n";
+	for (auto &chunk : chunks)
+	    f << chunk.path << " " << chunk.size << "\n";
+	f.close();
+	success = f.good() && rename(tmp.c_str(), manifest.c_str()) == 0;
+	if (!success) {
+	    ERROR("cannot write manifest " << manifest << ", error = " << std::strerror(errno));
+	    unlink(tmp.c_str());
+	}
+    }
+    // a manifest that was replaced no longer references its chunks, a failed one never will
+    release(success ? old_chunks : chunks);
+    DBG("flushed " << source << " as " << chunks.size() << " chunks");
+    return success ? VELOC_SUCCESS : VELOC_FAILURE;
+}
+
+void chunk_store_t::release(const std::vector<chunk_t> &chunks) {
+    std::unique_lock<std::mutex> lock(store_mutex);
+    for (auto &chunk : chunks) {
+	auto it = refs.find(chunk.path);
+	if (it == refs.end() || --it->second > 0)
+	    continue;
+	refs.erase(it);
+	stored.erase(chunk.path);
+	unlink((persistent + "/" + chunk.path).c_str());
+    }
+}
+
+void chunk_store_t::remove(const std::string &manifest) {
+    size_t size;
+    std::vector<chunk_t> chunks;
+    bool found = read_manifest(manifest, size, chunks);
+    unlink(manifest.c_str());
+    if (found)
+	release(chunks);
+}
+
+bool chunk_store_t::fetch_chunk(const std::string &path) {
+    std::promise<bool> promise;
+    std::shared_future<bool> done;
+    {
+	std::unique_lock<std::mutex> lock(store_mutex);
+	auto it = cached.find(path);
+	if (it != cached.end())
+	    done = it->second;
+	else
+	    cached[path] = promise.get_future().share();
+    }
+    if (done.valid())
+	return done.get();
+
+    std::string source = persistent + "/" + path, dest = scratch + "/.chunks/" + path.substr(path.rfind('/') + 1);
+    std::string tmp = hidden(dest, ".tmp");
+    mkdir((scratch + "/.chunks").c_str(), 0755);
+    struct stat st;
+    int fi = open(source.c_str(), O_RDONLY), fo = open(tmp.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    bool success = fi != -1 && fo != -1 && fstat(fi, &st) == 0 && copy_file(fi, fo, st.st_size);
+    if (fi != -1)
+	close(fi);
+    if (fo != -1 && close(fo) != 0)
+	success = false;
+    if (success && rename(tmp.c_str(), dest.c_str()) != 0)
+	success = false;
+    if (!success) {
+	ERROR("cannot fetch chunk " << source << ", error = " << std::strerror(errno));
+	unlink(tmp.c_str());
+	std::unique_lock<std::mutex> lock(store_mutex);
+	cached.erase(path);
+    }
+    promise.set_value(success);
+    return success;
+}
+
+int chunk_store_t::restore(const std::string &manifest, const std::string &dest) {
+    size_t size;
+    std::vector<chunk_t> chunks;
+    if (!read_manifest(manifest, size, chunks)) {
+	ERROR("manifest " << manifest << " is missing or corrupted");
+	return VELOC_FAILURE;
+    }
+    std::string tmp = hidden(dest, ".partial");
+    int fo = open(tmp.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    bool success = fo != -1;
+    for (auto &chunk : chunks) {
+	if (!success || !fetch_chunk(chunk.path)) {
+	    success = false;
+	    break;
+	}
+	int fi = open((scratch + "/.chunks/" + chunk.path.substr(chunk.path.rfind('/') + 1)).c_str(), O_RDONLY);
+	success = fi != -1 && copy_file(fi, fo, chunk.size);
+	if (fi != -1)
+	    close(fi);
+    }
+    if (fo != -1 && close(fo) != 0)
+	success = false;
+    if (success && rename(tmp.c_str(), dest.c_str()) != 0)
+	success = false;
+    if (!success) {
+	ERROR("cannot restore " << dest << " from manifest " << manifest << ", error = " << std::strerror(errno));
+	unlink(tmp.c_str());
+	return VELOC_FAILURE;
+    }
+    return VELOC_SUCCESS;
+}
+
+void chunk_store_t::clear_cache() {
+    std::unique_lock<std::mutex> lock(store_mutex);
+    for (auto it = cached.begin(); it != cached.end(); )
+	// chunks still being fetched are left to their restart
+	if (it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+	    unlink((scratch + "/.chunks/" + it->first.substr(it->first.rfind('/') + 1)).c_str());
+	    it = cached.erase(it);
+	} else
+	    it++;
+}
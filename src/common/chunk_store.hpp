@@ -0,0 +1,59 @@
+#ifndef __CHUNK_STORE_HPP
+#define __CHUNK_STORE_HPP
+
+#include "config.hpp"
+
+#include <map>
+#include <mutex>
+#include <future>
+#include <atomic>
+#include <vector>
+
+// Content-addressed store of checkpoint chunks on the persistent storage. A flushed checkpoint is cut into
+// content-defined chunks (so that identical data is found even at different offsets) and each chunk is stored
+// once under its SHA-256; a manifest next to the checkpoint lists its chunks. The store is either private to
+// the node (dedup = node) or shared by all the nodes of the job (dedup = job). On restart, every chunk is
+// fetched once per node into a cache in the scratch directory, from which the checkpoints are assembled.
+class chunk_store_t {
+    struct chunk_t {
+	std::string path;
+	size_t size;
+    };
+    std::string persistent, scratch, root;
+    bool private_store = false;
+    size_t min_size = 0, max_size = 0;
+    uint64_t threshold = 0;
+    std::mutex store_mutex;
+    // chunks known to be on the persistent storage and chunks fetched into the cache, by path
+    std::map<std::string, std::shared_future<bool> > stored, cached;
+    // references from the manifests of the node to the chunks of a private store, to collect them
+    std::map<std::string, int> refs;
+    std::atomic<uint64_t> bytes_deduplicated{0};
+
+    bool store_chunk(const std::string &path, const char *data, size_t size, bool &written);
+    bool fetch_chunk(const std::string &path);
+    void release(const std::vector<chunk_t> &chunks);
+    static bool read_manifest(const std::string &manifest, size_t &size, std::vector<chunk_t> &chunks);
+public:
+    chunk_store_t(const config_t &cfg);
+    bool enabled() const {
+	return !root.empty();
+    }
+    // writes the chunks of source missing from the store, then the manifest (atomically)
+    int flush(const std::string &source, const std::string &manifest);
+    // assembles dest from the chunks listed in the manifest
+    int restore(const std::string &manifest, const std::string &dest);
+    // removes the manifest and, in a private store, the chunks no other manifest references
+    void remove(const std::string &manifest);
+    // empties the restart cache
+    void clear_cache();
+    uint64_t get_bytes_deduplicated() const {
+	return bytes_deduplicated;
+    }
+
+    static std::string manifest_name(const std::string &fname) {
+	return fname + ".manifest";
+    }
+};
+
+#endif // __CHUNK_STORE_HPP
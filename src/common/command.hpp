@@ -9,9 +9,14 @@
 #include<thallium.hpp>
 class command_t {
 public:
-    static const int INIT = 0, CHECKPOINT = 1, RESTART = 2, TEST = 3;
+    static constexpr int INIT = 0, CHECKPOINT = 1, RESTART = 2, TEST = 3;
+    // flags: the checkpoint is not flushed to the persistent storage (set when the queue of the backend is full)
+    static constexpr int NO_PERSISTENT = 1;
+    // scheduling classes of the backend, most urgent first: a recovering application waits for the interactive
+    // commands, while the flushes of the checkpoints run in the background
+    static constexpr int INTERACTIVE = 0, FOREGROUND = 1;
     
-    int unique_id, command, version;
+    int unique_id, command, version, flags = 0;
     //char name[PATH_MAX] = {}, original[PATH_MAX] = {};
     std::string name;
     std::string original;
@@ -24,6 +29,9 @@ public:
 	    throw std::runtime_error("checkpoint name '" + src + "' is longer than admissible size " + std::to_string(PATH_MAX));
 	std::strcpy(dest, src.c_str());
     }
+    int priority() const {
+	return command == CHECKPOINT ? FOREGROUND : INTERACTIVE;
+    }
     std::string stem() const {
 	return /*std::string(name)*/name + "-" + std::to_string(unique_id) +
 	    "-" + std::to_string(version) + ".dat";
@@ -48,6 +56,7 @@ public:
 	ar& unique_id;
 	ar& command;
 	ar& version;
+	ar& flags;
     }
 };
 
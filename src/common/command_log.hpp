@@ -0,0 +1,57 @@
+#ifndef __COMMAND_LOG_HPP
+#define __COMMAND_LOG_HPP
+
+#include "command.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <chrono>
+#include <vector>
+
+// text log of the commands accepted by the backend, one per line:
+//   <timestamp_us> <unique_id> <command> <version> <size> <name>
+// the size is the length of the scratch file at enqueue time (0 if unknown), so that a replay can recreate it
+struct command_record_t {
+    uint64_t ts;
+    size_t size;
+    command_t cmd;
+};
+
+class command_log_t {
+    std::ofstream out;
+    std::mutex log_mutex;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+public:
+    static constexpr const char *HEADER = "# veloc command log v1";
+
+    command_log_t(const std::string &fname) : out(fname, std::ofstream::out | std::ofstream::trunc) {
+	if (!out)
+	    throw std::runtime_error("cannot open command log " + fname);
+	out << HEADER << std::endl;
+    }
+    void append(const command_t &c, size_t size) {
+	uint64_t ts = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	std::unique_lock<std::mutex> lock(log_mutex);
+	out << ts << " " << c.unique_id << " " << c.command << " " << c.version << " " << size << " " << c.name << std::endl;
+    }
+    static std::vector<command_record_t> load(const std::string &fname) {
+	std::ifstream in(fname);
+	std::string line;
+	std::vector<command_record_t> records;
+	if (!in || !std::getline(in, line) || line != HEADER)
+	    throw std::runtime_error("cannot read command log " + fname);
+	while (std::getline(in, line)) {
+	    std::istringstream fields(line);
+	    command_record_t r;
+	    if (!(fields >> r.ts >> r.cmd.unique_id >> r.cmd.command >> r.cmd.version >> r.size))
+		continue;
+	    fields.get();
+	    std::getline(fields, r.cmd.name);
+	    records.push_back(r);
+	}
+	return records;
+    }
+};
+
+#endif // __COMMAND_LOG_HPP
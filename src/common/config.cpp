@@ -3,6 +3,7 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sstream>
 
 //#define __DEBUG
 #include "debug.hpp"
@@ -17,18 +18,70 @@ static bool check_dir(const std::string dir_name) {
 	return false;
 }
 
-config_t::config_t(const std::string &f) : cfg_file(f), reader(cfg_file) {
+bool config_t::parse_tuning(const INIReader &r, tuning_t &t, std::string &error) {
+    t.ec_interval = r.GetInteger("", "ec_interval", t.ec_interval);
+    t.persistent_interval = r.GetInteger("", "persistent_interval", t.persistent_interval);
+    t.partner_interval = r.GetInteger("", "partner_interval", t.partner_interval);
+    t.max_versions = r.GetInteger("", "max_versions", t.max_versions);
+    t.module_threads = r.GetInteger("", "module_threads", t.module_threads);
+    t.flush_bandwidth = r.GetInteger("", "flush_bandwidth", t.flush_bandwidth);
+    if (t.max_versions < 0)
+	error = "max_versions must be positive or 0";
+    else if (t.module_threads < 0)
+	error = "module_threads must be positive or 0";
+    else if (t.flush_bandwidth < 0)
+	error = "flush_bandwidth must be positive or 0";
+    return error.empty();
+}
+
+config_t::config_t(const std::string &f) : cfg_file(f), reader(cfg_file), shared(new shared_t()) {
     if (reader.ParseError() < 0)
 	throw std::runtime_error("cannot open config file " + cfg_file);
     if (reader.ParseError() > 0)
 	throw std::runtime_error("error parsing config file " + cfg_file + " at line " + std::to_string(reader.ParseError()));
     std::string val;
-    if (!check_dir(val = get("scratch")))
-	throw std::runtime_error("scratch directory " + val + " inaccessible!");
-    if (!check_dir(val = get("persistent")))
-	throw std::runtime_error("persistent directory " + val + " inaccessible!");
+    if (!check_dir(scratch = get("scratch")))
+	throw std::runtime_error("scratch directory " + scratch + " inaccessible!");
+    if (!check_dir(persistent = get("persistent")))
+	throw std::runtime_error("persistent directory " + persistent + " inaccessible!");
     val = get("mode");
     if (val != "sync" && val != "async")
 	throw std::runtime_error("mode of operation " + val + " is invalid, must be sync/async!");
     sync_mode = (val == "sync");
+    if (get_optional("stream_names", val)) {
+	for (auto &c : val)
+	    if (c == ',')
+		c = ' ';
+	std::istringstream names(val);
+	std::string name;
+	while (names >> name)
+	    stream_names.insert(name);
+    }
+    stream_scratch = reader.GetBoolean("", "stream_scratch", false);
+    std::string error;
+    std::shared_ptr<tuning_t> t(new tuning_t());
+    if (!parse_tuning(reader, *t, error))
+	throw std::runtime_error("invalid config file " + cfg_file + ": " + error);
+    shared->tuning = t;
+}
+
+bool config_t::reload() const {
+    INIReader r(cfg_file);
+    if (r.ParseError() != 0) {
+	ERROR("cannot reload config file " << cfg_file << ", parse error " << r.ParseError());
+	return false;
+    }
+    std::string error;
+    std::shared_ptr<tuning_t> t(new tuning_t());
+    if (!parse_tuning(r, *t, error)) {
+	ERROR("cannot reload config file " << cfg_file << ": " << error);
+	return false;
+    }
+    if (r.Get("", "scratch", "") != scratch || r.Get("", "persistent", "") != persistent ||
+	(r.Get("", "mode", "") == "sync") != sync_mode)
+	INFO("changes of scratch, persistent or mode require a restart and are ignored");
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->tuning = t;
+    INFO("config reloaded from " << cfg_file);
+    return true;
 }
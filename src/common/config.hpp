@@ -5,13 +5,44 @@
 
 #include <limits>
 #include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <set>
+
+// tuning parameters that can be changed while running by reloading the configuration file
+struct tuning_t {
+    int ec_interval = 0, persistent_interval = 0, partner_interval = -1, max_versions = 0, module_threads = 4;
+    // MB/s for all the flushes of a backend, 0 = unlimited
+    int flush_bandwidth = 0;
+};
 
 class config_t {
-    std::string cfg_file;
+    std::string cfg_file, scratch, persistent;
     INIReader reader;
-    bool sync_mode;
+    bool sync_mode, stream_scratch;
+    std::set<std::string> stream_names;
+    // shared by all copies of the configuration, so that a reload is seen by every module
+    struct shared_t {
+	std::mutex mutex;
+	std::shared_ptr<const tuning_t> tuning;
+    };
+    std::shared_ptr<shared_t> shared;
+
+    static bool parse_tuning(const INIReader &r, tuning_t &t, std::string &error);
 public:    
     config_t(const std::string &cfg_file);
+    // re-reads the tuning parameters from the configuration file, the current ones are kept on error
+    bool reload() const;
+    tuning_t get_tuning() const {
+	std::unique_lock<std::mutex> lock(shared->mutex);
+	return *shared->tuning;
+    }
+    const std::string &get_scratch() const {
+	return scratch;
+    }
+    const std::string &get_persistent() const {
+	return persistent;
+    }
     std::string get(const std::string &param) const {
 	std::string ret = reader.Get("", param, "");
 	if (ret.empty())
@@ -33,6 +64,14 @@ public:
     bool is_sync() const {
 	return sync_mode;
     }
+    // memory-based checkpoints with these names are streamed by the client straight to the persistent storage
+    bool is_streamed(const std::string &name) const {
+	return stream_names.count("*") > 0 || stream_names.count(name) > 0;
+    }
+    // whether the scratch directory holds a copy of the checkpoint (needed by EC and partner replication)
+    bool keeps_local(const std::string &name) const {
+	return stream_scratch || !is_streamed(name);
+    }
     const std::string &get_cfg_file() const {
 	return cfg_file;
     }
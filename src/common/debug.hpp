@@ -6,6 +6,8 @@
 #include <iostream>
 #include <chrono>
 
+#include "trace.hpp"
+
 #define safe_printf(...) {\
     char msg[1024];\
     sprintf(msg, __VA_ARGS__);\
@@ -13,11 +15,17 @@
 
 #ifdef __BENCHMARK
 #define TIMER_START(timer) auto timer = std::chrono::steady_clock::now();
+// when tracing is enabled, timers are recorded as binary SPAN events instead of being formatted into std::clog
 #define TIMER_STOP(timer, message) {\
         auto now = std::chrono::steady_clock::now();\
-	auto d = std::chrono::duration_cast<std::chrono::microseconds>(now - timer).count();\
-        auto t = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count(); \
-	std::clog << "[BENCHMARK " << t << "] [" << __FILE__ << ":" << __LINE__ << ":" << __FUNCTION__ << "] [time elapsed: " << d << " us] " << message << std::endl;\
+	if (veloc_trace::enabled.load(std::memory_order_relaxed)) {\
+	    auto begin = std::chrono::duration_cast<std::chrono::nanoseconds>(timer.time_since_epoch()).count();\
+	    veloc_trace::record(veloc_trace::SPAN, -1, -1, -1, __FUNCTION__, std::chrono::duration_cast<std::chrono::nanoseconds>(now - timer).count(), begin);\
+	} else {\
+	    auto d = std::chrono::duration_cast<std::chrono::microseconds>(now - timer).count();\
+	    auto t = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count(); \
+	    std::clog << "[BENCHMARK " << t << "] [" << __FILE__ << ":" << __LINE__ << ":" << __FUNCTION__ << "] [time elapsed: " << d << " us] " << message << std::endl;\
+	}\
     }
 #else
 #define TIMER_START(timer)
@@ -28,6 +36,11 @@
     out << "[" << level << " " << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() << "] [" \
         << __FILE__ << ":" << __LINE__ << ":" << __FUNCTION__ << "] " << message << std::endl
 
+// when tracing is enabled, debug and informational messages become binary LOG events that only keep the function and
+// the line, so that their text is not formatted on the hot paths; errors are written to std::clog in any case
+#define LOG_MESSAGE(level, name, message)\
+    (veloc_trace::enabled.load(std::memory_order_relaxed) ? TRACE_LOG(level) : (void)(MESSAGE(std::clog, name, message)))
+
 #define FATAL(message) {\
     std::ostringstream out;\
     MESSAGE(out, "FATAL EXCEPTION", message);\
@@ -36,13 +49,13 @@
 
 #ifdef __INFO
 #define __ERROR
-#define INFO(message) MESSAGE(std::clog, "INFO", message)
+#define INFO(message) LOG_MESSAGE(LOG_INFO, "INFO", message)
 #else
 #define INFO(message)
 #endif
 
 #ifdef __ERROR
-#define ERROR(message) MESSAGE(std::clog, "ERROR", message)
+#define ERROR(message) (TRACE_LOG(LOG_ERROR), (void)(MESSAGE(std::clog, "ERROR", message)))
 #else
 #define ERROR(message)
 #endif
@@ -64,7 +77,7 @@
 #undef DBG
 #undef DBG_COND
 #ifdef __DEBUG
-#define DBG(message) MESSAGE(std::clog, "DEBUG", message)
+#define DBG(message) LOG_MESSAGE(LOG_DEBUG, "DEBUG", message)
 #define DBG_COND(cond, message) if (cond) DBG(message)
 #undef __DEBUG
 #else
@@ -2,12 +2,15 @@
 #define __IPC_QUEUE_HPP
 
 #include "status.hpp"
+#include "stats.hpp"
+#include "staging.hpp"
 
 #include<thallium.hpp>
 #include<thallium/serialization/stl/string.hpp>
 
 #include<thallium/serialization/stl/list.hpp>
 #include<list>
+#include<map>
 #include <functional>
 using namespace std::placeholders;
 namespace tl=thallium;
@@ -20,6 +23,32 @@ namespace tl=thallium;
 namespace veloc_ipc {
 
 typedef std::function<void (int)> completion_t;
+typedef std::function<void (backend_stats_t &)> stats_hook_t;
+typedef std::function<int (void)> reload_hook_t;
+typedef std::function<void (int)> heartbeat_hook_t;
+typedef std::function<void (int, int, uint64_t)> phase_hook_t;
+
+// what happens to a checkpoint request when the queue of its client (or the whole queue) is full
+enum full_policy_t {
+	// the request waits for room, which blocks the client once its pipeline of requests is full
+	BLOCK_WHEN_FULL,
+	// the oldest pending version of the same checkpoint is not flushed to the persistent storage
+	DROP_OLDEST,
+	// the new version is not flushed to the persistent storage
+	SKIP_PERSISTENT
+};
+
+inline bool parse_full_policy(const std::string &s, full_policy_t &policy) {
+	if (s == "block")
+		policy = BLOCK_WHEN_FULL;
+	else if (s == "drop_oldest")
+		policy = DROP_OLDEST;
+	else if (s == "skip_persistent")
+		policy = SKIP_PERSISTENT;
+	else
+		return false;
+	return true;
+}
 
 inline void cleanup() {
 
@@ -29,63 +58,191 @@ template <class T> class shm_queue_t:public tl::provider<shm_queue_t<T>> {
 	static const size_t MAX_SIZE = 1 << 20;
 
 	struct container_t {
-		std::mutex mutex_;
-		std::condition_variable cond_;
+		tl::mutex mutex_;
+		tl::condition_variable cond_;
 			int status = VELOC_SUCCESS;
 			std::list<T> pending, progress;
+			// since when the head of the pending queue waits to be dequeued
+			std::chrono::steady_clock::time_point head_since;
+			// elements sent asynchronously carry a sequence number, those arriving early wait for their turn
+			tl::mutex order_mutex;
+			uint64_t next_seq = 0;
+			std::map<uint64_t, T> early;
 			container_t() : pending(), progress() { }
 
 	};
 
 	typedef typename std::list<T>::iterator list_iterator_t;
 	std::unordered_map<std::string,container_t*> segment;
-	container_t* data;
-	std::mutex pending_mutex;
-	std::condition_variable pending_cond;
+	// Argobots primitives: a handler or worker waiting for the queue yields its ULT instead of blocking the
+	// execution stream, so that a few execution streams can serve many clients waiting for completion
+	tl::mutex pending_mutex;
+	tl::condition_variable pending_cond, room_cond;
+	// unfinished requests allowed per client (0 = unlimited) and in total; at twice as many, every policy blocks
+	size_t client_capacity = 0, global_capacity = MAX_SIZE;
+	full_policy_t full_policy = BLOCK_WHEN_FULL;
+	// a waiting command moves up one priority class per aging period, so that none of them starves
+	std::chrono::milliseconds priority_aging{1000};
+	// the interactive commands are always dequeued, the others only while fewer than max_inflight of them run
+	size_t max_inflight = MAX_SIZE, inflight = 0;
+	std::atomic<uint64_t> enqueued{0}, completed{0};
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	stats_hook_t stats_hook;
+	reload_hook_t reload_hook;
+	heartbeat_hook_t heartbeat_hook;
+	phase_hook_t phase_hook;
+	staging_info_t staging_info;
+	std::function<void (const T &)> enqueue_hook;
 	container_t *find_non_empty_pending() {
-		if(!segment.empty()){
-			for (auto it = segment.cbegin(); it != segment.cend(); ++it) {
-				container_t *result = it->second;
-				if (!result->pending.empty())
-					return result;
-			}}
-		return NULL;
-	}
-	bool check_completion() {
+		// the head of the client queues with the most urgent priority class wins, the one waiting longest among
+		// equals. The commands of the same client are still dequeued in order.
+		container_t *result = NULL;
+		long best = 0;
+		auto now = std::chrono::steady_clock::now();
+		for (auto it = segment.cbegin(); it != segment.cend(); ++it) {
+			container_t *q = it->second;
+			std::unique_lock<tl::mutex> queue_lock(q->mutex_);
+			if (q->pending.empty())
+				continue;
+			if (q->pending.front().priority() != T::INTERACTIVE && inflight >= max_inflight)
+				continue;
+			long cls = q->pending.front().priority() - (now - q->head_since) / priority_aging;
+			if (result == NULL || cls < best || (cls == best && q->head_since < result->head_since)) {
+				result = q;
+				best = cls;
+			}
+		}
+		return result;
+	}
+	container_t *find_queue(const std::string &id) {
+		// each client has its own queue, created on first use
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		auto it = segment.find(id);
+		if (it != segment.end())
+			return it->second;
+		container_t *q = new container_t();
+		segment.emplace(id, q);
+		return q;
+	}
+	bool check_completion(container_t *q) {
 		// this is a predicate intended to be used for condition variables only
-		return data->pending.empty() && data->progress.empty();
+		return q->pending.empty() && q->progress.empty();
 	}
 //ok
-	int wait_completion(bool reset_status=true) {
-		std::unique_lock<std::mutex> cond_lock(data->mutex_);
-		while (!check_completion())
-			data->cond_.wait(cond_lock);
-		int ret = data->status;
+	int wait_completion(std::string id, bool reset_status=true) {
+		container_t *q = find_queue(id);
+		std::unique_lock<tl::mutex> cond_lock(q->mutex_);
+		while (!check_completion(q))
+			q->cond_.wait(cond_lock);
+		int ret = q->status;
 		if (reset_status)
-			data->status = VELOC_SUCCESS;
+			q->status = VELOC_SUCCESS;
 		return ret;
 	}
+	size_t depth(container_t *q) {
+		std::unique_lock<tl::mutex> queue_lock(q->mutex_);
+		return q->pending.size() + q->progress.size();
+	}
+	void admit(container_t *q, T &e) {
+		// applies the policy for full queues to a checkpoint request, returns once the request can be queued
+		if (e.command != T::CHECKPOINT)
+			return;
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		while (true) {
+			std::unique_lock<tl::mutex> queue_lock(q->mutex_);
+			size_t unfinished = q->pending.size() + q->progress.size(), total = enqueued - completed;
+			if ((client_capacity == 0 || unfinished < client_capacity) && total < global_capacity)
+				return;
+			if ((client_capacity == 0 || unfinished < 2 * client_capacity) && total < 2 * global_capacity) {
+				if (full_policy == SKIP_PERSISTENT) {
+					INFO("queue of client " << e.unique_id << " full, " << e.stem() << " will not be flushed");
+					e.flags |= T::NO_PERSISTENT;
+					return;
+				}
+				if (full_policy == DROP_OLDEST)
+					for (auto &p : q->pending)
+						if (p.command == T::CHECKPOINT && p.name == e.name && !(p.flags & T::NO_PERSISTENT)) {
+							INFO("queue of client " << e.unique_id << " full, " << p.stem() << " will not be flushed");
+							p.flags |= T::NO_PERSISTENT;
+							return;
+						}
+			}
+			queue_lock.unlock();
+			room_cond.wait(cond_lock);
+		}
+	}
 	//ok
-	void enqueue(const T &e) {
-		std::cout<<"this is the command file name"<<e.name<<std::endl;
+	void enqueue(const T &element) {
 		// enqueue an element and notify the consumer
-		std::cout<<"enqueue is called"<<std::endl;
-		std::unique_lock<std::mutex> queue_lock(data->mutex_);
-		data->pending.push_back(e);
-		std::cout<<"emplaced"<<std::endl;
+		T e = element;
+		container_t *q = find_queue(std::to_string(e.unique_id));
+		admit(q, e);
+		TRACE_CMD(ENQUEUE, e, "enqueue", 0);
+		if (enqueue_hook)
+			enqueue_hook(e);
+		std::unique_lock<tl::mutex> queue_lock(q->mutex_);
+		if (q->pending.empty())
+			q->head_since = std::chrono::steady_clock::now();
+		q->pending.push_back(e);
 		queue_lock.unlock();
+		enqueued++;
 		//	if(wasEmpty) pending_cond.notify_one();
 		//added
-		std::unique_lock<std::mutex> cond_lock(pending_mutex);
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
 		pending_cond.notify_one();
 		DBG("enqueued element " << e);
 	}
+	int enqueue_ordered(const T &e, uint64_t seq) {
+		// pipelined requests of a client may be handled out of order, but are queued in the order they were sent.
+		// Returns the number of unfinished requests of the client.
+		container_t *q = find_queue(std::to_string(e.unique_id));
+		std::unique_lock<tl::mutex> order_lock(q->order_mutex);
+		if (seq != q->next_seq) {
+			DBG("element " << e << " arrived early, sequence number " << seq << " instead of " << q->next_seq);
+			q->early.emplace(seq, e);
+			return depth(q);
+		}
+		enqueue(e);
+		q->next_seq++;
+		for (auto it = q->early.begin(); it != q->early.end() && it->first == q->next_seq; q->next_seq++) {
+			enqueue(it->second);
+			it = q->early.erase(it);
+		}
+		// the depth lets the client throttle itself
+		return depth(q);
+	}
+	int get_depth(std::string id) {
+		return depth(find_queue(id));
+	}
 	//ok
-	void init(std::string id)
+	int init(std::string id)
 	{
-		std::cout<<"init called"<<std::endl;
-		data=new container_t();
-		segment.emplace(id,data);
+		DBG("new client queue " << id);
+		container_t *q = find_queue(id);
+		// a new client process numbers its requests from 0 again. The client waits for the answer before sending
+		// them, so that what is dropped here can only be left over from a previous process.
+		std::unique_lock<tl::mutex> order_lock(q->order_mutex);
+		q->next_seq = 0;
+		q->early.clear();
+		return VELOC_SUCCESS;
+	}
+	backend_stats_t get_stats() {
+		backend_stats_t s;
+		s.uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+		s.enqueued = enqueued;
+		s.completed = completed;
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		for (auto &e : segment) {
+			std::unique_lock<tl::mutex> queue_lock(e.second->mutex_);
+			queue_stats_t q;
+			q.id = e.first;
+			q.pending = e.second->pending.size();
+			q.progress = e.second->progress.size();
+			s.queues.push_back(q);
+		}
+		if (stats_hook)
+			stats_hook(s);
+		return s;
 	}
 
 
@@ -93,12 +250,88 @@ template <class T> class shm_queue_t:public tl::provider<shm_queue_t<T>> {
 	shm_queue_t(tl::engine& e,uint16_t provider_id=1) : 
 		tl::provider<shm_queue_t<T>>(e,provider_id)
 	{
-		std::unique_lock<std::mutex> cond_lock(pending_mutex);
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
 		//I will define here the methods
 		this-> define("enqueue",&shm_queue_t::enqueue,tl::ignore_return_value());
-		this-> define("init",&shm_queue_t::init,tl::ignore_return_value());
+		this-> define("enqueue_ordered",&shm_queue_t::enqueue_ordered);
+		this-> define("queue_depth",&shm_queue_t::get_depth);
+		this-> define("init",&shm_queue_t::init);
 		this-> define("wait_completion",&shm_queue_t::wait_completion);
 		this-> define("get",&shm_queue_t::get);
+		this-> define("get_stats",&shm_queue_t::get_stats);
+		this-> define("reload_config",&shm_queue_t::reload_config);
+		this-> define("staging_info",&shm_queue_t::get_staging_info);
+		this-> define("heartbeat",&shm_queue_t::heartbeat,tl::ignore_return_value());
+		this-> define("hint_phase",&shm_queue_t::hint_phase,tl::ignore_return_value());
+	}
+	void set_enqueue_hook(const std::function<void (const T &)> &f) {
+		// called for every accepted element before it is queued (e.g. to record the command stream)
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		enqueue_hook = f;
+	}
+	void set_reload_hook(const reload_hook_t &f) {
+		// lets the owner of the configuration apply the tuning parameters changed on disk
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		reload_hook = f;
+	}
+	void set_stats_hook(const stats_hook_t &f) {
+		// lets the owner of the modules fill in the module level statistics
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		stats_hook = f;
+	}
+	void set_capacity(size_t client, size_t global, full_policy_t policy) {
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		client_capacity = client;
+		global_capacity = global > 0 ? global : MAX_SIZE;
+		full_policy = policy;
+	}
+	void set_max_inflight(size_t n) {
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		max_inflight = n > 0 ? n : MAX_SIZE;
+		pending_cond.notify_one();
+	}
+	void set_priority_aging(std::chrono::milliseconds aging) {
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		priority_aging = aging.count() > 0 ? aging : std::chrono::milliseconds(1000);
+	}
+	void set_phase_hook(const phase_hook_t &f) {
+		// lets the flushes make way for the communication and I/O phases of the clients
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		phase_hook = f;
+	}
+	void set_heartbeat_hook(const heartbeat_hook_t &f) {
+		// lets the watchdog know that a client is alive between its commands
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		heartbeat_hook = f;
+	}
+	void set_staging_info(const staging_info_t &info) {
+		// advertises the staging arenas of the backend, so that clients can map them
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		staging_info = info;
+	}
+	staging_info_t get_staging_info() {
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		return staging_info;
+	}
+	int reload_config() {
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		reload_hook_t f = reload_hook;
+		cond_lock.unlock();
+		return f ? f() : VELOC_FAILURE;
+	}
+	void heartbeat(int id) {
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		heartbeat_hook_t f = heartbeat_hook;
+		cond_lock.unlock();
+		if (f)
+			f(id);
+	}
+	void hint_phase(int id, int phase, uint64_t seq) {
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		phase_hook_t f = phase_hook;
+		cond_lock.unlock();
+		if (f)
+			f(id, phase, seq);
 	}
 	int get(){
 
@@ -107,29 +340,43 @@ template <class T> class shm_queue_t:public tl::provider<shm_queue_t<T>> {
 	}
 	void set_completion(container_t *q,const list_iterator_t &it,int status) {
 		// delete the element from the progress queue and notify the producer
-		std::unique_lock<std::mutex> queue_lock(q->mutex_);
+		std::unique_lock<tl::mutex> queue_lock(q->mutex_);
 		DBG("completed element " << *it);
+		TRACE_CMD(COMPLETE, *it, "complete", (int64_t)status);
+		bool interactive = it->priority() == T::INTERACTIVE;
 		q->progress.erase(it);
+		completed++;
 		if (q->status < 0 || status < 0)
 			q->status = std::min(q->status, status);
 		else
 			q->status = std::max(q->status, status);
 		q->cond_.notify_one();
+		queue_lock.unlock();
+		// a request waiting for room may proceed, so may a command held back by the limit on running commands
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
+		room_cond.notify_all();
+		if (!interactive) {
+			inflight--;
+			pending_cond.notify_one();
+		}
 	}
 	//I am dequeueuing
 	completion_t dequeue_any(T &e) {
 		// wait until at least one pending queue has at least one element
 		container_t *first_found;
-		std::unique_lock<std::mutex> cond_lock(pending_mutex);
+		std::unique_lock<tl::mutex> cond_lock(pending_mutex);
 		while ((first_found = find_non_empty_pending()) == NULL){
 			pending_cond.wait(cond_lock);
 		}
 		// remove the head of the pending queue and move it to the progress queue
-		std::unique_lock<std::mutex> queue_lock(first_found->mutex_);
+		std::unique_lock<tl::mutex> queue_lock(first_found->mutex_);
 		e = first_found->pending.front();
 		first_found->pending.pop_front();
+		first_found->head_since = std::chrono::steady_clock::now();
+		if (e.priority() != T::INTERACTIVE)
+			inflight++;
 		first_found->progress.push_back(e);
-		std::cout<<"dequeued perfect"<<std::endl;
+		TRACE_CMD(DEQUEUE, e, "dequeue", 0);
 		DBG("dequeued element from pending and put in progress" << e);
 
 		return std::bind(&shm_queue_t<T>::set_completion, this,first_found,std::prev(first_found->progress.end()), _1);
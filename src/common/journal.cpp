@@ -0,0 +1,225 @@
+#include "journal.hpp"
+
+#include <cstring>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//#define __DEBUG
+#include "debug.hpp"
+
+static const char MAGIC[8] = {'V', 'E', 'L', 'O', 'C', 'J', 'N', 'L'};
+static const size_t HEADER_SIZE = 64;
+
+struct record_header_t {
+    uint32_t len, checksum;
+};
+
+static uint32_t checksum(const char *data, size_t len) {
+    // FNV-1a, enough to recognize a torn record
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+	h = (h ^ (unsigned char)data[i]) * 16777619u;
+    return h;
+}
+
+static size_t padded(size_t len) {
+    return (sizeof(record_header_t) + len + 7) & ~(size_t)7;
+}
+
+static std::string command_fields(const command_t &c) {
+    return std::to_string(c.unique_id) + "\n" + std::to_string(c.command) + "\n" + std::to_string(c.version) + "\n" +
+	c.name + "\n" + c.original;
+}
+
+journal_t::journal_t(const std::string &f, size_t s) : fname(f), size(s) {
+    if (!map_file(fname, false, size))
+	throw std::runtime_error("cannot open journal " + fname + ": " + std::strerror(errno));
+    replay();
+    for (auto &e : pending)
+	for (int i = 0; i < e.second.second; i++)
+	    recovered_pending.push_back(e.second.first);
+    recovered_transfers = transfers;
+    compact();
+}
+
+journal_t::~journal_t() {
+    unmap();
+}
+
+std::string journal_t::key(const command_t &c) {
+    return std::to_string(c.unique_id) + " " + std::to_string(c.command) + " " + std::to_string(c.version) + " " + c.name;
+}
+
+bool journal_t::map_file(const std::string &f, bool create, size_t min_size) {
+    int new_fd = open(f.c_str(), O_RDWR | O_CREAT | (create ? O_TRUNC : 0), 0644);
+    if (new_fd == -1)
+	return false;
+    struct stat st;
+    if (fstat(new_fd, &st) != 0 || ((size_t)st.st_size < min_size && ftruncate(new_fd, min_size) != 0)) {
+	close(new_fd);
+	return false;
+    }
+    size_t len = std::max(min_size, (size_t)st.st_size);
+    void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, new_fd, 0);
+    if (addr == MAP_FAILED) {
+	close(new_fd);
+	return false;
+    }
+    // the old mapping is released with its own length, the new one only replaces it once it exists
+    unmap();
+    fd = new_fd;
+    base = (char *)addr;
+    size = len;
+    if (std::memcmp(base, MAGIC, sizeof(MAGIC)) != 0) {
+	std::memset(base, 0, HEADER_SIZE);
+	std::memcpy(base, MAGIC, sizeof(MAGIC));
+    }
+    tail = HEADER_SIZE;
+    return true;
+}
+
+void journal_t::unmap() {
+    if (base != NULL)
+	munmap(base, size);
+    if (fd != -1)
+	close(fd);
+    base = NULL;
+    fd = -1;
+}
+
+void journal_t::replay() {
+    size_t records = 0;
+    while (tail + sizeof(record_header_t) <= size) {
+	record_header_t h;
+	std::memcpy(&h, base + tail, sizeof(h));
+	if (h.len == 0 || tail + padded(h.len) > size || checksum(base + tail + sizeof(h), h.len) != h.checksum)
+	    break;
+	apply(std::string(base + tail + sizeof(h), h.len));
+	tail += padded(h.len);
+	records++;
+    }
+    if (records > 0)
+	INFO("journal " << fname << " replayed: " << records << " records, " << pending.size()
+	     << " pending commands, " << transfers.size() << " interrupted transfers");
+}
+
+void journal_t::apply(const std::string &record) {
+    std::istringstream in(record);
+    std::string type, field;
+    std::getline(in, type);
+    if (type == "A" || type == "D") {
+	command_t c;
+	std::getline(in, field);
+	c.unique_id = std::stoi(field);
+	std::getline(in, field);
+	c.command = std::stoi(field);
+	std::getline(in, field);
+	c.version = std::stoi(field);
+	std::getline(in, c.name);
+	std::getline(in, c.original);
+	auto it = pending.find(key(c));
+	if (type == "A") {
+	    if (it == pending.end())
+		pending.insert(std::make_pair(key(c), std::make_pair(c, 1)));
+	    else
+		it->second.second++;
+	} else if (it != pending.end() && --it->second.second == 0)
+	    pending.erase(it);
+    } else if (type == "P") {
+	transfer_t t;
+	std::string dest;
+	std::getline(in, field);
+	t.offset = std::stoull(field);
+	std::getline(in, t.source);
+	std::getline(in, dest);
+	transfers[dest] = t;
+    } else if (type == "F") {
+	std::getline(in, field);
+	transfers.erase(field);
+    }
+}
+
+bool journal_t::write_record(const std::string &record, bool sync) {
+    if (tail + padded(record.size()) > size)
+	return false;
+    char *p = base + tail;
+    std::memcpy(p + sizeof(record_header_t), record.data(), record.size());
+    record_header_t h = {(uint32_t)record.size(), checksum(record.data(), record.size())};
+    // the length goes last: until then, the record reads as the end of the journal
+    std::memcpy(p + sizeof(uint32_t), &h.checksum, sizeof(uint32_t));
+    __atomic_store_n((uint32_t *)p, h.len, __ATOMIC_RELEASE);
+    if (sync) {
+	long page = sysconf(_SC_PAGESIZE);
+	char *start = base + (tail / page) * page;
+	msync(start, p + padded(record.size()) - start, MS_SYNC);
+    }
+    tail += padded(record.size());
+    return true;
+}
+
+void journal_t::compact() {
+    std::vector<std::string> live;
+    size_t needed = HEADER_SIZE;
+    for (auto &e : pending)
+	for (int i = 0; i < e.second.second; i++) {
+	    live.push_back("A\n" + command_fields(e.second.first));
+	    needed += padded(live.back().size());
+	}
+    for (auto &e : transfers) {
+	live.push_back("P\n" + std::to_string(e.second.offset) + "\n" + e.second.source + "\n" + e.first);
+	needed += padded(live.back().size());
+    }
+    // keep at least half of the journal free, so that compactions stay rare
+    size_t new_size = size;
+    while (new_size < 2 * needed)
+	new_size *= 2;
+    std::string tmp = fname + ".tmp";
+    if (!map_file(tmp, true, new_size)) {
+	ERROR("cannot compact journal " << fname << ": " << std::strerror(errno));
+	return;
+    }
+    for (auto &r : live)
+	write_record(r, false);
+    msync(base, size, MS_SYNC);
+    if (rename(tmp.c_str(), fname.c_str()) != 0)
+	ERROR("cannot replace journal " << fname << ": " << std::strerror(errno));
+}
+
+void journal_t::append(const std::string &record, bool sync) {
+    std::unique_lock<std::mutex> lock(journal_mutex);
+    apply(record);
+    if (!write_record(record, sync)) {
+	// the record is already part of the live state, which the compaction writes out
+	compact();
+	if (sync)
+	    msync(base, tail, MS_SYNC);
+    }
+}
+
+void journal_t::accepted(const command_t &c) {
+    // the client was told the command is accepted, so it must survive a crash of the node as well
+    append("A\n" + command_fields(c), true);
+}
+
+void journal_t::completed(const command_t &c) {
+    append("D\n" + command_fields(c));
+}
+
+void journal_t::progress(const std::string &source, const std::string &dest, size_t offset) {
+    // must not be lost even if the node crashes, since the copied data was synced
+    append("P\n" + std::to_string(offset) + "\n" + source + "\n" + dest, true);
+}
+
+void journal_t::finished(const std::string &dest) {
+    append("F\n" + dest);
+}
+
+size_t journal_t::get_offset(const std::string &source, const std::string &dest) {
+    std::unique_lock<std::mutex> lock(journal_mutex);
+    auto it = transfers.find(dest);
+    return it != transfers.end() && it->second.source == source ? it->second.offset : 0;
+}
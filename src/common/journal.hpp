@@ -0,0 +1,63 @@
+#ifndef __JOURNAL_HPP
+#define __JOURNAL_HPP
+
+#include "command.hpp"
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Durable record of the work of the backend: the commands accepted and not yet completed, and the progress of
+// each flush, chunk by chunk. The journal is an append-only, memory-mapped file of checksummed records, so that
+// it survives a crash of the backend; a torn record at the end is ignored. When the journal is full (and when it
+// is opened) it is compacted to the records that are still live.
+class journal_t {
+public:
+    struct transfer_t {
+	std::string source;
+	size_t offset;
+    };
+private:
+    std::string fname;
+    size_t size;
+    int fd = -1;
+    char *base = NULL;
+    size_t tail = 0;
+    std::mutex journal_mutex;
+    std::map<std::string, std::pair<command_t, int> > pending;
+    std::map<std::string, transfer_t> transfers;
+    // state left by the previous backend, found when opening the journal
+    std::vector<command_t> recovered_pending;
+    std::map<std::string, transfer_t> recovered_transfers;
+
+    static std::string key(const command_t &c);
+    bool map_file(const std::string &f, bool create, size_t min_size);
+    void unmap();
+    void replay();
+    void apply(const std::string &record);
+    bool write_record(const std::string &record, bool sync);
+    void compact();
+    void append(const std::string &record, bool sync = false);
+public:
+    journal_t(const std::string &fname, size_t size);
+    ~journal_t();
+
+    void accepted(const command_t &c);
+    void completed(const command_t &c);
+    // all bytes of source up to offset are durable in the (temporary) destination
+    void progress(const std::string &source, const std::string &dest, size_t offset);
+    void finished(const std::string &dest);
+
+    // commands accepted by the previous backend that were never completed
+    const std::vector<command_t> &get_pending() const {
+	return recovered_pending;
+    }
+    // flushes of the previous backend interrupted before completion, by destination
+    const std::map<std::string, transfer_t> &get_transfers() const {
+	return recovered_transfers;
+    }
+    // offset from which a copy of source to dest can resume, 0 if it needs to start over
+    size_t get_offset(const std::string &source, const std::string &dest);
+};
+
+#endif // __JOURNAL_HPP
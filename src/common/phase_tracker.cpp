@@ -0,0 +1,39 @@
+#include "phase_tracker.hpp"
+#include "include/veloc.h"
+
+phase_tracker_t::~phase_tracker_t() {
+    if (!busy_clients.empty())
+	gate.leave();
+}
+
+void phase_tracker_t::update(int id, bool busy) {
+    bool was_busy = !busy_clients.empty();
+    if (busy)
+	busy_clients.insert(id);
+    else
+	busy_clients.erase(id);
+    if (!was_busy && !busy_clients.empty())
+	gate.enter();
+    else if (was_busy && busy_clients.empty())
+	gate.leave();
+}
+
+bool phase_tracker_t::hint(int id, int phase, uint64_t seq) {
+    std::unique_lock<std::mutex> lock(phase_mutex);
+    auto it = last_seq.find(id);
+    if (it != last_seq.end() && seq <= it->second)
+	return false;
+    last_seq[id] = seq;
+    update(id, phase != VELOC_PHASE_COMPUTE);
+    return true;
+}
+
+void phase_tracker_t::clear(int id) {
+    std::unique_lock<std::mutex> lock(phase_mutex);
+    update(id, false);
+}
+
+bool phase_tracker_t::is_busy(int id) {
+    std::unique_lock<std::mutex> lock(phase_mutex);
+    return busy_clients.count(id) > 0;
+}
@@ -0,0 +1,30 @@
+#ifndef __PHASE_TRACKER_HPP
+#define __PHASE_TRACKER_HPP
+
+#include "common/priority_gate.hpp"
+
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+// Tracks the phases hinted by the clients (VELOC_PHASE_*) and holds the priority gate while any of them is in a
+// communication or I/O phase. The hints are one-way messages that the RPC threads may handle out of order, so each
+// of them carries a sequence number that grows for every client: a hint older than the last one applied is dropped.
+class phase_tracker_t {
+    priority_gate_t &gate;
+    std::mutex phase_mutex;
+    std::unordered_map<int, uint64_t> last_seq;
+    std::set<int> busy_clients;
+
+    void update(int id, bool busy);
+public:
+    phase_tracker_t(priority_gate_t &g) : gate(g) { }
+    ~phase_tracker_t();
+    // returns false if the hint is stale
+    bool hint(int id, int phase, uint64_t seq);
+    // the client is gone (watchdog timeout) or starts over: it no longer holds the gate, its late hints stay stale
+    void clear(int id);
+    bool is_busy(int id);
+};
+
+#endif // __PHASE_TRACKER_HPP
@@ -0,0 +1,28 @@
+#include "priority_gate.hpp"
+
+void priority_gate_t::set_max_pause(std::chrono::milliseconds p) {
+    std::unique_lock<std::mutex> lock(gate_mutex);
+    max_pause = p;
+}
+
+void priority_gate_t::enter() {
+    std::unique_lock<std::mutex> lock(gate_mutex);
+    interactive++;
+}
+
+void priority_gate_t::leave() {
+    std::unique_lock<std::mutex> lock(gate_mutex);
+    if (--interactive == 0)
+	gate_cond.notify_all();
+}
+
+bool priority_gate_t::pause() {
+    // the common case of no interactive command does not take the lock
+    if (interactive == 0)
+	return false;
+    std::unique_lock<std::mutex> lock(gate_mutex);
+    if (interactive == 0 || max_pause.count() <= 0)
+	return false;
+    gate_cond.wait_for(lock, max_pause, [this] { return interactive == 0; });
+    return true;
+}
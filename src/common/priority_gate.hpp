@@ -0,0 +1,30 @@
+#ifndef __PRIORITY_GATE_HPP
+#define __PRIORITY_GATE_HPP
+
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// Lets the interactive commands (restarts, tests) of a recovering application take over the storage bandwidth:
+// while one of them is in progress, the background flushes pause at their next chunk boundary. A flush pauses for
+// at most max_pause per chunk, so that a steady stream of interactive commands cannot starve it.
+class priority_gate_t {
+    std::mutex gate_mutex;
+    std::condition_variable gate_cond;
+    std::atomic<int> interactive{0};
+    std::chrono::milliseconds max_pause;
+public:
+    priority_gate_t(std::chrono::milliseconds p = std::chrono::milliseconds(1000)) : max_pause(p) { }
+    void set_max_pause(std::chrono::milliseconds p);
+    void enter();
+    void leave();
+    // whether a flush calling pause now would wait
+    bool closed() const {
+	return interactive > 0;
+    }
+    // called by a background flush between two chunks, returns true if it had to wait
+    bool pause();
+};
+
+#endif // __PRIORITY_GATE_HPP
@@ -0,0 +1,25 @@
+#ifndef __SHA256_HPP
+#define __SHA256_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// SHA-256 (FIPS 180-4), used to address the contents of checkpoint chunks
+class sha256_t {
+    uint32_t state[8];
+    uint8_t block[64];
+    size_t block_len = 0;
+    uint64_t total = 0;
+
+    void transform(const uint8_t *data);
+public:
+    sha256_t();
+    void update(const void *data, size_t len);
+    // finishes the hash and returns it in hexadecimal
+    std::string hex_digest();
+
+    static std::string hex_digest(const void *data, size_t len);
+};
+
+#endif // __SHA256_HPP
@@ -0,0 +1,291 @@
+#include "staging.hpp"
+
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+
+//#define __DEBUG
+#include "debug.hpp"
+
+// avoid a dependency on libnuma for the few definitions we need
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+
+static const uint64_t ARENA_MAGIC = 0x56454c4f43535447ULL; // "VELOCSTG"
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "staging arenas need address-free 64 bit atomics");
+
+struct staging_arena_t::header_t {
+    uint64_t magic, size, block_size, blocks, node;
+    std::atomic<uint64_t> used, hint;
+};
+
+staging_arena_t::~staging_arena_t() {
+    if (base != NULL)
+	munmap(base, size);
+    if (fd != -1)
+	close(fd);
+}
+
+bool staging_arena_t::map(int prot_fd, size_t len) {
+    void *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, prot_fd, 0);
+    if (addr == MAP_FAILED)
+	return false;
+    base = (char *)addr;
+    size = len;
+    return true;
+}
+
+bool staging_arena_t::create(int n, size_t len, size_t block_size) {
+    node = n;
+    if (block_size == 0 || len < 2 * block_size) {
+	ERROR("staging arena of " << len << " bytes is too small for blocks of " << block_size << " bytes");
+	return false;
+    }
+    len -= len % block_size;
+    std::string name = "veloc-staging-" + std::to_string(node);
+    // huge pages need to be reserved by the administrator; fall back to transparent huge pages otherwise
+    fd = memfd_create(name.c_str(), MFD_HUGETLB);
+    if (fd != -1) {
+	if (ftruncate(fd, len) == 0 && map(fd, len))
+	    huge = true;
+	else {
+	    close(fd);
+	    fd = -1;
+	}
+    }
+    if (fd == -1) {
+	fd = memfd_create(name.c_str(), 0);
+	if (fd == -1 || ftruncate(fd, len) != 0 || !map(fd, len)) {
+	    ERROR("cannot create staging arena of " << len << " bytes, error = " << std::strerror(errno));
+	    return false;
+	}
+	madvise(base, size, MADV_HUGEPAGE);
+    }
+    if (node >= 0) {
+	std::vector<unsigned long> mask(node / (8 * sizeof(unsigned long)) + 1, 0);
+	mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+	if (syscall(SYS_mbind, base, size, MPOL_BIND, mask.data(), mask.size() * 8 * sizeof(unsigned long) + 1, MPOL_MF_MOVE) != 0)
+	    INFO("cannot bind staging arena to NUMA node " << node << ", error = " << std::strerror(errno));
+    }
+    // pre-fault the arena now, so that checkpointing does not pay for the page faults
+    long page = huge ? block_size : sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < size; i += page)
+	base[i] = 0;
+
+    header = (header_t *)base;
+    header->magic = ARENA_MAGIC;
+    header->size = size;
+    header->block_size = block_size;
+    header->blocks = size / block_size;
+    header->node = node = std::max(node, 0);
+    header->used = 0;
+    header->hint = 0;
+    bitmap = (std::atomic<uint64_t> *)(header + 1);
+    uint64_t words = (header->blocks + 63) / 64;
+    for (uint64_t i = 0; i < words; i++)
+	bitmap[i] = 0;
+    // the header and the bitmap occupy the first blocks; this also makes 0 an invalid buffer offset
+    uint64_t reserved = reserved_blocks();
+    if (reserved >= header->blocks) {
+	ERROR("staging arena of " << size << " bytes is too small for its own metadata");
+	return false;
+    }
+    claim(0, reserved);
+    header->used = 0;
+    header->hint = reserved;
+    DBG("created staging arena on node " << node << ", size = " << size << ", huge pages = " << huge);
+    return true;
+}
+
+bool staging_arena_t::attach(int f) {
+    struct stat st;
+    if (fstat(f, &st) != 0 || !map(f, st.st_size))
+	return false;
+    header = (header_t *)base;
+    if (header->magic != ARENA_MAGIC || header->size != size) {
+	ERROR("invalid staging arena, size = " << size);
+	munmap(base, size);
+	base = NULL;
+	return false;
+    }
+    node = header->node;
+    bitmap = (std::atomic<uint64_t> *)(header + 1);
+    return true;
+}
+
+uint64_t staging_arena_t::reserved_blocks() const {
+    uint64_t words = (header->blocks + 63) / 64;
+    return (sizeof(header_t) + words * sizeof(uint64_t) + header->block_size - 1) / header->block_size;
+}
+
+bool staging_arena_t::claim(uint64_t first, uint64_t n) {
+    uint64_t end = first + n;
+    for (uint64_t i = first; i < end; ) {
+	uint64_t w = i / 64, bits = std::min(end - i, 64 - i % 64);
+	uint64_t mask = (bits == 64 ? ~0ULL : ((1ULL << bits) - 1)) << (i % 64);
+	uint64_t old = bitmap[w].load();
+	do {
+	    if (old & mask) {
+		// somebody else got part of the run first, give back what we took
+		clear(first, i - first);
+		return false;
+	    }
+	} while (!bitmap[w].compare_exchange_weak(old, old | mask));
+	i += bits;
+    }
+    header->used += n;
+    return true;
+}
+
+void staging_arena_t::clear(uint64_t first, uint64_t n) {
+    uint64_t end = first + n;
+    for (uint64_t i = first; i < end; ) {
+	uint64_t w = i / 64, bits = std::min(end - i, 64 - i % 64);
+	uint64_t mask = (bits == 64 ? ~0ULL : ((1ULL << bits) - 1)) << (i % 64);
+	bitmap[w].fetch_and(~mask);
+	i += bits;
+    }
+}
+
+uint64_t staging_arena_t::allocate(size_t bytes) {
+    uint64_t bs = header->block_size, blocks = header->blocks;
+    uint64_t n = (bytes + bs - 1) / bs;
+    if (n == 0 || n > blocks)
+	return 0;
+    // first fit, starting where the last allocation ended to avoid contention on the same words
+    uint64_t start = header->hint.load() % blocks;
+    for (uint64_t k = 0; k < blocks; ) {
+	uint64_t i = (start + k) % blocks;
+	uint64_t word = bitmap[i / 64].load();
+	if (i % 64 == 0 && word == ~0ULL) {
+	    k += 64;
+	    continue;
+	}
+	if (!(word & (1ULL << (i % 64))) && i + n <= blocks && claim(i, n)) {
+	    header->hint = i + n;
+	    return i * bs;
+	}
+	k++;
+    }
+    return 0;
+}
+
+void staging_arena_t::release(uint64_t offset, size_t bytes) {
+    uint64_t bs = header->block_size;
+    uint64_t n = (bytes + bs - 1) / bs;
+    clear(offset / bs, n);
+    header->used -= n;
+}
+
+bool staging_arena_t::allocated(uint64_t offset, size_t bytes) const {
+    uint64_t bs = header->block_size, blocks = header->blocks;
+    uint64_t first = offset / bs, n = (bytes + bs - 1) / bs;
+    if (offset % bs != 0 || n == 0 || first < reserved_blocks() || first >= blocks || n > blocks - first)
+	return false;
+    for (uint64_t i = first; i < first + n; i++)
+	if (!(bitmap[i / 64].load() & (1ULL << (i % 64))))
+	    return false;
+    return true;
+}
+
+size_t staging_arena_t::get_block_size() const {
+    return header->block_size;
+}
+
+size_t staging_arena_t::get_capacity() const {
+    return size;
+}
+
+size_t staging_arena_t::get_used() const {
+    return header->used * header->block_size;
+}
+
+int staging_t::numa_nodes() {
+    DIR *dir = opendir("/sys/devices/system/node");
+    if (dir == NULL)
+	return 1;
+    int nodes = 0;
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+	int id;
+	if (sscanf(e->d_name, "node%d", &id) == 1)
+	    nodes = std::max(nodes, id + 1);
+    }
+    closedir(dir);
+    return std::max(nodes, 1);
+}
+
+int staging_t::current_node() {
+    unsigned int cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+	return 0;
+    return node;
+}
+
+bool staging_t::create(size_t size_per_node, size_t block_size) {
+    int nodes = numa_nodes();
+    for (int i = 0; i < nodes; i++) {
+	std::unique_ptr<staging_arena_t> a(new staging_arena_t());
+	if (!a->create(nodes > 1 ? i : -1, size_per_node, block_size)) {
+	    arenas.clear();
+	    return false;
+	}
+	INFO("staging arena for NUMA node " << i << ": " << a->get_capacity() << " bytes, huge pages = " << a->uses_huge_pages());
+	arenas.emplace_back(std::move(a));
+    }
+    return true;
+}
+
+bool staging_t::attach(const staging_info_t &info) {
+    for (unsigned int i = 0; i < info.fds.size(); i++) {
+	// reopening the memfd of another process requires the same permissions as ptrace (i.e. same user)
+	std::string path = "/proc/" + std::to_string(info.pid) + "/fd/" + std::to_string(info.fds[i]);
+	int fd = open(path.c_str(), O_RDWR);
+	std::unique_ptr<staging_arena_t> a(new staging_arena_t());
+	if (fd == -1 || !a->attach(fd)) {
+	    ERROR("cannot attach to staging arena " << path << ", error = " << std::strerror(errno));
+	    if (fd != -1)
+		close(fd);
+	    arenas.clear();
+	    return false;
+	}
+	close(fd);
+	arenas.emplace_back(std::move(a));
+    }
+    return true;
+}
+
+staging_info_t staging_t::get_info() const {
+    staging_info_t info;
+    info.pid = getpid();
+    for (auto &a : arenas)
+	info.fds.push_back(a->get_fd());
+    return info;
+}
+
+staging_arena_t *staging_t::get(int node) {
+    if (node < 0 || node >= (int)arenas.size())
+	return NULL;
+    return arenas[node].get();
+}
+
+staging_arena_t *staging_t::local() {
+    if (arenas.empty())
+	return NULL;
+    staging_arena_t *a = get(current_node());
+    return a != NULL ? a : arenas[0].get();
+}
@@ -0,0 +1,89 @@
+#ifndef __STAGING_HPP
+#define __STAGING_HPP
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <string>
+
+#include <unistd.h>
+
+#include <thallium/serialization/stl/vector.hpp>
+
+// how a client finds the staging arenas of its backend: the memfd of each NUMA node, opened through /proc/<pid>/fd
+struct staging_info_t {
+    int pid = -1;
+    std::vector<int> fds;
+
+    template<typename A> void serialize(A &ar) {
+	ar & pid;
+	ar & fds;
+    }
+};
+
+// a memfd backed memory arena (using huge pages if possible) bound to a NUMA node and shared between processes.
+// The allocator state lives in the arena itself: a bitmap of fixed size blocks updated with atomic operations,
+// so that every process that maps the arena can allocate and release buffers without locks. Buffers are
+// identified by their offset, which is the same in all processes.
+class staging_arena_t {
+    struct header_t;
+    int fd = -1, node = 0;
+    bool huge = false;
+    size_t size = 0;
+    char *base = NULL;
+    header_t *header = NULL;
+    std::atomic<uint64_t> *bitmap = NULL;
+
+    bool map(int prot_fd, size_t len);
+    bool claim(uint64_t first, uint64_t n);
+    void clear(uint64_t first, uint64_t n);
+    uint64_t reserved_blocks() const;
+public:
+    ~staging_arena_t();
+    // creates an arena of size bytes (rounded to blocks) on the given NUMA node (-1 = no binding)
+    bool create(int node, size_t size, size_t block_size);
+    // maps an arena created by another process, fd may be closed afterwards
+    bool attach(int fd);
+
+    // returns the offset of a buffer of (at least) the given size, 0 if the arena is full
+    uint64_t allocate(size_t bytes);
+    void release(uint64_t offset, size_t bytes);
+    // checks that a buffer received from another process lies within the arena and is allocated
+    bool allocated(uint64_t offset, size_t bytes) const;
+    void *address(uint64_t offset) const {
+	return base + offset;
+    }
+
+    int get_fd() const {
+	return fd;
+    }
+    int get_node() const {
+	return node;
+    }
+    bool uses_huge_pages() const {
+	return huge;
+    }
+    size_t get_block_size() const;
+    size_t get_capacity() const;
+    size_t get_used() const;
+};
+
+// the set of arenas of a node, one per NUMA node
+class staging_t {
+    std::vector<std::unique_ptr<staging_arena_t> > arenas;
+public:
+    static int numa_nodes();
+    static int current_node();
+
+    bool create(size_t size_per_node, size_t block_size);
+    bool attach(const staging_info_t &info);
+    staging_info_t get_info() const;
+    bool empty() const {
+	return arenas.empty();
+    }
+    // arena on the NUMA node of the calling thread, or the first one if there is none on that node
+    staging_arena_t *local();
+    staging_arena_t *get(int node);
+};
+
+#endif // __STAGING_HPP
@@ -0,0 +1,108 @@
+#ifndef __STATS_HPP
+#define __STATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include <thallium/serialization/stl/string.hpp>
+#include <thallium/serialization/stl/vector.hpp>
+
+// snapshot of a latency histogram: bucket i counts samples in [2^i, 2^(i+1)) us (bucket 0 also holds 0 us)
+struct histogram_t {
+    std::string name;
+    std::vector<uint64_t> buckets;
+    uint64_t count = 0, sum_us = 0, max_us = 0;
+
+    static uint64_t bucket_low(unsigned int i) {
+	return i == 0 ? 0 : (uint64_t)1 << i;
+    }
+    // approximate percentile (upper bound of the bucket that contains it)
+    uint64_t percentile(double p) const {
+	uint64_t target = (uint64_t)(p * count), seen = 0;
+	for (unsigned int i = 0; i < buckets.size(); i++) {
+	    seen += buckets[i];
+	    if (seen > target)
+		return std::min(max_us, ((uint64_t)1 << (i + 1)) - 1);
+	}
+	return max_us;
+    }
+    template<typename A> void serialize(A &ar) {
+	ar & name;
+	ar & buckets;
+	ar & count;
+	ar & sum_us;
+	ar & max_us;
+    }
+};
+
+// lock-free latency histogram, safe to update concurrently from the worker threads
+class latency_histogram_t {
+public:
+    static const unsigned int BUCKETS = 32;
+private:
+    std::atomic<uint64_t> buckets[BUCKETS], count{0}, sum_us{0}, max_us{0};
+public:
+    latency_histogram_t() {
+	for (auto &b : buckets)
+	    b = 0;
+    }
+    void record(uint64_t us) {
+	unsigned int i = us < 2 ? 0 : 63 - __builtin_clzll(us);
+	buckets[std::min(i, BUCKETS - 1)]++;
+	count++;
+	sum_us += us;
+	uint64_t prev = max_us;
+	while (prev < us && !max_us.compare_exchange_weak(prev, us));
+    }
+    histogram_t snapshot(const std::string &name) const {
+	histogram_t h;
+	h.name = name;
+	for (auto &b : buckets)
+	    h.buckets.push_back(b);
+	h.count = count;
+	h.sum_us = sum_us;
+	h.max_us = max_us;
+	return h;
+    }
+};
+
+struct queue_stats_t {
+    std::string id;
+    uint64_t pending = 0, progress = 0;
+
+    template<typename A> void serialize(A &ar) {
+	ar & id;
+	ar & pending;
+	ar & progress;
+    }
+};
+
+// live statistics of the backend, returned by the "get_stats" RPC
+struct backend_stats_t {
+    double uptime = 0;
+    uint64_t enqueued = 0, completed = 0, bytes_written = 0, bytes_flushed = 0, bytes_deduplicated = 0,
+	bytes_superseded = 0;
+    std::vector<queue_stats_t> queues;
+    std::vector<histogram_t> modules;
+
+    double commands_per_sec() const {
+	return uptime > 0 ? completed / uptime : 0;
+    }
+    template<typename A> void serialize(A &ar) {
+	ar & uptime;
+	ar & enqueued;
+	ar & completed;
+	ar & bytes_written;
+	ar & bytes_flushed;
+	ar & bytes_deduplicated;
+	ar & bytes_superseded;
+	ar & queues;
+	ar & modules;
+    }
+};
+
+#endif // __STATS_HPP
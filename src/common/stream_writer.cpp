@@ -0,0 +1,94 @@
+#include "stream_writer.hpp"
+#include "status.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+
+//#define __DEBUG
+#include "debug.hpp"
+
+stream_writer_t::stream_writer_t(const config_t &cfg) : persistent(cfg.get_persistent()) { }
+
+stream_writer_t::~stream_writer_t() {
+    for (auto &f : files) {
+	close(f.second.fd);
+	unlink((persistent + "/." + f.first + ".partial").c_str());
+    }
+}
+
+std::string stream_writer_t::partial(const command_t &c) const {
+    // hidden, so that it never matches the checkpoint name when looking for the latest version
+    return persistent + "/." + c.stem() + ".partial";
+}
+
+int stream_writer_t::write(const command_t &c, size_t offset, const std::vector<struct iovec> &iov) {
+    std::unique_lock<std::mutex> lock(files_mutex);
+    auto it = files.find(c.stem());
+    if (it == files.end()) {
+	int fd = open(partial(c).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+	    ERROR("cannot open " << partial(c) << " for streaming, error = " << std::strerror(errno));
+	    return VELOC_FAILURE;
+	}
+	it = files.insert(std::make_pair(c.stem(), file_t{fd, 0})).first;
+    }
+    int fd = it->second.fd;
+    lock.unlock();
+
+    std::vector<struct iovec> left(iov);
+    size_t first = 0, total = 0;
+    while (first < left.size()) {
+	int count = std::min(left.size() - first, (size_t)IOV_MAX);
+	ssize_t ret = pwritev(fd, &left[first], count, offset + total);
+	if (ret < 0 && errno == EINTR)
+	    continue;
+	if (ret <= 0) {
+	    ERROR("cannot write " << c.stem() << " at offset " << offset + total << ", error = " << std::strerror(errno));
+	    return VELOC_FAILURE;
+	}
+	total += ret;
+	size_t done = ret;
+	while (first < left.size() && done >= left[first].iov_len)
+	    done -= left[first++].iov_len;
+	if (done > 0) {
+	    left[first].iov_base = (char *)left[first].iov_base + done;
+	    left[first].iov_len -= done;
+	}
+    }
+    lock.lock();
+    it = files.find(c.stem());
+    if (it == files.end())
+	return VELOC_FAILURE;
+    it->second.written += total;
+    return VELOC_SUCCESS;
+}
+
+int stream_writer_t::commit(const command_t &c, size_t size, bool success) {
+    std::unique_lock<std::mutex> lock(files_mutex);
+    auto it = files.find(c.stem());
+    if (it == files.end()) {
+	ERROR("nothing streamed for " << c.stem());
+	return VELOC_FAILURE;
+    }
+    file_t f = it->second;
+    files.erase(it);
+    lock.unlock();
+
+    if (success && f.written != size) {
+	success = false;
+	ERROR("streamed " << f.written << " bytes of " << c.stem() << " instead of " << size);
+    }
+    if (close(f.fd) != 0)
+	success = false;
+    if (success && rename(partial(c).c_str(), c.filename(persistent).c_str()) != 0) {
+	ERROR("cannot publish streamed checkpoint " << c.stem() << ", error = " << std::strerror(errno));
+	success = false;
+    }
+    if (!success)
+	unlink(partial(c).c_str());
+    return success ? VELOC_SUCCESS : VELOC_FAILURE;
+}
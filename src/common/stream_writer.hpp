@@ -0,0 +1,34 @@
+#ifndef __STREAM_WRITER_HPP
+#define __STREAM_WRITER_HPP
+
+#include "config.hpp"
+#include "command.hpp"
+
+#include <vector>
+#include <map>
+#include <mutex>
+
+#include <sys/uio.h>
+
+// writes checkpoints straight to the persistent storage, chunk by chunk and possibly out of order. The data goes
+// to a hidden partial file that is renamed on commit, so that a checkpoint never shows up incomplete.
+class stream_writer_t {
+    struct file_t {
+	int fd;
+	size_t written;
+    };
+    std::string persistent;
+    std::mutex files_mutex;
+    std::map<std::string, file_t> files;
+
+    std::string partial(const command_t &c) const;
+public:
+    stream_writer_t(const config_t &cfg);
+    ~stream_writer_t();
+    // writes the segments at the given offset of the checkpoint file, opening the file on first use
+    int write(const command_t &c, size_t offset, const std::vector<struct iovec> &iov);
+    // publishes the checkpoint if successful and exactly size bytes were written, discards it otherwise
+    int commit(const command_t &c, size_t size, bool success = true);
+};
+
+#endif // __STREAM_WRITER_HPP
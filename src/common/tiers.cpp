@@ -0,0 +1,290 @@
+#include "tiers.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <map>
+#include <limits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/sendfile.h>
+#include <limits.h>
+
+//#define __DEBUG
+#include "debug.hpp"
+
+// checkpoint files are named <name>-<id>-<version>.dat
+static bool parse_stem(const std::string &stem, std::string &name, int &id, int &version) {
+    const std::string ext = ".dat";
+    if (stem.size() <= ext.size() || stem.compare(stem.size() - ext.size(), ext.size(), ext) != 0)
+	return false;
+    size_t v = stem.rfind('-', stem.size() - ext.size());
+    if (v == std::string::npos || v == 0)
+	return false;
+    size_t i = stem.rfind('-', v - 1);
+    if (i == std::string::npos)
+	return false;
+    if (sscanf(stem.c_str() + i, "-%d-%d.dat", &id, &version) != 2)
+	return false;
+    name = stem.substr(0, i);
+    return true;
+}
+
+struct tier_file_t {
+    std::string stem, name;
+    int id, version;
+    size_t size;
+    time_t last_use;
+};
+
+static std::vector<tier_file_t> list_files(const std::string &dir) {
+    std::vector<tier_file_t> files;
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL)
+	return files;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+	tier_file_t f;
+	struct stat st;
+	f.stem = e->d_name;
+	if (!parse_stem(f.stem, f.name, f.id, f.version) || lstat((dir + "/" + f.stem).c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+	    continue;
+	f.size = st.st_size;
+	f.last_use = std::max(st.st_atime, st.st_mtime);
+	files.push_back(f);
+    }
+    closedir(d);
+    return files;
+}
+
+static bool copy_file(const std::string &source, const std::string &dest) {
+    int fi = open(source.c_str(), O_RDONLY);
+    if (fi == -1)
+	return false;
+    int fo = open(dest.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fo == -1) {
+	close(fi);
+	return false;
+    }
+    struct stat st;
+    bool success = fstat(fi, &st) == 0;
+    for (size_t remaining = success ? st.st_size : 0; remaining > 0; ) {
+	ssize_t transferred = sendfile(fo, fi, NULL, remaining);
+	if (transferred <= 0) {
+	    success = false;
+	    break;
+	}
+	remaining -= transferred;
+    }
+    close(fi);
+    if (close(fo) != 0)
+	success = false;
+    return success;
+}
+
+// points the scratch entry to target, replacing any previous entry atomically
+static bool link_local(const std::string &local, const std::string &target) {
+    size_t slash = local.rfind('/');
+    std::string tmp = local.substr(0, slash + 1) + "." + local.substr(slash + 1) + ".link";
+    unlink(tmp.c_str());
+    if (symlink(target.c_str(), tmp.c_str()) != 0 || rename(tmp.c_str(), local.c_str()) != 0) {
+	ERROR("cannot link " << local << " to " << target << ", error = " << std::strerror(errno));
+	unlink(tmp.c_str());
+	return false;
+    }
+    return true;
+}
+
+static std::string link_target(const std::string &local) {
+    char buf[PATH_MAX + 1];
+    ssize_t len = readlink(local.c_str(), buf, PATH_MAX);
+    return len > 0 ? std::string(buf, len) : std::string();
+}
+
+tier_set_t::tier_set_t(const config_t &cfg) : scratch(cfg.get_scratch()) {
+    std::string list;
+    if (!cfg.get_optional("tiers", list))
+	return;
+    for (auto &c : list)
+	if (c == ',')
+	    c = ' ';
+    std::istringstream names(list);
+    std::string name;
+    while (names >> name) {
+	tier_t t;
+	int val;
+	t.name = name;
+	t.path = cfg.get("tier_" + name + "_path");
+	mkdir(t.path.c_str(), 0755);
+	if (access(t.path.c_str(), W_OK) != 0)
+	    throw std::runtime_error("directory " + t.path + " of tier " + name + " inaccessible!");
+	if (cfg.get_optional("tier_" + name + "_capacity", val) && val > 0)
+	    t.capacity = (size_t)val << 20;
+	if (cfg.get_optional("tier_" + name + "_bandwidth", val) && val > 0)
+	    t.bandwidth = val;
+	if (cfg.get_optional("tier_" + name + "_max_versions", val) && val > 0)
+	    t.max_versions = val;
+	tiers.push_back(t);
+    }
+    // the bandwidth hints take precedence over the order of the list
+    std::stable_sort(tiers.begin(), tiers.end(), [](const tier_t &a, const tier_t &b) {
+	return a.bandwidth > b.bandwidth;
+    });
+}
+
+size_t tier_set_t::used(size_t tier) const {
+    size_t total = 0;
+    for (auto &f : list_files(tiers[tier].path))
+	total += f.size;
+    return total;
+}
+
+std::vector<size_t> tier_set_t::place(size_t size) const {
+    std::vector<size_t> result;
+    for (size_t i = 0; i < tiers.size(); i++) {
+	struct statvfs st;
+	size_t room = std::numeric_limits<size_t>::max();
+	if (statvfs(tiers[i].path.c_str(), &st) == 0)
+	    room = (size_t)st.f_bavail * st.f_frsize;
+	if (tiers[i].capacity > 0) {
+	    size_t u = used(i);
+	    room = std::min(room, u < tiers[i].capacity ? tiers[i].capacity - u : 0);
+	}
+	if (size <= room)
+	    result.push_back(i);
+    }
+    return result;
+}
+
+bool tier_set_t::store(const command_t &c, size_t size, const writer_t &write) const {
+    std::string local = c.filename(scratch);
+    // an earlier copy of the same version may live on another tier
+    remove_local(local);
+    for (auto i : place(size)) {
+	std::string target = c.filename(tiers[i].path), tmp = tiers[i].path + "/." + c.stem() + ".tmp";
+	if (write(tmp) && rename(tmp.c_str(), target.c_str()) == 0) {
+	    if (link_local(local, target))
+		return true;
+	} else
+	    INFO("cannot write " << c.stem() << " to tier " << tiers[i].name << ", error = " << std::strerror(errno) << ", trying the next one");
+	unlink(tmp.c_str());
+	unlink(target.c_str());
+    }
+    INFO("no tier can hold " << c.stem() << " (" << size << " bytes), using the scratch directory");
+    return write(local);
+}
+
+bool tier_set_t::relink(const command_t &c) const {
+    std::string local = c.filename(scratch);
+    if (access(local.c_str(), R_OK) == 0)
+	return true;
+    for (auto &t : tiers) {
+	std::string target = c.filename(t.path);
+	if (access(target.c_str(), R_OK) == 0) {
+	    DBG("found " << c.stem() << " on tier " << t.name);
+	    return link_local(local, target);
+	}
+    }
+    return false;
+}
+
+int tier_set_t::latest_version(const command_t &c) const {
+    int ret = -1;
+    for (auto &t : tiers)
+	for (auto &f : list_files(t.path))
+	    if (f.name == c.name && f.id == c.unique_id && (c.version == 0 || f.version <= c.version))
+		ret = std::max(ret, f.version);
+    return ret;
+}
+
+bool tier_set_t::migrate(const std::string &stem, size_t from) {
+    std::string source = tiers[from].path + "/" + stem, local = scratch + "/" + stem;
+    std::unique_lock<std::mutex> lock(pin_mutex);
+    if (pinned.find(stem) != pinned.end()) {
+	DBG("keep " << stem << " on tier " << tiers[from].name << ", it was not processed yet");
+	return false;
+    }
+    bool linked = link_target(local) == source;
+    if (from + 1 == tiers.size()) {
+	// under the lock, so that a version accepted in the meantime is not evicted
+	DBG("evict " << stem << " from tier " << tiers[from].name);
+	if (linked)
+	    unlink(local.c_str());
+	return unlink(source.c_str()) == 0;
+    }
+    lock.unlock();
+    std::string dest = tiers[from + 1].path + "/" + stem, tmp = tiers[from + 1].path + "/." + stem + ".tmp";
+    if (!copy_file(source, tmp) || rename(tmp.c_str(), dest.c_str()) != 0) {
+	ERROR("cannot move " << stem << " from tier " << tiers[from].name << " to tier " << tiers[from + 1].name
+	      << ", error = " << std::strerror(errno));
+	unlink(tmp.c_str());
+	return false;
+    }
+    // readers that already opened the source keep reading it after the unlink
+    if (linked && !link_local(local, dest))
+	return false;
+    DBG("moved " << stem << " from tier " << tiers[from].name << " to tier " << tiers[from + 1].name);
+    return unlink(source.c_str()) == 0;
+}
+
+void tier_set_t::rebalance() {
+    // top-down, so that whatever moves into a tier is accounted for when that tier is processed
+    for (size_t i = 0; i < tiers.size(); i++) {
+	std::vector<tier_file_t> files = list_files(tiers[i].path);
+	std::vector<bool> moved(files.size(), false);
+	if (tiers[i].max_versions > 0) {
+	    std::map<std::pair<std::string, int>, std::vector<size_t> > versions;
+	    for (size_t j = 0; j < files.size(); j++)
+		versions[std::make_pair(files[j].name, files[j].id)].push_back(j);
+	    for (auto &v : versions) {
+		std::sort(v.second.begin(), v.second.end(), [&files](size_t a, size_t b) {
+		    return files[a].version > files[b].version;
+		});
+		for (size_t k = tiers[i].max_versions; k < v.second.size(); k++)
+		    moved[v.second[k]] = migrate(files[v.second[k]].stem, i);
+	    }
+	}
+	if (tiers[i].capacity > 0) {
+	    size_t total = 0, largest = 0;
+	    std::vector<size_t> lru;
+	    for (size_t j = 0; j < files.size(); j++)
+		if (!moved[j]) {
+		    total += files[j].size;
+		    largest = std::max(largest, files[j].size);
+		    lru.push_back(j);
+		}
+	    std::sort(lru.begin(), lru.end(), [&files](size_t a, size_t b) {
+		return files[a].last_use < files[b].last_use ||
+		    (files[a].last_use == files[b].last_use && files[a].version < files[b].version);
+	    });
+	    // leave room for the next checkpoint of the same size, but keep the most recently used version
+	    size_t limit = tiers[i].capacity > largest ? tiers[i].capacity - largest : 0;
+	    for (size_t k = 0; k < lru.size() && (total > tiers[i].capacity || (total > limit && k + 1 < lru.size())); k++)
+		if (migrate(files[lru[k]].stem, i))
+		    total -= files[lru[k]].size;
+	}
+    }
+}
+
+void tier_set_t::pin(const command_t &c) {
+    std::unique_lock<std::mutex> lock(pin_mutex);
+    pinned[c.stem()]++;
+}
+
+void tier_set_t::unpin(const command_t &c) {
+    std::unique_lock<std::mutex> lock(pin_mutex);
+    auto it = pinned.find(c.stem());
+    if (it != pinned.end() && --it->second == 0)
+	pinned.erase(it);
+}
+
+void tier_set_t::remove_local(const std::string &local) {
+    std::string target = link_target(local);
+    if (!target.empty())
+	unlink(target.c_str());
+    unlink(local.c_str());
+}
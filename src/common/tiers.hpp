@@ -0,0 +1,64 @@
+#ifndef __TIERS_HPP
+#define __TIERS_HPP
+
+#include "config.hpp"
+#include "command.hpp"
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+
+// a local storage tier (e.g. tmpfs, NVMe, burst buffer) that holds checkpoint files
+struct tier_t {
+    std::string name, path;
+    // capacity in bytes (0 = limited only by the free space of the file system) and bandwidth hint in MB/s
+    size_t capacity = 0, bandwidth = 0;
+    // number of versions of each checkpoint kept on the tier before older ones move down (0 = no limit)
+    int max_versions = 0;
+};
+
+// Ordered hierarchy of local tiers, fastest first. A checkpoint is written to the fastest tier with room and
+// the scratch directory keeps a symbolic link to it, so that the modules find every checkpoint in the same
+// place. Older versions move down the hierarchy and are evicted from the last tier. A version is pinned from the
+// moment its checkpoint is accepted until it is processed (e.g. flushed), and stays where it is until then.
+class tier_set_t {
+    std::string scratch;
+    std::vector<tier_t> tiers;
+    std::mutex pin_mutex;
+    std::map<std::string, int> pinned;
+
+    bool migrate(const std::string &stem, size_t from);
+public:
+    typedef std::function<bool (const std::string &)> writer_t;
+
+    tier_set_t(const config_t &cfg);
+    bool empty() const {
+	return tiers.empty();
+    }
+    const std::vector<tier_t> &get_tiers() const {
+	return tiers;
+    }
+    // bytes of checkpoint files stored on a tier
+    size_t used(size_t tier) const;
+    // tiers that can take a file of the given size, fastest first
+    std::vector<size_t> place(size_t size) const;
+    // writes the checkpoint using the writer on the fastest tier with room (falling back to the next tiers on
+    // error, e.g. ENOSPC, and finally to the scratch directory) and links it into the scratch directory. On a
+    // tier, the file only gets its final name once complete, so that a rebalance never sees it half written.
+    bool store(const command_t &c, size_t size, const writer_t &write) const;
+    // restores the link of a checkpoint found on a tier (searched in order), returns false if there is none
+    bool relink(const command_t &c) const;
+    // latest version of a checkpoint on any tier, -1 if none
+    int latest_version(const command_t &c) const;
+    // moves versions down according to the retention and capacity of each tier, evicts from the last tier
+    void rebalance();
+    // pins are counted, a version may be checkpointed again before the previous request was processed
+    void pin(const command_t &c);
+    void unpin(const command_t &c);
+
+    // removes a file of the scratch directory, including the tier copy it links to
+    static void remove_local(const std::string &local);
+};
+
+#endif // __TIERS_HPP
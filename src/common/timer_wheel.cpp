@@ -0,0 +1,89 @@
+#include "timer_wheel.hpp"
+
+timer_wheel_t::timer_wheel_t(std::chrono::milliseconds t) : tick(t), start(clock::now()) {
+    if (tick.count() <= 0)
+	tick = std::chrono::milliseconds(1);
+}
+
+void timer_wheel_t::link(entry_t *e) {
+    // the level is given by the highest bit in which the expiration and the current tick differ, so that the
+    // slot is visited (and cascaded) exactly when the current tick enters its span
+    uint64_t expires = std::max(e->expires, current);
+    const uint64_t span = ((uint64_t)1 << (BITS * LEVELS)) - 1;
+    if ((expires ^ current) > span)
+	// beyond the horizon: parked in the last slot of the top level, linked again when it cascades
+	expires = current | span;
+    unsigned int level = 0;
+    while (level + 1 < LEVELS && ((expires ^ current) >> (BITS * (level + 1))) != 0)
+	level++;
+    e->level = level;
+    e->slot = (expires >> (BITS * level)) & (SLOTS - 1);
+    e->prev = NULL;
+    e->next = slots[level][e->slot];
+    if (e->next != NULL)
+	e->next->prev = e;
+    slots[level][e->slot] = e;
+}
+
+void timer_wheel_t::unlink(entry_t *e) {
+    if (e->prev != NULL)
+	e->prev->next = e->next;
+    else
+	slots[e->level][e->slot] = e->next;
+    if (e->next != NULL)
+	e->next->prev = e->prev;
+}
+
+void timer_wheel_t::schedule(int id, clock::time_point deadline) {
+    uint64_t expires = current + 1;
+    if (deadline > start)
+	expires = std::max(expires, (uint64_t)((deadline - start + tick - clock::duration(1)) / tick));
+    auto it = entries.find(id);
+    if (it == entries.end()) {
+	it = entries.emplace(id, entry_t()).first;
+	it->second.id = id;
+    } else
+	unlink(&it->second);
+    it->second.expires = expires;
+    link(&it->second);
+}
+
+void timer_wheel_t::cancel(int id) {
+    auto it = entries.find(id);
+    if (it == entries.end())
+	return;
+    unlink(&it->second);
+    entries.erase(it);
+}
+
+std::vector<int> timer_wheel_t::advance(clock::time_point now) {
+    std::vector<int> expired;
+    uint64_t target = now > start ? (now - start) / tick : 0;
+    while (current < target) {
+	current++;
+	// higher levels first, so that the timers they hand down are cascaded further in the same tick
+	for (unsigned int level = LEVELS - 1; level > 0; level--) {
+	    if ((current & (((uint64_t)1 << (BITS * level)) - 1)) != 0)
+		continue;
+	    entry_t *e = slots[level][(current >> (BITS * level)) & (SLOTS - 1)];
+	    slots[level][(current >> (BITS * level)) & (SLOTS - 1)] = NULL;
+	    while (e != NULL) {
+		entry_t *next = e->next;
+		link(e);
+		e = next;
+	    }
+	}
+	entry_t *e = slots[0][current & (SLOTS - 1)];
+	slots[0][current & (SLOTS - 1)] = NULL;
+	while (e != NULL) {
+	    entry_t *next = e->next;
+	    if (e->expires <= current) {
+		expired.push_back(e->id);
+		entries.erase(e->id);
+	    } else
+		link(e);
+	    e = next;
+	}
+    }
+    return expired;
+}
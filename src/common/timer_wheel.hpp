@@ -0,0 +1,46 @@
+#ifndef __TIMER_WHEEL_HPP
+#define __TIMER_WHEEL_HPP
+
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// Hierarchical timer wheel: LEVELS wheels of SLOTS slots, a slot of level l spans SLOTS^l ticks. Scheduling,
+// rearming and cancelling a timer are O(1), whatever the number of timers; a timer cascades to the lower levels
+// as its deadline approaches, so advancing by one tick touches only the timers that are due. Not thread-safe.
+class timer_wheel_t {
+public:
+    typedef std::chrono::steady_clock clock;
+private:
+    static const unsigned int BITS = 6, SLOTS = 1 << BITS, LEVELS = 4;
+    struct entry_t {
+	int id;
+	uint64_t expires;
+	entry_t *prev = NULL, *next = NULL;
+	unsigned int level = 0, slot = 0;
+    };
+    std::chrono::milliseconds tick;
+    clock::time_point start;
+    uint64_t current = 0;
+    std::unordered_map<int, entry_t> entries;
+    entry_t *slots[LEVELS][SLOTS] = {};
+
+    void link(entry_t *e);
+    void unlink(entry_t *e);
+public:
+    timer_wheel_t(std::chrono::milliseconds tick);
+    // arms the timer of id, or rearms it if already armed; it expires at the first tick after the deadline
+    void schedule(int id, clock::time_point deadline);
+    void cancel(int id);
+    bool armed(int id) const {
+	return entries.find(id) != entries.end();
+    }
+    size_t size() const {
+	return entries.size();
+    }
+    // moves the wheel to now and returns the timers that expired meanwhile, which are disarmed
+    std::vector<int> advance(clock::time_point now);
+};
+
+#endif // __TIMER_WHEEL_HPP
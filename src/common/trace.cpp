@@ -0,0 +1,121 @@
+#include "trace.hpp"
+
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdio>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+//#define __DEBUG
+#include "debug.hpp"
+
+namespace veloc_trace {
+
+std::atomic<bool> enabled{false};
+
+static std::mutex registry_mutex;
+static std::vector<ring_t *> registry;
+static std::thread drain_thread;
+static std::mutex drain_mutex;
+static std::condition_variable drain_cond;
+static bool drain_stop = false;
+static FILE *trace_file = NULL;
+static uint64_t reported_drops = 0;
+
+// releases the ring buffer when the owner thread exits, so that short-lived workers recycle buffers
+struct ring_owner_t {
+    ring_t *ring = NULL;
+    uint32_t tid = 0;
+    ~ring_owner_t() {
+	if (ring != NULL)
+	    ring->in_use.store(false, std::memory_order_release);
+    }
+};
+static thread_local ring_owner_t owner;
+
+ring_t *local_ring(uint32_t &tid) {
+    if (owner.ring == NULL) {
+	owner.tid = syscall(SYS_gettid);
+	std::unique_lock<std::mutex> lock(registry_mutex);
+	// only recycle rings that were already drained, otherwise short-lived threads would overflow them
+	for (auto r : registry) {
+	    bool expected = false;
+	    if (r->head.load() == r->tail.load() && r->in_use.compare_exchange_strong(expected, true)) {
+		owner.ring = r;
+		break;
+	    }
+	}
+	if (owner.ring == NULL) {
+	    owner.ring = new ring_t();
+	    owner.ring->in_use = true;
+	    registry.push_back(owner.ring);
+	}
+    }
+    tid = owner.tid;
+    return owner.ring;
+}
+
+static void drain() {
+    uint64_t drops = 0;
+    // rings are never freed, so it is enough to hold the lock while taking a copy of the registry
+    std::unique_lock<std::mutex> lock(registry_mutex);
+    std::vector<ring_t *> rings(registry);
+    lock.unlock();
+    for (auto r : rings) {
+	uint64_t t = r->tail.load(std::memory_order_relaxed), h = r->head.load(std::memory_order_acquire);
+	for (; t < h; t++)
+	    fwrite(&r->events[t % ring_t::CAPACITY], sizeof(event_t), 1, trace_file);
+	r->tail.store(t, std::memory_order_release);
+	drops += r->dropped.load(std::memory_order_relaxed);
+    }
+    fflush(trace_file);
+    if (drops > reported_drops) {
+	ERROR("trace buffers full, " << drops - reported_drops << " events dropped");
+	reported_drops = drops;
+    }
+}
+
+bool init(const std::string &dir, unsigned int interval_ms) {
+    if (trace_file != NULL)
+	return true;
+    std::string fname = dir + "/veloc-trace-" + std::to_string(getpid()) + ".bin";
+    trace_file = fopen(fname.c_str(), "wb");
+    if (trace_file == NULL) {
+	ERROR("cannot open trace file " << fname);
+	return false;
+    }
+    file_header_t header = {TRACE_MAGIC, TRACE_VERSION, (uint32_t)getpid(), sizeof(event_t)};
+    fwrite(&header, sizeof(header), 1, trace_file);
+    drain_stop = false;
+    drain_thread = std::thread([interval_ms]() {
+	std::unique_lock<std::mutex> lock(drain_mutex);
+	while (!drain_stop) {
+	    drain_cond.wait_for(lock, std::chrono::milliseconds(interval_ms));
+	    drain();
+	}
+    });
+    // the last message written to std::clog, the next ones are recorded as events
+    INFO("tracing enabled, writing events to " << fname);
+    enabled = true;
+    atexit(finalize);
+    return true;
+}
+
+void finalize() {
+    if (trace_file == NULL)
+	return;
+    enabled = false;
+    std::unique_lock<std::mutex> lock(drain_mutex);
+    drain_stop = true;
+    drain_cond.notify_one();
+    lock.unlock();
+    drain_thread.join();
+    drain();
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+}
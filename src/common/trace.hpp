@@ -0,0 +1,95 @@
+#ifndef __TRACE_HPP
+#define __TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+namespace veloc_trace {
+
+enum event_type_t : uint16_t {
+    ENQUEUE = 0, DEQUEUE, COMPLETE, MODULE_BEGIN, MODULE_END, IO_BEGIN, IO_END, SPAN, LOG
+};
+
+// level of a LOG event, stored in its command field
+enum log_level_t : uint16_t {
+    LOG_DEBUG = 0, LOG_INFO, LOG_ERROR
+};
+
+static const uint32_t TRACE_MAGIC = 0x43525456; // "VTRC"
+static const uint32_t TRACE_VERSION = 1;
+static const size_t LABEL_SIZE = 16;
+
+// fixed-size binary event, written as-is to the trace files
+struct event_t {
+    uint64_t ts;         // steady clock, nanoseconds (CLOCK_MONOTONIC, comparable across processes on the same node)
+    uint64_t arg;        // bytes for I/O events, duration in ns for SPAN, status for COMPLETE, source line for LOG
+    int32_t id, version; // unique_id and version of the command
+    uint32_t tid;
+    uint16_t type, command;
+    char label[LABEL_SIZE];
+};
+
+// header at the beginning of each trace file
+struct file_header_t {
+    uint32_t magic, version, pid, event_size;
+};
+
+// single producer (owner thread) / single consumer (drain thread) ring buffer
+struct ring_t {
+    static const size_t CAPACITY = 4096;
+    event_t events[CAPACITY];
+    std::atomic<uint64_t> head{0}, tail{0}, dropped{0};
+    std::atomic<bool> in_use{false};
+
+    void push(const event_t &e) {
+	uint64_t h = head.load(std::memory_order_relaxed);
+	if (h - tail.load(std::memory_order_acquire) >= CAPACITY) {
+	    dropped.fetch_add(1, std::memory_order_relaxed);
+	    return;
+	}
+	events[h % CAPACITY] = e;
+	head.store(h + 1, std::memory_order_release);
+    }
+};
+
+extern std::atomic<bool> enabled;
+
+// starts tracing into <dir>/veloc-trace-<pid>.bin, drained every interval_ms milliseconds
+bool init(const std::string &dir, unsigned int interval_ms = 100);
+// drains all buffers and stops the drain thread
+void finalize();
+// returns the ring buffer of the calling thread (acquired on first use) and its thread id
+ring_t *local_ring(uint32_t &tid);
+
+inline uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void record(uint16_t type, int id, int version, int command, const char *label, uint64_t arg, uint64_t ts = 0) {
+    if (!enabled.load(std::memory_order_relaxed))
+	return;
+    event_t e;
+    e.ts = ts == 0 ? now() : ts;
+    e.arg = arg;
+    e.id = id;
+    e.version = version;
+    e.type = type;
+    e.command = command;
+    strncpy(e.label, label, LABEL_SIZE);
+    ring_t *r = local_ring(e.tid);
+    if (r != NULL)
+	r->push(e);
+}
+
+}
+
+// trace points for commands (anything with unique_id, version and command fields)
+#define TRACE_CMD(type, c, label, arg) veloc_trace::record(veloc_trace::type, (c).unique_id, (c).version, (c).command, label, arg)
+#define TRACE_IO(type, label, bytes) veloc_trace::record(veloc_trace::type, -1, -1, -1, label, bytes)
+#define TRACE_LOG(level) veloc_trace::record(veloc_trace::LOG, -1, -1, veloc_trace::level, __FUNCTION__, __LINE__)
+
+#endif // __TRACE_HPP
@@ -1,8 +1,11 @@
 #include "client.hpp"
 #include "include/veloc.h"
 
-#include <fstream>
 #include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <future>
+#include <fcntl.h>
 #include <unistd.h>
 #include <ftw.h>
 #include <limits.h>
@@ -11,30 +14,60 @@
 //#define __DEBUG
 #include "common/debug.hpp"
 const uint16_t providerId=22;
+// number of streamed chunks in flight per client
+static const size_t STREAM_DEPTH = 4;
+// number of requests in flight per client
+static const size_t ENQUEUE_DEPTH = 16;
 veloc_client_t::veloc_client_t(MPI_Comm c, const char *cfg_file) :
-    cfg(cfg_file), comm(c),
-    myEngine("tcp",THALLIUM_CLIENT_MODE),
-    enqueue(myEngine.define("enqueue").disable_response()),
+    cfg(cfg_file), comm(c), streamer(cfg), tiers(cfg),
+    // RPCs progress on a dedicated execution stream, not on the application thread
+    myEngine("tcp",THALLIUM_CLIENT_MODE,true),
+    enqueue_ordered(myEngine.define("enqueue_ordered")),
     wait_completion(myEngine.define("wait_completion")),
     get(myEngine.define("get")),
-    init(myEngine.define("init").disable_response()),
+    init(myEngine.define("init")),
+    stream_chunk(myEngine.define("stream_chunk")),
+    stream_commit(myEngine.define("stream_commit")),
+    heartbeat(myEngine.define("heartbeat").disable_response()),
+    queue_depth_rpc(myEngine.define("queue_depth")),
+    phase_rpc(myEngine.define("hint_phase").disable_response()),
     server(myEngine.lookup("tcp://127.0.0.1:1234")),
     ph(server,providerId){
     MPI_Comm_rank(comm, &rank);
+    std::string trace_dir;
+    if (cfg.get_optional("trace_dir", trace_dir)) {
+	int trace_interval;
+	if (!cfg.get_optional("trace_interval", trace_interval))
+	    trace_interval = 100;
+	veloc_trace::init(trace_dir, trace_interval);
+    }
     if (!cfg.get_optional("max_versions", max_versions)) {
 	INFO("Max number of versions to keep not specified, keeping all");
 	max_versions = 0;
     }
     collective = cfg.get_optional("collective", true);
+    int chunk_size;
+    stream_chunk_size = cfg.get_optional("stream_chunk_size", chunk_size) && chunk_size > 0 ? chunk_size : 16 << 20;
     if (cfg.is_sync()) {
 	modules = new module_manager_t();
 	modules->add_default_modules(cfg, comm, true);
     }else{
-    std::cout<<"trying init"<<std::endl;
+    // waits for the backend to reset the numbering of the requests of this client before sending the first one
     init.on(ph)(std::to_string(rank));
-    std::cout<<"init succeded"<<std::endl;
+    staging_info_t info = myEngine.define("staging_info").on(ph)();
+    if (!info.fds.empty() && !staging.attach(info))
+	INFO("cannot map the staging arenas of the backend, using the scratch directory only");
     }
     ec_active = run_blocking(command_t(rank, command_t::INIT, 0, "")) > 0;
+    int heartbeat_interval;
+    if (!cfg.is_sync() && cfg.get_optional("heartbeat_interval", heartbeat_interval) && heartbeat_interval > 0)
+	heartbeat_thread = std::thread([this, heartbeat_interval]() {
+	    std::unique_lock<std::mutex> lock(heartbeat_mutex);
+	    while (!stopping) {
+		heartbeat.on(ph)(rank);
+		heartbeat_cond.wait_for(lock, std::chrono::seconds(heartbeat_interval));
+	    }
+	});
     DBG("VELOC initialized");
 }
 
@@ -43,17 +76,68 @@ static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW
 }
 
 void veloc_client_t::cleanup() {
-    nftw(cfg.get("scratch").c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
-    nftw(cfg.get("persistent").c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    nftw(cfg.get_scratch().c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    nftw(cfg.get_persistent().c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    for (auto &t : tiers.get_tiers())
+	nftw(t.path.c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
 }
 
 veloc_client_t::~veloc_client_t() {
+    drain();
+    if (heartbeat_thread.joinable()) {
+	std::unique_lock<std::mutex> lock(heartbeat_mutex);
+	stopping = true;
+	heartbeat_cond.notify_one();
+	lock.unlock();
+	heartbeat_thread.join();
+    }
     delete modules;
     DBG("VELOC finalized");
 }
 
 bool veloc_client_t::mem_protect(int id, void *ptr, size_t count, size_t base_size) {
-    mem_regions[id] = std::make_pair(ptr, base_size * count);
+    struct iovec segment = {ptr, base_size * count};
+    return mem_protect(id, &segment, 1);
+}
+
+bool veloc_client_t::mem_protect(int id, const struct iovec *segments, size_t no_segments) {
+    region_t region;
+    for (size_t i = 0; i < no_segments; i++) {
+	if (segments[i].iov_len == 0)
+	    continue;
+	if (segments[i].iov_base == NULL) {
+	    ERROR("memory region " << id << " has a NULL segment of " << segments[i].iov_len << " bytes");
+	    return false;
+	}
+	// merge adjacent segments (e.g. strided regions with stride == block size) to keep the I/O vectors short
+	if (!region.segments.empty() && (char *)region.segments.back().iov_base + region.segments.back().iov_len == segments[i].iov_base)
+	    region.segments.back().iov_len += segments[i].iov_len;
+	else
+	    region.segments.push_back(segments[i]);
+	region.size += segments[i].iov_len;
+    }
+    mem_regions[id] = region;
+    return true;
+}
+
+// writes or reads the whole list of segments, retrying on partial transfers
+static bool transfer_segments(int fd, std::vector<struct iovec> iov, bool write) {
+    size_t first = 0;
+    while (first < iov.size()) {
+	int count = std::min(iov.size() - first, (size_t)IOV_MAX);
+	ssize_t ret = write ? writev(fd, &iov[first], count) : readv(fd, &iov[first], count);
+	if (ret < 0 && errno == EINTR)
+	    continue;
+	if (ret <= 0)
+	    return false;
+	size_t done = ret;
+	while (first < iov.size() && done >= iov[first].iov_len)
+	    done -= iov[first++].iov_len;
+	if (done > 0) {
+	    iov[first].iov_base = (char *)iov[first].iov_base + done;
+	    iov[first].iov_len -= done;
+	}
+    }
     return true;
 }
 
@@ -68,8 +152,9 @@ bool veloc_client_t::checkpoint_wait() {
 	ERROR("need to finalize local checkpoint first by calling checkpoint_end()");
 	return false;
     }
-    int t=wait_completion.on(ph)(true); 
-    return t== VELOC_SUCCESS;
+    bool sent = drain();
+    int t=wait_completion.on(ph)(std::to_string(rank), true);
+    return sent && t== VELOC_SUCCESS;
 }
 
 bool veloc_client_t::checkpoint_begin(const char *name, int version) {
@@ -89,9 +174,11 @@ bool veloc_client_t::checkpoint_begin(const char *name, int version) {
 	version_history.push_back(version);
 	if ((int)version_history.size() > max_versions) {
 	    // wait for operations to complete in async mode before deleting old versions
-	    if (!cfg.is_sync())
-		int b=wait_completion.on(ph)(false);
-	    remove(current_ckpt.filename(cfg.get("scratch"), version_history.front()).c_str());
+	    if (!cfg.is_sync()) {
+		drain();
+		wait_completion.on(ph)(std::to_string(rank), false);
+	    }
+	    tier_set_t::remove_local(current_ckpt.filename(cfg.get_scratch(), version_history.front()));
 	    version_history.pop_front();
 	}
     }
@@ -99,48 +186,222 @@ bool veloc_client_t::checkpoint_begin(const char *name, int version) {
     return true;
 }
 
+static bool write_file(const std::string &fname, const std::vector<struct iovec> &iov) {
+    int fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool success = fd != -1 && transfer_segments(fd, iov, true);
+    if (fd != -1 && close(fd) != 0)
+	success = false;
+    return success;
+}
+
+bool veloc_client_t::write_local(const std::vector<struct iovec> &iov, size_t size) {
+    if (tiers.empty())
+	return write_file(current_ckpt.filename(cfg.get_scratch()), iov);
+    return tiers.store(current_ckpt, size, [&iov](const std::string &f) { return write_file(f, iov); });
+}
+
+bool veloc_client_t::stream_checkpoint(const std::vector<struct iovec> &iov, size_t size) {
+    staging_arena_t *arena = staging.local();
+    if (arena != NULL) {
+	// hand the checkpoint over to the backend in chunks of shared memory, a few of them in flight at a time
+	size_t chunk_size = std::min(stream_chunk_size, arena->get_capacity() / 4);
+	size_t seg = 0, seg_offset = 0;
+	// the backend releases the buffer of a chunk once it answered, the client if the request failed
+	struct chunk_t {
+	    tl::async_response response;
+	    uint64_t buf;
+	    size_t len;
+	};
+	std::deque<chunk_t> pending;
+	bool success = true;
+	auto complete = [&]() {
+	    chunk_t chunk = std::move(pending.front());
+	    pending.pop_front();
+	    try {
+		int ret = chunk.response.wait();
+		success = success && ret == VELOC_SUCCESS;
+	    } catch (std::exception &e) {
+		arena->release(chunk.buf, chunk.len);
+		throw;
+	    }
+	};
+	try {
+	    for (size_t offset = 0; offset < size && success; ) {
+		size_t len = std::min(chunk_size, size - offset);
+		uint64_t buf;
+		while ((buf = arena->allocate(len)) == 0 && !pending.empty())
+		    complete();
+		if (buf == 0) {
+		    success = false;
+		    break;
+		}
+		// gather the next chunk from the segments
+		char *dest = (char *)arena->address(buf);
+		for (size_t left = len; left > 0; ) {
+		    size_t n = std::min(left, iov[seg].iov_len - seg_offset);
+		    memcpy(dest, (char *)iov[seg].iov_base + seg_offset, n);
+		    dest += n;
+		    left -= n;
+		    seg_offset += n;
+		    if (seg_offset == iov[seg].iov_len) {
+			seg++;
+			seg_offset = 0;
+		    }
+		}
+		try {
+		    pending.push_back(chunk_t{stream_chunk.on(server).async(current_ckpt, offset, arena->get_node(), buf, len),
+					      buf, len});
+		} catch (std::exception &e) {
+		    arena->release(buf, len);
+		    throw;
+		}
+		offset += len;
+		if (pending.size() > STREAM_DEPTH)
+		    complete();
+	    }
+	    while (!pending.empty())
+		complete();
+	    int ret = stream_commit.on(server)(current_ckpt, size, success);
+	    if (ret == VELOC_SUCCESS)
+		return true;
+	} catch (std::exception &e) {
+	    ERROR("cannot stream checkpoint " << current_ckpt << " to the backend: " << e.what());
+	    // the chunks still in flight must be answered or failed before their buffers can be reused, and the
+	    // backend drops what it received
+	    while (!pending.empty())
+		try {
+		    complete();
+		} catch (std::exception &) { }
+	    try {
+		stream_commit.on(server)(current_ckpt, size, false);
+	    } catch (std::exception &e) {
+		ERROR("cannot cancel the streaming of " << current_ckpt << ": " << e.what());
+	    }
+	}
+	INFO("streaming " << current_ckpt << " through the backend failed, writing it directly");
+    }
+    // sync mode or no shared memory with the backend: the client writes the persistent copy itself
+    int ret = streamer.write(current_ckpt, 0, iov);
+    return streamer.commit(current_ckpt, size, ret == VELOC_SUCCESS) == VELOC_SUCCESS;
+}
+
 bool veloc_client_t::checkpoint_mem() {
     if (!checkpoint_in_progress) {
 	ERROR("must call checkpoint_begin() first");
 	return false;
     }
-    std::ofstream f;
-    f.exceptions(std::ofstream::failbit | std::ofstream::badbit);
-    try {
-	f.open(current_ckpt.filename(cfg.get("scratch")), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
-	size_t regions_size = mem_regions.size();
-	f.write((char *)&regions_size, sizeof(size_t));
-	for (auto &e : mem_regions) {
-	    f.write((char *)&(e.first), sizeof(int));
-	    f.write((char *)&(e.second.second), sizeof(size_t));
-	}
-        for (auto &e : mem_regions)
-	    f.write((char *)e.second.first, e.second.second);
-    } catch (std::ofstream::failure &f) {
-	ERROR("cannot write to checkpoint file: " << current_ckpt << ", reason: " << f.what());
+    size_t total = 0;
+    for (auto &e : mem_regions)
+	total += e.second.size;
+    TRACE_CMD(IO_BEGIN, current_ckpt, "checkpoint_mem", total);
+    // header (number of regions, then id and size of each region) followed by the segments of all regions
+    size_t regions_size = mem_regions.size();
+    std::vector<char> header(sizeof(size_t) + regions_size * (sizeof(int) + sizeof(size_t)));
+    char *p = header.data();
+    memcpy(p, &regions_size, sizeof(size_t));
+    p += sizeof(size_t);
+    for (auto &e : mem_regions) {
+	memcpy(p, &e.first, sizeof(int));
+	memcpy(p + sizeof(int), &e.second.size, sizeof(size_t));
+	p += sizeof(int) + sizeof(size_t);
+    }
+    std::vector<struct iovec> iov = {{header.data(), header.size()}};
+    for (auto &e : mem_regions)
+	iov.insert(iov.end(), e.second.segments.begin(), e.second.segments.end());
+    bool success;
+    if (cfg.is_streamed(current_ckpt.name)) {
+	// the scratch copy, if any, is written while the checkpoint is streamed to the persistent storage
+	std::future<bool> local;
+	if (cfg.keeps_local(current_ckpt.name))
+	    local = std::async(std::launch::async, &veloc_client_t::write_local, this, std::cref(iov), header.size() + total);
+	success = stream_checkpoint(iov, header.size() + total);
+	if (local.valid() && !local.get())
+	    success = false;
+    } else
+	success = write_local(iov, header.size() + total);
+    if (!success) {
+	ERROR("cannot write to checkpoint file: " << current_ckpt << ", reason: " << std::strerror(errno));
+	TRACE_CMD(IO_END, current_ckpt, "checkpoint_mem", 0);
 	return false;
     }
+    TRACE_CMD(IO_END, current_ckpt, "checkpoint_mem", total);
     return true;
 }
 
 bool veloc_client_t::checkpoint_end(bool /*success*/) {
     checkpoint_in_progress = false;
-    if (cfg.is_sync())
+    if (cfg.is_sync()) {
+	modules->announce(current_ckpt);
 	return modules->notify_command(current_ckpt) == VELOC_SUCCESS;
-    else {
-	enqueue.on(ph)(current_ckpt);
+    } else {
+	post(current_ckpt);
 	return true;
     }
 }
 
+bool veloc_client_t::reap() {
+    // waits for the acknowledgement of the oldest request in flight
+    bool success;
+    try {
+	// the backend acknowledges with the number of unfinished requests of the client
+	int ret = outstanding.front().wait();
+	success = ret >= 0;
+    } catch (std::exception &e) {
+	ERROR("request of client " << rank << " failed: " << e.what());
+	success = false;
+    }
+    outstanding.pop_front();
+    return success;
+}
+
+void veloc_client_t::post(const command_t &cmd) {
+    // the request is sent by the progress execution stream, the application only waits if too many are in flight
+    while (!outstanding.empty() && (outstanding.size() >= ENQUEUE_DEPTH || outstanding.front().received()))
+	if (!reap())
+	    async_failed = true;
+    outstanding.push_back(enqueue_ordered.on(ph).async(cmd, next_seq++));
+}
+
+bool veloc_client_t::drain() {
+    // failures of requests acknowledged earlier are reported by the next drain
+    bool success = !async_failed;
+    async_failed = false;
+    while (!outstanding.empty())
+	success = reap() && success;
+    return success;
+}
+
+int veloc_client_t::queue_depth() {
+    // requests not yet acknowledged are not counted by the backend
+    if (cfg.is_sync())
+	return 0;
+    int depth = queue_depth_rpc.on(ph)(std::to_string(rank));
+    return depth + outstanding.size();
+}
+
+bool veloc_client_t::hint_phase(int p) {
+    // in sync mode, the flushes happen within VELOC_Checkpoint_end and cannot be moved. Only the changes of phase
+    // are sent, which costs a one-way message.
+    if (cfg.is_sync() || p == phase)
+	return true;
+    phase = p;
+    // the backend drops the hints older than the last one it applied. The steady clock is shared by the processes
+    // of the node, so that the hints of a restarted client are never mistaken for stale ones.
+    uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count();
+    phase_seq = std::max(phase_seq + 1, now);
+    phase_rpc.on(ph)(rank, phase, phase_seq);
+    return true;
+}
+
 int veloc_client_t::run_blocking(const command_t &cmd) {
     if (cfg.is_sync())
 	return modules->notify_command(cmd);
     else {
-	enqueue.on(ph)(cmd);
-    	int babe =get.on(ph)();
-    	std::cout<<"Ok I called vAlue"<<babe<<std::endl;
-	int tet=wait_completion.on(ph)(true);
+	post(cmd);
+	if (!drain())
+	    return VELOC_FAILURE;
+	int tet=wait_completion.on(ph)(std::to_string(rank), true);
 	return tet;
     }
 }
@@ -159,7 +420,7 @@ std::string veloc_client_t::route_file(const char *original) {
     char abs_path[PATH_MAX + 1];
     if (original[0] != '/' && getcwd(abs_path, PATH_MAX) != NULL)
 	current_ckpt.assign_path(abs_path, std::string(abs_path) + "/" + std::string(original));
-    return current_ckpt.filename(cfg.get("scratch"));    	
+    return current_ckpt.filename(cfg.get_scratch());    	
 }
 
 bool veloc_client_t::restart_begin(const char *name, int version) {
@@ -170,7 +431,7 @@ bool veloc_client_t::restart_begin(const char *name, int version) {
 	return false;
     }
     current_ckpt = command_t(rank, command_t::RESTART, version, name);    
-    if (access(current_ckpt.filename(cfg.get("scratch")).c_str(), R_OK) == 0)
+    if (access(current_ckpt.filename(cfg.get_scratch()).c_str(), R_OK) == 0)
 	result = VELOC_SUCCESS;
     else 
 	result = run_blocking(current_ckpt);
@@ -190,42 +451,63 @@ bool veloc_client_t::restart_begin(const char *name, int version) {
 }
 
 bool veloc_client_t::recover_mem(int mode, std::set<int> &ids) {
-    std::ifstream f;
     std::map<int, size_t> region_info;
+    size_t total = 0;
 
-    f.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    try {
-	f.open(current_ckpt.filename(cfg.get("scratch")), std::ifstream::in | std::ifstream::binary);
-	size_t no_regions, region_size;
+    TRACE_CMD(IO_BEGIN, current_ckpt, "recover_mem", 0);
+    int fd = open(current_ckpt.filename(cfg.get_scratch()).c_str(), O_RDONLY);
+    bool success = fd != -1;
+    size_t no_regions = 0;
+    if (success) {
+	struct iovec count = {&no_regions, sizeof(size_t)};
+	success = transfer_segments(fd, {count}, false);
+    }
+    for (unsigned int i = 0; success && i < no_regions; i++) {
 	int id;
-	f.read((char *)&no_regions, sizeof(size_t));
-	for (unsigned int i = 0; i < no_regions; i++) {
-	    f.read((char *)&id, sizeof(int));
-	    f.read((char *)&region_size, sizeof(size_t));
-	    region_info.insert(std::make_pair(id, region_size));
+	size_t region_size;
+	success = transfer_segments(fd, {{&id, sizeof(int)}, {&region_size, sizeof(size_t)}}, false);
+	region_info.insert(std::make_pair(id, region_size));
+    }
+    for (auto it = region_info.begin(); success && it != region_info.end(); it++) {
+	auto &e = *it;
+	bool found = ids.find(e.first) != ids.end();
+	if ((mode == VELOC_RECOVER_SOME && !found) || (mode == VELOC_RECOVER_REST && found)) {
+	    success = lseek(fd, e.second, SEEK_CUR) != -1;
+	    continue;
 	}
-	for (auto &e : region_info) {
-	    bool found = ids.find(e.first) != ids.end();
-	    if ((mode == VELOC_RECOVER_SOME && !found) || (mode == VELOC_RECOVER_REST && found)) {
-		f.seekg(e.second, std::ifstream::cur);
-		continue;
-	    }
-	    if (mem_regions.find(e.first) == mem_regions.end()) {
-		ERROR("no protected memory region defined for id " << e.first);
-		return false;
-	    }
-	    if (mem_regions[e.first].second < e.second) {
-		ERROR("protected memory region " << e.first << " is too small ("
-		      << mem_regions[e.first].second << ") to hold required size ("
-		      << e.second << ")");
-		return false;
-	    }
-	    f.read((char *)mem_regions[e.first].first, e.second);
+	auto region = mem_regions.find(e.first);
+	if (region == mem_regions.end()) {
+	    ERROR("no protected memory region defined for id " << e.first);
+	    close(fd);
+	    return false;
 	}
-    } catch (std::ifstream::failure &e) {
-	ERROR("cannot read checkpoint file " << current_ckpt << ", reason: " << e.what());
+	if (region->second.size < e.second) {
+	    ERROR("protected memory region " << e.first << " is too small ("
+		  << region->second.size << ") to hold required size ("
+		  << e.second << ")");
+	    close(fd);
+	    return false;
+	}
+	// scatter the saved bytes over the segments, in order
+	std::vector<struct iovec> iov;
+	size_t left = e.second;
+	for (auto &seg : region->second.segments) {
+	    if (left == 0)
+		break;
+	    iov.push_back({seg.iov_base, std::min(left, seg.iov_len)});
+	    left -= iov.back().iov_len;
+	}
+	success = transfer_segments(fd, iov, false);
+	total += e.second;
+    }
+    if (fd != -1)
+	close(fd);
+    if (!success) {
+	ERROR("cannot read checkpoint file " << current_ckpt << ", reason: " << std::strerror(errno));
+	TRACE_CMD(IO_END, current_ckpt, "recover_mem", total);
 	return false;
     }
+    TRACE_CMD(IO_END, current_ckpt, "recover_mem", total);
     return true;
 }
 
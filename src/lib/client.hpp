@@ -1,15 +1,24 @@
 #ifndef __CLIENT_HPP
 #define __CLIENT_HPP
 
+#include "include/veloc.h"
 #include "common/config.hpp"
 #include "common/command.hpp"
 #include "common/ipc_queue.hpp"
+#include "common/staging.hpp"
+#include "common/stream_writer.hpp"
+#include "common/tiers.hpp"
 #include "modules/module_manager.hpp"
 
 #include <unordered_map>
 #include <map>
 #include <set>
 #include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/uio.h>
 #include <thallium.hpp>
 #include <thallium/serialization/stl/string.hpp>
 namespace tl=thallium;
@@ -19,7 +28,11 @@ class veloc_client_t {
     bool collective, ec_active;
     int max_versions;
     
-    typedef std::pair <void *, size_t> region_t;
+    // a region is a list of segments, written (gather) and read back (scatter) consecutively
+    struct region_t {
+	std::vector<struct iovec> segments;
+	size_t size = 0;
+    };
     typedef std::map<int, region_t> regions_t;
     typedef std::map<std::string, std::deque<int> > checkpoint_history_t;
 
@@ -30,13 +43,38 @@ class veloc_client_t {
     bool checkpoint_in_progress = false;    
 
     module_manager_t *modules = NULL;
+    staging_t staging;
+    stream_writer_t streamer;
+    tier_set_t tiers;
+    size_t stream_chunk_size;
+    // tells the watchdog of the backend that the client is alive, also between checkpoints
+    std::thread heartbeat_thread;
+    std::mutex heartbeat_mutex;
+    std::condition_variable heartbeat_cond;
+    bool stopping = false;
+
+    // requests sent to the backend whose handling is not yet acknowledged, oldest first
+    std::deque<tl::async_response> outstanding;
+    uint64_t next_seq = 0;
+    bool async_failed = false;
 
     int run_blocking(const command_t &cmd);
+    void post(const command_t &cmd);
+    bool reap();
+    bool drain();
+    bool stream_checkpoint(const std::vector<struct iovec> &iov, size_t size);
+    bool write_local(const std::vector<struct iovec> &iov, size_t size);
     tl::engine myEngine;
+    tl::remote_procedure enqueue_ordered;
     tl::remote_procedure wait_completion;
-    tl::remote_procedure enqueue;
     tl::remote_procedure get;
     tl::remote_procedure init;
+    tl::remote_procedure stream_chunk, stream_commit;
+    tl::remote_procedure heartbeat;
+    tl::remote_procedure queue_depth_rpc;
+    tl::remote_procedure phase_rpc;
+    int phase = VELOC_PHASE_COMPUTE;
+    uint64_t phase_seq = 0;
     tl::endpoint server;
     tl::provider_handle ph;
 public:
@@ -44,13 +82,21 @@ public:
     void cleanup();
 
     bool mem_protect(int id, void *ptr, size_t count, size_t base_size);
+    bool mem_protect(int id, const struct iovec *segments, size_t no_segments);
     bool mem_unprotect(int id);
     std::string route_file(const char *original);
+    // shared memory of the backend for in-memory checkpoint staging, empty if not enabled
+    staging_t &get_staging() {
+	return staging;
+    }
 
     bool checkpoint_begin(const char *name, int version);
     bool checkpoint_mem();
     bool checkpoint_end(bool success);
     bool checkpoint_wait();
+    // number of checkpoint requests of this client that the backend has not finished yet
+    int queue_depth();
+    bool hint_phase(int phase);
 
     int restart_test(const char *name, int version);
     bool restart_begin(const char *name, int version);
@@ -1,4 +1,5 @@
 #include "include/veloc.h"
+#include "include/veloc.hpp"
 #include "client.hpp"
 
 static veloc_client_t *veloc_client = NULL;
@@ -28,6 +29,29 @@ extern "C" int VELOC_Mem_protect(int id, void *ptr, size_t count, size_t base_si
     return CLIENT_CALL(veloc_client->mem_protect(id, ptr, count, base_size));
 }
 
+extern "C" int VELOC_Mem_protect_strided(int id, void *base, size_t count, size_t block_size, size_t stride) {
+    if (veloc_client == NULL)
+	return VELOC_FAILURE;
+    if (stride < block_size) {
+	ERROR("stride (" << stride << ") of memory region " << id << " is smaller than its block size (" << block_size << ")");
+	return VELOC_FAILURE;
+    }
+    std::vector<struct iovec> segments(count);
+    for (size_t i = 0; i < count; i++)
+	segments[i] = {(char *)base + i * stride, block_size};
+    return CLIENT_CALL(veloc_client->mem_protect(id, segments.data(), count));
+}
+
+extern "C" int VELOC_Mem_protect_iov(int id, const struct iovec *iov, int iovcnt) {
+    if (iovcnt < 0)
+	return VELOC_FAILURE;
+    return CLIENT_CALL(veloc_client->mem_protect(id, iov, iovcnt));
+}
+
+int veloc::detail::mem_protect_segments(int id, const struct iovec *segments, size_t no_segments) {
+    return CLIENT_CALL(veloc_client->mem_protect(id, segments, no_segments));
+}
+
 extern "C" int VELOC_Mem_unprotect(int id) {
     return CLIENT_CALL(veloc_client->mem_unprotect(id));
 }
@@ -48,6 +72,19 @@ extern "C" int VELOC_Checkpoint_wait() {
     return CLIENT_CALL(veloc_client->checkpoint_wait());
 }
 
+extern "C" int VELOC_Checkpoint_queue_depth(int *depth) {
+    if (veloc_client == NULL || depth == NULL)
+	return VELOC_FAILURE;
+    *depth = veloc_client->queue_depth();
+    return *depth >= 0 ? VELOC_SUCCESS : VELOC_FAILURE;
+}
+
+extern "C" int VELOC_Hint_phase(int phase) {
+    if (phase != VELOC_PHASE_COMPUTE && phase != VELOC_PHASE_COMMUNICATE && phase != VELOC_PHASE_IO)
+	return VELOC_FAILURE;
+    return CLIENT_CALL(veloc_client->hint_phase(phase));
+}
+
 extern "C" int VELOC_Restart_test(const char *name, int version) {
     if (veloc_client == NULL)
 	return -1;
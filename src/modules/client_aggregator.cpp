@@ -1,24 +1,248 @@
 #include "client_aggregator.hpp"
 
-client_aggregator_t::client_aggregator_t(const agg_function_t &f, const single_function_t &g) :
-    agg_function(f), single_function(g) { }
+#include <set>
+#include <sstream>
+
+//#define __DEBUG
+#include "common/debug.hpp"
+
+// a round that agreed on nothing is repeated after this delay, until the other backends are ready as well
+static const std::chrono::milliseconds ROUND_RETRY(100);
+// how often the backends check whether the first one started a round
+static const std::chrono::milliseconds ROUND_POLL(1);
+
+static std::vector<std::string> allgather_strings(const std::string &local, MPI_Comm comm) {
+    int size, len = local.size();
+    MPI_Comm_size(comm, &size);
+    std::vector<int> lens(size), displs(size, 0);
+    MPI_Allgather(&len, 1, MPI_INT, lens.data(), 1, MPI_INT, comm);
+    for (int i = 1; i < size; i++)
+	displs[i] = displs[i - 1] + lens[i - 1];
+    std::vector<char> all(displs[size - 1] + lens[size - 1] + 1);
+    MPI_Allgatherv(local.data(), len, MPI_CHAR, all.data(), lens.data(), displs.data(), MPI_CHAR, comm);
+    std::vector<std::string> result;
+    for (int i = 0; i < size; i++)
+	result.push_back(std::string(all.data() + displs[i], lens[i]));
+    return result;
+}
+
+client_aggregator_t::client_aggregator_t(const agg_function_t &f, const single_function_t &g, MPI_Comm cm, int t) :
+    timeout(t), agg_function(f), single_function(g) {
+    if (timeout > 0) {
+	// the rounds must not interleave with the collective calls of the modules on the same communicator
+	MPI_Comm_dup(cm, &comm);
+	agreement_thread = std::thread([this]() { agreement_loop(); });
+    }
+}
+
+client_aggregator_t::~client_aggregator_t() {
+    std::unique_lock<std::mutex> lock(batches_mutex);
+    stopping = true;
+    timer_cond.notify_one();
+    result_cond.notify_all();
+    lock.unlock();
+    // the other backends stop once the first one does
+    if (agreement_thread.joinable())
+	agreement_thread.join();
+    if (comm != MPI_COMM_NULL)
+	MPI_Comm_free(&comm);
+}
+
+std::vector<std::vector<command_t> > client_aggregator_t::extract_ready() {
+    // a batch is ready when all clients arrived. Older versions of the same checkpoint are processed first, so
+    // that all backends issue the collective calls in the same order.
+    std::vector<std::vector<command_t> > ready;
+    auto it = batches.begin();
+    while (it != batches.end()) {
+	auto group_end = it, last_due = batches.end();
+	for (; group_end != batches.end() && std::get<0>(group_end->first) == std::get<0>(it->first) &&
+		 std::get<1>(group_end->first) == std::get<1>(it->first); group_end++)
+	    if (group_end->second.cmds.size() >= no_clients)
+		last_due = group_end;
+	if (last_due == batches.end()) {
+	    it = group_end;
+	    continue;
+	}
+	auto &version = processed[std::make_pair(std::get<0>(it->first), std::get<1>(it->first))];
+	version = std::max(version, std::get<2>(last_due->first));
+	for (auto end = std::next(last_due); it != end; it = batches.erase(it))
+	    ready.push_back(std::move(it->second.cmds));
+	it = group_end;
+    }
+    return ready;
+}
+
+int client_aggregator_t::flush() {
+    // hold the lock during the collective calls to keep them in the same order as the extraction
+    std::unique_lock<std::mutex> agg_lock(agg_mutex);
+    std::unique_lock<std::mutex> lock(batches_mutex);
+    auto ready = extract_ready();
+    lock.unlock();
+    int ret = VELOC_SUCCESS;
+    for (auto &cmds : ready)
+	ret = std::min(ret, agg_function(cmds));
+    return ret;
+}
+
+bool client_aggregator_t::wait_round() {
+    // the first backend starts a round as soon as one of its batches is ready, and again after ROUND_RETRY while
+    // some of them are still waiting for the other backends; false means that the aggregators are stopping
+    std::unique_lock<std::mutex> lock(batches_mutex);
+    while (!stopping) {
+	auto now = clock_t::now(), next = clock_t::time_point::max();
+	bool ready = false;
+	for (auto &b : batches)
+	    if (b.second.cmds.size() >= no_clients || now >= b.second.deadline)
+		ready = true;
+	    else
+		next = std::min(next, b.second.deadline);
+	if (ready && now >= retry_at)
+	    return true;
+	if (ready)
+	    next = std::min(next, retry_at);
+	if (next == clock_t::time_point::max())
+	    timer_cond.wait(lock);
+	else
+	    timer_cond.wait_until(lock, next);
+    }
+    return false;
+}
+
+size_t client_aggregator_t::agree() {
+    // every backend proposes its ready batches, those proposed by all of them are processed in key order
+    std::map<std::string, key_t> proposed;
+    std::string local;
+    std::unique_lock<std::mutex> lock(batches_mutex);
+    auto now = clock_t::now();
+    for (auto &b : batches)
+	if (b.second.cmds.size() >= no_clients || now >= b.second.deadline) {
+	    std::string k = std::to_string(std::get<0>(b.first)) + " " + std::to_string(std::get<2>(b.first)) + " " +
+		std::get<1>(b.first);
+	    proposed.emplace(k, b.first);
+	    local += k + "\n";
+	}
+    lock.unlock();
+
+    std::vector<std::string> all = allgather_strings(local, comm);
+    std::map<std::string, size_t> votes;
+    for (auto &s : all) {
+	std::istringstream in(s);
+	std::string k;
+	while (std::getline(in, k))
+	    votes[k]++;
+    }
+    std::set<key_t> agreed;
+    for (auto &p : proposed)
+	if (votes[p.first] == all.size())
+	    agreed.insert(p.second);
+
+    std::vector<std::pair<key_t, batch_t> > ready;
+    std::vector<key_t> dropped;
+    lock.lock();
+    for (auto &k : agreed) {
+	auto &version = processed[std::make_pair(std::get<0>(k), std::get<1>(k))];
+	version = std::max(version, std::get<2>(k));
+    }
+    for (auto it = batches.begin(); it != batches.end(); ) {
+	auto done = processed.find(std::make_pair(std::get<0>(it->first), std::get<1>(it->first)));
+	if (agreed.count(it->first) == 0 && (done == processed.end() || std::get<2>(it->first) > done->second)) {
+	    it++;
+	    continue;
+	}
+	// an older version not ready on all backends is left behind, like a late request
+	if (agreed.count(it->first) == 0) {
+	    INFO("requests for " << std::get<1>(it->first) << ", version " << std::get<2>(it->first)
+		 << " were not included in the collective processing of a newer version");
+	    if (it->second.awaited)
+		results[it->first] = VELOC_SUCCESS;
+	} else {
+	    if (it->second.cmds.size() < no_clients)
+		INFO("proceeding with " << it->second.cmds.size() << " out of " << no_clients << " clients for "
+		     << std::get<1>(it->first) << ", version " << std::get<2>(it->first));
+	    ready.push_back(std::make_pair(it->first, std::move(it->second)));
+	}
+	it = batches.erase(it);
+    }
+    result_cond.notify_all();
+    lock.unlock();
+
+    std::unique_lock<std::mutex> agg_lock(agg_mutex);
+    for (auto &b : ready) {
+	int ret = agg_function(b.second.cmds);
+	if (ret != VELOC_SUCCESS)
+	    ERROR("collective processing of " << std::get<1>(b.first) << ", version " << std::get<2>(b.first) << " failed");
+	if (b.second.awaited) {
+	    lock.lock();
+	    results[b.first] = ret;
+	    result_cond.notify_all();
+	    lock.unlock();
+	}
+    }
+    return ready.size();
+}
+
+void client_aggregator_t::agreement_loop() {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    while (true) {
+	int round = 1;
+	if (rank == 0)
+	    round = wait_round() ? 1 : 0;
+	MPI_Request req;
+	MPI_Ibcast(&round, 1, MPI_INT, 0, comm, &req);
+	int done = 0;
+	while (MPI_Test(&req, &done, MPI_STATUS_IGNORE) == MPI_SUCCESS && !done)
+	    std::this_thread::sleep_for(ROUND_POLL);
+	if (!round)
+	    return;
+	size_t processed_batches = agree();
+	std::unique_lock<std::mutex> lock(batches_mutex);
+	retry_at = processed_batches > 0 ? clock_t::time_point::min() : clock_t::now() + ROUND_RETRY;
+    }
+}
 
 int client_aggregator_t::process_command(const command_t &c) {
-    int res = VELOC_SUCCESS;
-        switch (c.command) {
-    case command_t::INIT:
+    switch (c.command) {
+    case command_t::INIT: {
+	std::unique_lock<std::mutex> lock(batches_mutex);
 	no_clients++;
+	lock.unlock();
 	return single_function(c);
+    }
     case command_t::TEST:
 	return single_function(c);
     case command_t::CHECKPOINT:
-    case command_t::RESTART:
-	cmds[c.command].push_back(c);
-	if (cmds[c.command].size() == no_clients) {
-	    res = agg_function(cmds[c.command]);
-	    cmds[c.command].clear();
+    case command_t::RESTART: {
+	std::unique_lock<std::mutex> lock(batches_mutex);
+	auto done = processed.find(std::make_pair(c.command, c.name));
+	if (done != processed.end() && c.version <= done->second) {
+	    INFO("late request " << c << " was not included in the collective processing of its version");
+	    return VELOC_SUCCESS;
 	}
-	return res;
+	key_t k = std::make_tuple(c.command, c.name, c.version);
+	auto &b = batches[k];
+	if (b.cmds.empty())
+	    b.deadline = clock_t::now() + std::chrono::seconds(timeout);
+	b.cmds.push_back(c);
+	bool complete = b.cmds.size() >= no_clients;
+	if (timeout > 0) {
+	    // the batches are processed by the rounds of the agreement thread only
+	    timer_cond.notify_one();
+	    if (!complete || b.awaited)
+		return VELOC_SUCCESS;
+	    b.awaited = true;
+	    while (results.find(k) == results.end() && !stopping)
+		result_cond.wait(lock);
+	    auto r = results.find(k);
+	    if (r == results.end())
+		return VELOC_FAILURE;
+	    int ret = r->second;
+	    results.erase(r);
+	    return ret;
+	}
+	lock.unlock();
+	return complete ? flush() : VELOC_SUCCESS;
+    }
     default:
 	return VELOC_SUCCESS;
     }
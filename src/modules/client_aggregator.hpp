@@ -7,16 +7,58 @@
 #include <functional>
 #include <vector>
 #include <map>
+#include <tuple>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
+#include <mpi.h>
+
+// groups the CHECKPOINT/RESTART requests of all local clients for the same (name, version) into a single
+// collective call. If a timeout is set, a group that is still incomplete when it expires proceeds with the
+// clients that arrived; the requests of the stragglers are then handled as late arrivals. Since the groups
+// expire at different times on different backends, the backends then agree in rounds on the groups that are
+// ready on all of them, and process those in the same order.
 class client_aggregator_t {
-    unsigned int no_clients = 0;
     typedef std::function<int (const std::vector<command_t> &)> agg_function_t;
     typedef std::function<int (const command_t &)> single_function_t;
+    typedef std::chrono::steady_clock clock_t;
+    // (command, name, version), ordered so that the versions of the same checkpoint are consecutive
+    typedef std::tuple<int, std::string, int> key_t;
+    struct batch_t {
+	std::vector<command_t> cmds;
+	clock_t::time_point deadline;
+	// the request that completed the batch waits for the result of its processing
+	bool awaited = false;
+    };
+
+    unsigned int no_clients = 0;
+    int timeout;
+    MPI_Comm comm = MPI_COMM_NULL;
     agg_function_t agg_function;
     single_function_t single_function;
-    std::map<int, std::vector<command_t> > cmds;
+    std::map<key_t, batch_t> batches;
+    // latest version processed for each (command, name), to recognize late arrivals
+    std::map<std::pair<int, std::string>, int> processed;
+    // results of the awaited batches processed by the rounds
+    std::map<key_t, int> results;
+    std::mutex batches_mutex, agg_mutex;
+    std::condition_variable timer_cond, result_cond;
+    std::thread agreement_thread;
+    bool stopping = false;
+    // the first backend starts no new round before then, while its ready batches wait for the other backends
+    clock_t::time_point retry_at = clock_t::time_point::min();
+
+    std::vector<std::vector<command_t> > extract_ready();
+    int flush();
+    bool wait_round();
+    size_t agree();
+    void agreement_loop();
 public:
-    client_aggregator_t(const agg_function_t &f, const single_function_t &g);
+    // the agreement is collective over comm, which all backends pass with the same timeout
+    client_aggregator_t(const agg_function_t &f, const single_function_t &g, MPI_Comm comm, int timeout = 0);
+    ~client_aggregator_t();
     int process_command(const command_t &c);
 };
 
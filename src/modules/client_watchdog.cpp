@@ -5,46 +5,101 @@
 //#define __DEBUG
 #include "common/debug.hpp"
 
-client_watchdog_t::client_watchdog_t(const config_t &c) : cfg(c) {
-    if(cfg.get_optional("watchdog_interval", timeout)) {
-	watchdog_thread = std::thread([this]() { timeout_check(); });
-	watchdog_thread.detach();
-	INFO("watchdog enabled, checking liveness every " << timeout << " seconds");
-    } else
-	timeout = 0;
+static int read_timeout(const config_t &cfg) {
+    int timeout;
+    return cfg.get_optional("watchdog_interval", timeout) && timeout > 0 ? timeout : 0;
+}
+
+// a timeout is detected at most one tick late: 1/64 of the timeout, between 10 ms and 1 s
+static std::chrono::milliseconds tick_for(int timeout) {
+    return std::chrono::milliseconds(std::min(1000, std::max(10, timeout * 1000 / 64)));
+}
+
+client_watchdog_t::client_watchdog_t(const config_t &c) : cfg(c), timeout(read_timeout(c)), timers(tick_for(timeout)) {
+    if (timeout == 0)
+	return;
+    watchdog_thread = std::thread([this]() { timeout_check(); });
+    INFO("watchdog enabled, clients time out after " << timeout << " seconds without a sign of life");
+}
+
+client_watchdog_t::~client_watchdog_t() {
+    if (!watchdog_thread.joinable())
+	return;
+    std::unique_lock<std::mutex> lock(watchdog_mutex);
+    stopping = true;
+    stop_cond.notify_one();
+    lock.unlock();
+    watchdog_thread.join();
 }
 
 void client_watchdog_t::timeout_check() {
-    while (true) {
-	auto t = std::chrono::system_clock::now();
-	for (auto &e : client_map)
-	    if (t > e.second) {
-		ERROR("client " << e.first << " triggered a watchdog timeout");
-		// TODO: kill client and initiate restart
-	    }
-	std::this_thread::sleep_for(std::chrono::seconds(timeout));
+    std::unique_lock<std::mutex> lock(watchdog_mutex);
+    while (!stopping) {
+	auto timed_out = timers.advance(timer_wheel_t::clock::now());
+	for (auto id : timed_out) {
+	    expired.insert(id);
+	    ERROR("client " << id << " triggered a watchdog timeout");
+	    // TODO: kill client and initiate restart
+	}
+	if (expiry_hook && !timed_out.empty()) {
+	    auto f = expiry_hook;
+	    lock.unlock();
+	    for (auto id : timed_out)
+		f(id);
+	    lock.lock();
+	}
+	stop_cond.wait_for(lock, tick_for(timeout));
     }
 }
 
+bool client_watchdog_t::refresh(int id, bool registering) {
+    std::unique_lock<std::mutex> lock(watchdog_mutex);
+    if (registering) {
+	if (clients.insert(id).second)
+	    INFO("new client " << id << " registered");
+    } else if (clients.find(id) == clients.end())
+	return false;
+    if (expired.erase(id) > 0)
+	INFO("client " << id << " is alive again after a watchdog timeout");
+    timers.schedule(id, timer_wheel_t::clock::now() + std::chrono::seconds(timeout));
+    return true;
+}
+
+void client_watchdog_t::set_expiry_hook(const std::function<void (int)> &f) {
+    std::unique_lock<std::mutex> lock(watchdog_mutex);
+    expiry_hook = f;
+}
+
+void client_watchdog_t::heartbeat(int id) {
+    if (timeout == 0)
+	return;
+    if (!refresh(id, false))
+	DBG("heartbeat of unknown client " << id << " ignored");
+}
+
+size_t client_watchdog_t::get_expired() {
+    std::unique_lock<std::mutex> lock(watchdog_mutex);
+    return expired.size();
+}
+
 int client_watchdog_t::process_command(const command_t &c) {
     if (timeout == 0)
 	return VELOC_SUCCESS;
     switch(c.command) {
     case command_t::INIT:
-	if (client_map.find(c.unique_id) == client_map.end())
-	    INFO("new client " << c.unique_id << " registered");
-	client_map[c.unique_id] = std::chrono::system_clock::now() + std::chrono::seconds(timeout);
-	DBG("watchdog init, next check in " << timeout << " seconds");
+	refresh(c.unique_id, true);
+	DBG("watchdog init, client " << c.unique_id << " times out in " << timeout << " seconds");
         return VELOC_SUCCESS;
     case command_t::CHECKPOINT:
-	if (client_map.find(c.unique_id) == client_map.end()) {
+	if (!refresh(c.unique_id, false)) {
 	    ERROR("unknown client " << c.unique_id << " issued checkpoint request");
 	    return VELOC_FAILURE;
 	}
-	client_map[c.unique_id] = std::chrono::system_clock::now() + std::chrono::seconds(timeout);
-	DBG("watchdog ping, next check in " << timeout << " seconds");
+	DBG("watchdog ping, client " << c.unique_id << " times out in " << timeout << " seconds");
 	return VELOC_SUCCESS;
     default:
+	// any other request is a sign of life as well
+	refresh(c.unique_id, false);
 	return VELOC_SUCCESS;
     }
 }
@@ -3,21 +3,40 @@
 
 #include "common/config.hpp"
 #include "common/command.hpp"
+#include "common/timer_wheel.hpp"
 
 #include <thread>
 #include <chrono>
-#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
+#include <functional>
 
+// Detects clients that stopped making progress: every command and every heartbeat of a client rearms its timer,
+// which expires when the client stays silent for watchdog_interval seconds. The timers live in a timer wheel, so
+// the cost of a heartbeat and of a check does not depend on the number of clients.
 class client_watchdog_t {
-    std::thread watchdog_thread;
     const config_t &cfg;
-    std::map<int, std::chrono::system_clock::time_point> client_map;
     int timeout;
+    std::mutex watchdog_mutex;
+    std::condition_variable stop_cond;
+    bool stopping = false;
+    timer_wheel_t timers;
+    std::unordered_set<int> clients, expired;
+    std::thread watchdog_thread;
+    std::function<void (int)> expiry_hook;
 
     void timeout_check();
+    bool refresh(int id, bool registering);
 public:
     client_watchdog_t(const config_t &c);
+    ~client_watchdog_t();
     int process_command(const command_t &cmd);
+    // sign of life of a client outside of its commands (e.g. sent by the client from a progress thread)
+    void heartbeat(int id);
+    // called with the id of every client that times out, outside of the watchdog lock
+    void set_expiry_hook(const std::function<void (int)> &f);
+    size_t get_expired();
 };
 
 #endif // __CLIENT_WATCHDOG_HPP
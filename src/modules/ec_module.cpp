@@ -1,5 +1,6 @@
 #include "ec_module.hpp"
 #include "common/status.hpp"
+#include "common/tiers.hpp"
 
 #include <stdexcept>
 
@@ -13,7 +14,7 @@
 //#define __DEBUG
 #include "common/debug.hpp"
 
-static int get_latest_version(const std::string &p, const std::string &cname, int needed_version) {
+int get_latest_ec_version(const std::string &p, const std::string &cname, int needed_version) {
     struct dirent *dentry;
     DIR *dir;
     int version, ret = -1;
@@ -52,18 +53,15 @@ ec_module_t::ec_module_t(const config_t &c, MPI_Comm cm) : cfg(c), comm(cm) {
 	throw std::runtime_error("Failed to create scheme using failure domain: " + fdomain);
     rankstr_mpi_comm_split(comm, host_name, 0, 0, 1, &comm_domain);
 
-    if (!cfg.get_optional("ec_interval", interval)) {
+    int interval;
+    if (!cfg.get_optional("ec_interval", interval))
 	INFO("EC interval not specified, every checkpoint will be protected using EC");
-	interval = 0;
-    }
     int domain_ranks;
     MPI_Comm_size(comm_domain, &domain_ranks);
     if (domain_ranks == ranks) {
 	INFO("Running on a single host, EC deactivated");
-	interval = -1;
+	active = false;
     }
-    if (!cfg.get_optional("max_versions", max_versions))
-	max_versions = 0;
 	
     DBG("EC scheme successfully initialized");
 }
@@ -75,6 +73,7 @@ ec_module_t::~ec_module_t() {
 }
 
 int ec_module_t::process_command(const command_t &c) {
+    int interval = active ? cfg.get_tuning().ec_interval : -1;
     switch (c.command) {
     case command_t::INIT:
 	last_timestamp = std::chrono::system_clock::now() + std::chrono::seconds(interval);
@@ -82,7 +81,7 @@ int ec_module_t::process_command(const command_t &c) {
 	
     case command_t::TEST:
 	DBG("get latest EC version for " << c.name);
-	return get_latest_version(cfg.get("scratch"), std::string(c.name) + "-ec", c.version);
+	return get_latest_ec_version(cfg.get_scratch(), std::string(c.name) + "-ec", c.version);
 
     default:
 	return VELOC_SUCCESS;
@@ -90,14 +89,21 @@ int ec_module_t::process_command(const command_t &c) {
 }
 
 int ec_module_t::process_commands(const std::vector<command_t> &cmds) {    
+    tuning_t tuning = cfg.get_tuning();
+    int interval = active ? tuning.ec_interval : -1, max_versions = tuning.max_versions;
+    // the backends may have reloaded the configuration at different times, but need to agree on EC
+    MPI_Allreduce(MPI_IN_PLACE, &interval, 1, MPI_INT, MPI_MIN, comm);
     if (cmds.size() == 0 || interval < 0)
 	return VELOC_SUCCESS;
     int command = cmds[0].command;
     ASSERT(command == command_t::CHECKPOINT || command == command_t::RESTART);
+    // streamed checkpoints without a copy in the scratch directory have nothing to encode
+    if (command == command_t::CHECKPOINT && !cfg.keeps_local(cmds[0].name))
+	return VELOC_SUCCESS;
 
     int version = cmds[0].version;
     int set_id;
-    std::string name = cfg.get("scratch") + "/" + cmds[0].name + "-ec-" + std::to_string(version);
+    std::string name = cfg.get_scratch() + "/" + cmds[0].name + "-ec-" + std::to_string(version);
     if (command == command_t::CHECKPOINT) {
 	if (interval > 0) {
 	    auto t = std::chrono::system_clock::now();
@@ -117,15 +123,15 @@ int ec_module_t::process_commands(const std::vector<command_t> &cmds) {
 	    return VELOC_FAILURE;
 	}
 	for (auto &c : cmds)
-	    ER_Add(set_id, c.filename(cfg.get("scratch")).c_str());
+	    ER_Add(set_id, c.filename(cfg.get_scratch()).c_str());
 	if (max_versions > 0) {
 	    auto &version_history = checkpoint_history[cmds[0].name];
 	    version_history.push_back(version);
 	    if ((int)version_history.size() > max_versions) {		
-		std::string old_name = cfg.get("scratch") + "/" + cmds[0].name +
+		std::string old_name = cfg.get_scratch() + "/" + cmds[0].name +
 		    "-ec-" + std::to_string(version_history.front());
 		for (auto &c : cmds)
-		    unlink(c.filename(cfg.get("scratch"), version_history.front()).c_str());
+		    tier_set_t::remove_local(c.filename(cfg.get_scratch(), version_history.front()));
 		version_history.pop_front();
 		int old_id = ER_Create(comm, comm_domain, old_name.c_str(), ER_DIRECTION_REMOVE, 0);
 		if (old_id != -1) {
@@ -10,11 +10,15 @@
 
 #include <mpi.h>
 
+// latest version <= needed_version (any if 0) of the EC files named <cname>-<version>* in directory p, -1 if none
+int get_latest_ec_version(const std::string &p, const std::string &cname, int needed_version);
+
 class ec_module_t {
     config_t cfg;
     MPI_Comm comm, comm_domain;
     std::string fdomain;
-    int scheme_id, interval, max_versions;
+    int scheme_id;
+    bool active = true;
     std::chrono::system_clock::time_point last_timestamp;
     typedef std::map<std::string, std::deque<int> > checkpoint_history_t;
     checkpoint_history_t checkpoint_history;
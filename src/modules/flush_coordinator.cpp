@@ -0,0 +1,122 @@
+#include "flush_coordinator.hpp"
+
+#include <vector>
+#include <cstring>
+
+//#define __DEBUG
+#include "common/debug.hpp"
+
+static std::string engine_address(const config_t &cfg) {
+    std::string address;
+    if (!cfg.get_optional("coordinator_address", address))
+	address = "tcp";
+    return address;
+}
+
+static std::chrono::milliseconds flush_quantum(const config_t &cfg) {
+    int quantum;
+    if (!cfg.get_optional("flush_quantum", quantum) || quantum < 0)
+	quantum = 1000;
+    return std::chrono::milliseconds(quantum);
+}
+
+flush_coordinator_t::flush_coordinator_t(const config_t &cfg, MPI_Comm cm, int max_writers) :
+    comm(cm), writers(max_writers), quantum(flush_quantum(cfg)),
+    engine(engine_address(cfg), THALLIUM_SERVER_MODE, true, 1), available(max_writers) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    acquire_rpc = engine.define("flush_acquire", [this](const tl::request &req) { on_acquire(req); });
+    release_rpc = engine.define("flush_release", [this](const tl::request &req) { on_release(req); });
+
+    // the first backend serves the tokens
+    const size_t len = 256;
+    std::vector<char> address(len, 0);
+    if (rank == 0)
+	strncpy(address.data(), std::string(engine.self()).c_str(), len - 1);
+    MPI_Bcast(address.data(), len, MPI_CHAR, 0, comm);
+    server = engine.lookup(std::string(address.data()));
+    if (rank == 0)
+	INFO("flush coordination enabled, at most " << writers << " backends flush at the same time");
+}
+
+flush_coordinator_t::~flush_coordinator_t() {
+    // the token server must outlive the flushes of the other backends
+    MPI_Barrier(comm);
+    engine.finalize();
+}
+
+void flush_coordinator_t::on_acquire(const tl::request &req) {
+    // the request is answered when a token is available, in the order the requests arrived
+    std::unique_lock<std::mutex> lock(server_mutex);
+    if (available > 0 && waiting.empty()) {
+	available--;
+	lock.unlock();
+	req.respond((int)VELOC_SUCCESS);
+    } else
+	waiting.push_back(req);
+}
+
+void flush_coordinator_t::on_release(const tl::request &req) {
+    std::unique_lock<std::mutex> lock(server_mutex);
+    if (waiting.empty()) {
+	available++;
+	lock.unlock();
+    } else {
+	// the token goes straight to the next backend in line
+	tl::request next = waiting.front();
+	waiting.pop_front();
+	lock.unlock();
+	next.respond((int)VELOC_SUCCESS);
+    }
+    req.respond((int)VELOC_SUCCESS);
+}
+
+void flush_coordinator_t::acquire() {
+    std::unique_lock<std::mutex> lock(token_mutex);
+    while (true) {
+	if (held && std::chrono::steady_clock::now() - granted_at < quantum) {
+	    users++;
+	    return;
+	}
+	if (!held && !acquiring)
+	    break;
+	// either the token is being requested, or it is past its quantum and will be returned by the last user
+	token_cond.wait(lock);
+    }
+    acquiring = true;
+    lock.unlock();
+    bool success = true;
+    try {
+	acquire_rpc.on(server)();
+    } catch (std::exception &e) {
+	// without the coordinator, flushing uncoordinated is better than not flushing at all
+	ERROR("cannot obtain a flush token: " << e.what());
+	success = false;
+    }
+    lock.lock();
+    acquiring = false;
+    held = true;
+    granted = success;
+    granted_at = std::chrono::steady_clock::now();
+    users++;
+    token_cond.notify_all();
+}
+
+void flush_coordinator_t::release() {
+    std::unique_lock<std::mutex> lock(token_mutex);
+    if (--users > 0)
+	return;
+    // a flush starting now asks for a new token, which the server grants after this one comes back
+    held = false;
+    token_cond.notify_all();
+    // a token that was never granted is not returned, or the server would hand out more than it has
+    if (!granted)
+	return;
+    granted = false;
+    lock.unlock();
+    try {
+	release_rpc.on(server)();
+    } catch (std::exception &e) {
+	ERROR("cannot return the flush token: " << e.what());
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef __FLUSH_COORDINATOR_HPP
+#define __FLUSH_COORDINATOR_HPP
+
+#include "common/config.hpp"
+#include "common/status.hpp"
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#include <mpi.h>
+#include <thallium.hpp>
+
+namespace tl = thallium;
+
+// global I/O coordination: at most flush_writers backends flush to the persistent storage at the same time. The
+// first backend hands out the tokens in the order they were requested, so that after a synchronized checkpoint
+// the backends take turns instead of all hitting the parallel file system together. The flushes of a backend
+// share its token; a token held longer than flush_quantum is returned before the next flush, so that a backend
+// with a steady stream of flushes does not keep it.
+class flush_coordinator_t {
+    MPI_Comm comm;
+    int writers;
+    std::chrono::milliseconds quantum;
+    tl::engine engine;
+    tl::remote_procedure acquire_rpc, release_rpc;
+    tl::endpoint server;
+
+    // token server state, on the first backend only
+    std::mutex server_mutex;
+    int available;
+    std::deque<tl::request> waiting;
+
+    // local token state, shared by the flushes of this backend
+    std::mutex token_mutex;
+    std::condition_variable token_cond;
+    // granted: the token server answered, so the token must be returned (false when flushing uncoordinated)
+    bool held = false, acquiring = false, granted = false;
+    int users = 0;
+    std::chrono::steady_clock::time_point granted_at;
+
+    void on_acquire(const tl::request &req);
+    void on_release(const tl::request &req);
+public:
+    flush_coordinator_t(const config_t &cfg, MPI_Comm cm, int max_writers);
+    ~flush_coordinator_t();
+    // blocks until this backend may flush
+    void acquire();
+    void release();
+};
+
+#endif //__FLUSH_COORDINATOR_HPP
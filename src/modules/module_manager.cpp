@@ -1,14 +1,84 @@
 #include "module_manager.hpp"
+#include "include/veloc.h"
+
+#include <future>
+#include <stdexcept>
 
 #define __DEBUG
 #include "common/debug.hpp"
 
 module_manager_t::module_manager_t() { }
 
+void module_manager_t::add_module(const std::string &name, const method_t &m, const deps_t &deps, bool collective) {
+    // dependencies refer to modules added earlier, which rules out cycles
+    std::map<int, std::vector<size_t> > after;
+    for (auto &d : deps)
+	for (auto &dep_name : d.second) {
+	    size_t i = 0;
+	    while (i < sig.size() && sig[i].name != dep_name)
+		i++;
+	    if (i == sig.size())
+		throw std::runtime_error("module " + name + " depends on unknown module " + dep_name);
+	    after[d.first].push_back(i);
+	}
+    sig.push_back(module_t{name, m, std::unique_ptr<latency_histogram_t>(new latency_histogram_t()), after, collective});
+}
+
+void module_manager_t::set_parallelism(unsigned int threads) {
+    std::unique_lock<std::mutex> lock(workers_mutex);
+    while (workers.size() < threads)
+	workers.emplace_back([this]() {
+	    while (true) {
+		std::unique_lock<std::mutex> lock(tasks_mutex);
+		while (tasks.empty() && !stopping)
+		    tasks_cond.wait(lock);
+		if (tasks.empty())
+		    return;
+		auto task = std::move(tasks.front());
+		tasks.pop_front();
+		lock.unlock();
+		task();
+	    }
+	});
+    worker_count = workers.size();
+}
+
 void module_manager_t::add_default_modules(const config_t &cfg, MPI_Comm comm, bool ec_active) {
+    int threads;
+    if (!cfg.get_optional("module_threads", threads) || threads < 0)
+	threads = 4;
+    set_parallelism(threads);
+    // the local write is complete by the time a checkpoint request arrives, so EC, partner replication and
+    // the flush to the persistent storage can overlap. On restart, the local copy is restored in order:
+    // EC rebuild first, then the partner, then the persistent storage.
+    deps_t restart_deps;
+    int agg_timeout;
+    if (!cfg.get_optional("aggregation_timeout", agg_timeout) || agg_timeout < 0)
+	agg_timeout = 0;
     watchdog = new client_watchdog_t(cfg);
-    add_module([this](const command_t &c) { return watchdog->process_command(c); });
-    if (ec_active) {
+    // a client that died in a communication phase would otherwise pause the flushes of all the others for good
+    watchdog->set_expiry_hook([this](int id) { phases.clear(id); });
+    add_module("watchdog", [this](const command_t &c) { return watchdog->process_command(c); });
+    // with local tiers, a restart first restores the link to the tier copy in the scratch directory
+    std::string tier_list;
+    if (cfg.get_optional("tiers", tier_list)) {
+	tiers = new tier_module_t(cfg);
+	add_module("tier", [this](const command_t &c) { return tiers->process_command(c); });
+	restart_deps[command_t::RESTART].push_back("tier");
+    }
+    std::string ec_engine;
+    if (ec_active && cfg.get_optional("ec_engine", ec_engine) && ec_engine == "native") {
+	native_ec = new rs_module_t(cfg, comm);
+	ec_agg = new client_aggregator_t(
+	    [this](const std::vector<command_t> &cmds) {
+		return native_ec->process_commands(cmds);
+	    },
+	    [this](const command_t &c) {
+		return native_ec->process_command(c);
+	    }, comm, agg_timeout);
+	add_module("ec", [this](const command_t &c) { return ec_agg->process_command(c); }, restart_deps, true);
+	restart_deps[command_t::RESTART].push_back("ec");
+    } else if (ec_active) {
 	redset = new ec_module_t(cfg, comm);
 	ec_agg = new client_aggregator_t(
 	    [this](const std::vector<command_t> &cmds) {
@@ -16,28 +86,180 @@ void module_manager_t::add_default_modules(const config_t &cfg, MPI_Comm comm, b
 	    },
 	    [this](const command_t &c) {
 		return redset->process_command(c);
-	    });
-	add_module([this](const command_t &c) { return ec_agg->process_command(c); });
+	    }, comm, agg_timeout);
+	add_module("ec", [this](const command_t &c) { return ec_agg->process_command(c); }, restart_deps, true);
+	restart_deps[command_t::RESTART].push_back("ec");
+    }
+    // partner replication is opt-in; it runs before the transfer module so that a restart prefers the partner copy
+    int partner_interval;
+    if (cfg.get_optional("partner_interval", partner_interval) && partner_interval >= 0) {
+	partner = new partner_module_t(cfg, comm);
+	add_module("partner", [this](const command_t &c) { return partner->process_command(c); }, restart_deps);
+	restart_deps[command_t::RESTART].push_back("partner");
+    }
+    int subfile_count;
+    if (cfg.get_optional("subfile_count", subfile_count) && subfile_count > 0) {
+	subfiles = new subfile_module_t(cfg, comm);
+	subfile_agg = new client_aggregator_t(
+	    [this](const std::vector<command_t> &cmds) {
+		return subfiles->process_commands(cmds);
+	    },
+	    [this](const command_t &c) {
+		return subfiles->process_command(c);
+	    }, comm, agg_timeout);
+	// both EC and subfiling issue collective MPI calls, which may only overlap if MPI is multi-threaded
+	deps_t subfile_deps = restart_deps;
+	int provided;
+	MPI_Query_thread(&provided);
+	if (ec_agg != NULL && provided != MPI_THREAD_MULTIPLE)
+	    subfile_deps[command_t::CHECKPOINT].push_back("ec");
+	add_module("subfile", [this](const command_t &c) { return subfile_agg->process_command(c); }, subfile_deps, true);
+	restart_deps[command_t::RESTART].push_back("subfile");
     }
     transfer = new transfer_module_t(cfg);
-    add_module([this](const command_t &c) { return transfer->process_command(c); });
+    int max_pause;
+    if (!cfg.get_optional("flush_max_pause", max_pause) || max_pause < 0)
+	max_pause = 1000;
+    gate.set_max_pause(std::chrono::milliseconds(max_pause));
+    transfer->set_gate(&gate);
+    // the backends take turns flushing to the persistent storage, at most flush_writers at a time
+    int flush_writers;
+    if (cfg.get_optional("flush_writers", flush_writers) && flush_writers > 0) {
+	coordinator = new flush_coordinator_t(cfg, comm, flush_writers);
+	transfer->set_coordinator(coordinator);
+    }
+    add_module("transfer", [this](const command_t &c) { return transfer->process_command(c); }, restart_deps);
 }
 
 module_manager_t::~module_manager_t() {
+    std::unique_lock<std::mutex> lock(tasks_mutex);
+    stopping = true;
+    tasks_cond.notify_all();
+    lock.unlock();
+    std::unique_lock<std::mutex> workers_lock(workers_mutex);
+    for (auto &t : workers)
+	t.join();
+    workers.clear();
+    worker_count = 0;
     delete watchdog;
     delete ec_agg;
     delete redset;
+    delete native_ec;
+    delete partner;
+    delete subfile_agg;
+    delete subfiles;
     delete transfer;
+    delete coordinator;
+    delete tiers;
+}
+
+int module_manager_t::run_module(module_t &m, const command_t &c) {
+    auto start = std::chrono::steady_clock::now();
+    TRACE_CMD(MODULE_BEGIN, c, m.name.c_str(), 0);
+    int ret = m.method(c);
+    TRACE_CMD(MODULE_END, c, m.name.c_str(), (int64_t)ret);
+    m.latency->record(std::chrono::duration_cast<std::chrono::microseconds>(
+			  std::chrono::steady_clock::now() - start).count());
+    return ret;
 }
 
 int module_manager_t::notify_command(const command_t &c) {
+    // the background flushes make way for the interactive commands while they are in progress
+    bool interactive = c.priority() == command_t::INTERACTIVE;
+    // a client starting over is no longer in the phase it hinted at before
+    if (c.command == command_t::INIT)
+	phases.clear(c.unique_id);
+    if (interactive)
+	gate.enter();
+    int ret = run_stages(c);
+    if (interactive)
+	gate.leave();
+    if (tiers != NULL)
+	tiers->unpin(c);
+    return ret;
+}
+
+int module_manager_t::run_stages(const command_t &c) {
+    // a module belongs to the stage after the last of its dependencies for this command
+    std::vector<unsigned int> stage(sig.size(), 0);
+    unsigned int stages = 0;
+    for (size_t i = 0; i < sig.size(); i++) {
+	auto it = sig[i].after.find(c.command);
+	if (it != sig[i].after.end())
+	    for (auto d : it->second)
+		stage[i] = std::max(stage[i], stage[d] + 1);
+	stages = std::max(stages, stage[i] + 1);
+    }
+    // modules of the same stage run concurrently: the collective ones (or the last one if there are none) on the
+    // thread of the command, the others on the worker pool. A collective module waiting in a queue of the bounded
+    // pool behind the collective modules of other commands could deadlock with another backend that queued them in
+    // a different order.
+    std::vector<int> status(sig.size(), VELOC_SUCCESS);
+    bool pool = worker_count > 0;
+    for (unsigned int s = 0; s < stages; s++) {
+	std::vector<size_t> pooled, local;
+	for (size_t i = 0; i < sig.size(); i++)
+	    if (stage[i] == s)
+		(sig[i].collective || !pool ? local : pooled).push_back(i);
+	if (local.empty() && !pooled.empty()) {
+	    local.push_back(pooled.back());
+	    pooled.pop_back();
+	}
+	std::vector<std::future<void> > pending;
+	for (auto i : pooled) {
+	    auto task = std::make_shared<std::packaged_task<void ()> >([this, i, &c, &status] {
+		status[i] = run_module(sig[i], c);
+	    });
+	    pending.push_back(task->get_future());
+	    std::unique_lock<std::mutex> lock(tasks_mutex);
+	    tasks.push_back([task] { (*task)(); });
+	    tasks_cond.notify_one();
+	}
+	for (auto i : local)
+	    status[i] = run_module(sig[i], c);
+	for (auto &f : pending)
+	    f.wait();
+    }
+
     int ret = VELOC_SUCCESS;
-    for (auto &f : sig) {
-	int mod_ret = f(c);
+    for (auto mod_ret : status)
 	if (c.command == command_t::TEST && mod_ret != VELOC_FAILURE)
 	    ret = std::max(ret, mod_ret);
 	else
 	    ret = std::min(ret, mod_ret);
-    }
     return ret;
 }
+
+void module_manager_t::set_journal(journal_t *journal) {
+    if (transfer != NULL)
+	transfer->resume(journal);
+}
+
+void module_manager_t::announce(const command_t &c) {
+    // the local copy must stay until the modules are done with it
+    if (tiers != NULL)
+	tiers->pin(c);
+    if (transfer != NULL)
+	transfer->announce(c);
+}
+
+void module_manager_t::hint_phase(int id, int phase, uint64_t seq) {
+    if (!phases.hint(id, phase, seq))
+	DBG("stale phase hint " << phase << " of client " << id << " dropped");
+}
+
+void module_manager_t::heartbeat(int id) {
+    if (watchdog != NULL)
+	watchdog->heartbeat(id);
+}
+
+void module_manager_t::get_stats(backend_stats_t &s) const {
+    for (auto &m : sig)
+	s.modules.push_back(m.latency->snapshot(m.name));
+    if (transfer != NULL) {
+	s.bytes_written = transfer->get_bytes_written();
+	s.bytes_flushed = transfer->get_bytes_flushed();
+	s.bytes_deduplicated = transfer->get_bytes_deduplicated();
+	s.bytes_superseded = transfer->get_bytes_superseded();
+    }
+}
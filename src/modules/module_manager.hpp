@@ -4,32 +4,89 @@
 #include "common/command.hpp"
 #include "common/status.hpp"
 #include "common/config.hpp"
+#include "common/stats.hpp"
+#include "common/priority_gate.hpp"
+#include "common/phase_tracker.hpp"
 #include "modules/client_watchdog.hpp"
 #include "modules/client_aggregator.hpp"
 #include "modules/ec_module.hpp"
+#include "modules/rs_module.hpp"
+#include "modules/partner_module.hpp"
+#include "modules/subfile_module.hpp"
 #include "modules/transfer_module.hpp"
+#include "modules/tier_module.hpp"
+#include "modules/flush_coordinator.hpp"
 
 #include <functional>
 #include <vector>
+#include <memory>
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 
 #include <mpi.h>
 
 class module_manager_t {
+public:
     typedef std::function<int (const command_t &)> method_t;
-    std::vector<method_t> sig;
+    // for each command type, the modules that need to complete before a module can process it
+    typedef std::map<int, std::vector<std::string> > deps_t;
+private:
+    struct module_t {
+	std::string name;
+	method_t method;
+	std::unique_ptr<latency_histogram_t> latency;
+	std::map<int, std::vector<size_t> > after;
+	// waits in collective calls for the matching module of the other backends
+	bool collective;
+    };
+    std::vector<module_t> sig;
+    // worker pool running the independent modules of the same stage concurrently, grown by reloads of the
+    // configuration from other threads
+    std::mutex workers_mutex;
+    std::vector<std::thread> workers;
+    // size of workers, read without workers_mutex by the commands
+    std::atomic<size_t> worker_count{0};
+    std::deque<std::function<void ()> > tasks;
+    std::mutex tasks_mutex;
+    std::condition_variable tasks_cond;
+    bool stopping = false;
     client_watchdog_t *watchdog = NULL;
     transfer_module_t *transfer = NULL;
     client_aggregator_t *ec_agg = NULL;
     ec_module_t *redset = NULL;
+    rs_module_t *native_ec = NULL;
+    partner_module_t *partner = NULL;
+    client_aggregator_t *subfile_agg = NULL;
+    subfile_module_t *subfiles = NULL;
+    tier_module_t *tiers = NULL;
+    flush_coordinator_t *coordinator = NULL;
+    priority_gate_t gate;
+    // clients in a communication or I/O phase, which hold the gate for all of them
+    phase_tracker_t phases{gate};
+
+    int run_module(module_t &m, const command_t &c);
+    int run_stages(const command_t &c);
     
 public:
     module_manager_t();
     ~module_manager_t();
     void add_default_modules(const config_t &cfg, MPI_Comm comm, bool ec_active);
-    void add_module(const method_t &m) {
-	sig.push_back(m);
-    }
+    // collective modules always run on the thread of the command, never on the worker pool
+    void add_module(const std::string &name, const method_t &m, const deps_t &deps = deps_t(), bool collective = false);
+    void set_parallelism(unsigned int threads);
     int notify_command(const command_t &c);
+    void set_journal(journal_t *journal);
+    // called when a command is accepted, long before it is processed; every command passed to notify_command
+    // is announced first
+    void announce(const command_t &c);
+    void heartbeat(int id);
+    // the flushes pause while any client is in a communication or I/O phase (VELOC_PHASE_*)
+    void hint_phase(int id, int phase, uint64_t seq);
+    void get_stats(backend_stats_t &s) const;
 };
 
 #endif // __MODULE_MANAGER_HPP
@@ -0,0 +1,319 @@
+#include "partner_module.hpp"
+#include "transfer_module.hpp"
+
+#include <vector>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+//#define __DEBUG
+#include "common/debug.hpp"
+
+static std::string engine_address(const config_t &cfg) {
+    std::string address;
+    if (!cfg.get_optional("partner_address", address))
+	address = "tcp";
+    return address;
+}
+
+static int engine_threads(const config_t &cfg) {
+    int threads;
+    if (!cfg.get_optional("partner_threads", threads) || threads < 1)
+	threads = 2;
+    return threads;
+}
+
+static std::vector<std::string> allgather_fixed(const std::string &local, size_t len, MPI_Comm comm) {
+    int size;
+    MPI_Comm_size(comm, &size);
+    std::vector<char> mine(len, 0), all(len * size);
+    strncpy(mine.data(), local.c_str(), len - 1);
+    MPI_Allgather(mine.data(), len, MPI_CHAR, all.data(), len, MPI_CHAR, comm);
+    std::vector<std::string> result;
+    for (int i = 0; i < size; i++)
+	result.push_back(std::string(all.data() + i * len));
+    return result;
+}
+
+partner_module_t::partner_module_t(const config_t &c, MPI_Comm cm) :
+    cfg(c), comm(cm), engine(engine_address(c), THALLIUM_SERVER_MODE, true, engine_threads(c)) {
+    int rank, ranks;
+    MPI_Comm_size(comm, &ranks);
+    MPI_Comm_rank(comm, &rank);
+
+    int chunk;
+    if (!cfg.get_optional("partner_chunk_size", chunk) || chunk < 4096)
+	chunk = 16 << 20;
+    chunk_size = chunk;
+    int seconds;
+    if (!cfg.get_optional("partner_timeout", seconds) || seconds < 1)
+	seconds = 60;
+    timeout = std::chrono::seconds(seconds);
+    store = cfg.get_scratch() + "/partner";
+    mkdir(store.c_str(), 0755);
+
+    store_rpc = engine.define("partner_store", [this](const tl::request &req, const command_t &c, size_t offset,
+						       size_t len, size_t total, tl::bulk &b) {
+	on_store(req, c, offset, len, total, b);
+    });
+    query_rpc = engine.define("partner_query", [this](const tl::request &req, const command_t &c) {
+	on_query(req, c);
+    });
+    latest_rpc = engine.define("partner_latest", [this](const tl::request &req, const command_t &c) {
+	on_latest(req, c);
+    });
+    fetch_rpc = engine.define("partner_fetch", [this](const tl::request &req, const command_t &c, size_t offset,
+						       size_t len, tl::bulk &b) {
+	on_fetch(req, c, offset, len, b);
+    });
+
+    // the partner is the next backend in rank order that lives in a different failure domain
+    char host_name[HOST_NAME_MAX] = "";
+    gethostname(host_name, HOST_NAME_MAX);
+    std::string fdomain;
+    if (!cfg.get_optional("failure_domain", fdomain))
+	fdomain.assign(host_name);
+    std::vector<std::string> domains = allgather_fixed(fdomain, HOST_NAME_MAX, comm);
+    std::vector<std::string> addresses = allgather_fixed(std::string(engine.self()), 256, comm);
+    if (ranks < 2) {
+	INFO("single backend, partner replication deactivated");
+	active = false;
+	return;
+    }
+    int partner_rank = (rank + 1) % ranks;
+    for (int d = 1; d < ranks; d++)
+	if (domains[(rank + d) % ranks] != fdomain) {
+	    partner_rank = (rank + d) % ranks;
+	    break;
+	}
+    if (domains[partner_rank] == fdomain)
+	INFO("all backends share failure domain " << fdomain << ", partner replicas will not survive its loss");
+    partner = engine.lookup(addresses[partner_rank]);
+    DBG("partner replication initialized: " << rank << " -> " << partner_rank << " at " << addresses[partner_rank]);
+}
+
+partner_module_t::~partner_module_t() {
+    // make sure nobody is still pulling from or pushing to us before shutting down the engine
+    MPI_Barrier(comm);
+    engine.finalize();
+}
+
+void partner_module_t::on_store(const tl::request &req, const command_t &c, size_t offset, size_t len,
+				 size_t total, tl::bulk &b) {
+    std::string tmp = store + "/" + c.stem() + ".tmp";
+    int fd = open(tmp.c_str(), O_CREAT | O_WRONLY | (offset == 0 ? O_TRUNC : 0), 0644);
+    if (fd == -1) {
+	ERROR("cannot open partner replica " << tmp << ", error = " << std::strerror(errno));
+	req.respond((int)VELOC_FAILURE);
+	return;
+    }
+    int ret = VELOC_SUCCESS;
+    if (len > 0) {
+	std::vector<char> buf(len);
+	std::vector<std::pair<void *, size_t> > segments{{buf.data(), len}};
+	try {
+	    tl::bulk local = engine.expose(segments, tl::bulk_mode::write_only);
+	    b.select(0, len).on(req.get_endpoint()) >> local;
+	    if (pwrite(fd, buf.data(), len, offset) != (ssize_t)len) {
+		ERROR("cannot write partner replica " << tmp << ", error = " << std::strerror(errno));
+		ret = VELOC_FAILURE;
+	    }
+	} catch (std::exception &e) {
+	    ERROR("cannot pull partner replica " << tmp << ": " << e.what());
+	    ret = VELOC_FAILURE;
+	}
+    }
+    close(fd);
+    if (ret == VELOC_SUCCESS && offset + len == total) {
+	if (rename(tmp.c_str(), c.filename(store).c_str()) != 0) {
+	    ERROR("cannot rename partner replica " << tmp << ", error = " << std::strerror(errno));
+	    ret = VELOC_FAILURE;
+	} else if (cfg.get_tuning().max_versions > 0) {
+	    std::unique_lock<std::mutex> lock(history_mutex);
+	    auto &version_history = replica_history[c.name + "-" + std::to_string(c.unique_id)];
+	    version_history.push_back(c.version);
+	    if ((int)version_history.size() > cfg.get_tuning().max_versions) {
+		unlink(c.filename(store, version_history.front()).c_str());
+		version_history.pop_front();
+	    }
+	}
+    }
+    req.respond(ret);
+}
+
+void partner_module_t::on_query(const tl::request &req, const command_t &c) {
+    struct stat st;
+    int64_t size = stat(c.filename(store).c_str(), &st) == 0 ? st.st_size : -1;
+    req.respond(size);
+}
+
+void partner_module_t::on_latest(const tl::request &req, const command_t &c) {
+    req.respond(get_latest_version(store, c));
+}
+
+void partner_module_t::on_fetch(const tl::request &req, const command_t &c, size_t offset, size_t len, tl::bulk &b) {
+    std::string fname = c.filename(store);
+    int fd = open(fname.c_str(), O_RDONLY), ret = VELOC_SUCCESS;
+    std::vector<char> buf(len);
+    if (fd == -1 || pread(fd, buf.data(), len, offset) != (ssize_t)len) {
+	ERROR("cannot read partner replica " << fname << ", error = " << std::strerror(errno));
+	ret = VELOC_FAILURE;
+    } else {
+	std::vector<std::pair<void *, size_t> > segments{{buf.data(), len}};
+	try {
+	    tl::bulk local = engine.expose(segments, tl::bulk_mode::read_only);
+	    b.select(0, len).on(req.get_endpoint()) << local;
+	} catch (std::exception &e) {
+	    ERROR("cannot push partner replica " << fname << ": " << e.what());
+	    ret = VELOC_FAILURE;
+	}
+    }
+    if (fd != -1)
+	close(fd);
+    req.respond(ret);
+}
+
+int partner_module_t::replicate(const command_t &c) {
+    std::string local = c.filename(cfg.get_scratch());
+    int fd = open(local.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+	ERROR("cannot open " << local << " for partner replication, error = " << std::strerror(errno));
+	if (fd != -1)
+	    close(fd);
+	return VELOC_FAILURE;
+    }
+    size_t total = st.st_size;
+    // the buffer is exposed once and reused for every chunk, the partner pulls it after each read
+    std::vector<char> buf(std::max(std::min(chunk_size, total), (size_t)1));
+    std::vector<std::pair<void *, size_t> > segments{{buf.data(), buf.size()}};
+    int ret = VELOC_SUCCESS;
+    TRACE_IO(IO_BEGIN, "partner", total);
+    try {
+	tl::bulk b = engine.expose(segments, tl::bulk_mode::read_only);
+	size_t offset = 0;
+	do {
+	    size_t len = std::min(chunk_size, total - offset);
+	    if (pread(fd, buf.data(), len, offset) != (ssize_t)len) {
+		ERROR("cannot read " << local << " for partner replication, error = " << std::strerror(errno));
+		ret = VELOC_FAILURE;
+		break;
+	    }
+	    ret = store_rpc.on(partner).timed(timeout, c, offset, len, total, b);
+	    offset += len;
+	} while (ret == VELOC_SUCCESS && offset < total);
+    } catch (tl::timeout &e) {
+	ERROR("partner replication of " << local << " failed: partner did not answer within " << timeout.count() << " ms");
+	ret = VELOC_FAILURE;
+    } catch (std::exception &e) {
+	ERROR("partner replication of " << local << " failed: " << e.what());
+	ret = VELOC_FAILURE;
+    }
+    TRACE_IO(IO_END, "partner", ret == VELOC_SUCCESS ? total : 0);
+    close(fd);
+    return ret;
+}
+
+int partner_module_t::recover(const command_t &c) {
+    std::string local = c.filename(cfg.get_scratch()), tmp = local + ".partner";
+    int ret = VELOC_SUCCESS, fd = -1;
+    try {
+	int64_t total = query_rpc.on(partner).timed(timeout, c);
+	if (total < 0) {
+	    ERROR("partner holds no replica of " << c.stem());
+	    return VELOC_FAILURE;
+	}
+	fd = open(tmp.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	if (fd == -1) {
+	    ERROR("cannot open " << tmp << " for partner recovery, error = " << std::strerror(errno));
+	    return VELOC_FAILURE;
+	}
+	std::vector<char> buf(std::max(std::min(chunk_size, (size_t)total), (size_t)1));
+	std::vector<std::pair<void *, size_t> > segments{{buf.data(), buf.size()}};
+	tl::bulk b = engine.expose(segments, tl::bulk_mode::write_only);
+	TRACE_IO(IO_BEGIN, "partner", total);
+	for (size_t offset = 0; ret == VELOC_SUCCESS && offset < (size_t)total; ) {
+	    size_t len = std::min(chunk_size, (size_t)total - offset);
+	    ret = fetch_rpc.on(partner).timed(timeout, c, offset, len, b);
+	    if (ret == VELOC_SUCCESS && pwrite(fd, buf.data(), len, offset) != (ssize_t)len) {
+		ERROR("cannot write " << tmp << " during partner recovery, error = " << std::strerror(errno));
+		ret = VELOC_FAILURE;
+	    }
+	    offset += len;
+	}
+	TRACE_IO(IO_END, "partner", ret == VELOC_SUCCESS ? total : 0);
+    } catch (tl::timeout &e) {
+	ERROR("partner recovery of " << local << " failed: partner did not answer within " << timeout.count() << " ms");
+	ret = VELOC_FAILURE;
+    } catch (std::exception &e) {
+	ERROR("partner recovery of " << local << " failed: " << e.what());
+	ret = VELOC_FAILURE;
+    }
+    // an RPC that timed out or failed leaves the file open
+    if (fd != -1)
+	close(fd);
+    if (ret == VELOC_SUCCESS && rename(tmp.c_str(), local.c_str()) != 0) {
+	ERROR("cannot rename " << tmp << " to " << local << ", error = " << std::strerror(errno));
+	ret = VELOC_FAILURE;
+    }
+    if (ret != VELOC_SUCCESS)
+	unlink(tmp.c_str());
+    return ret;
+}
+
+int partner_module_t::process_command(const command_t &c) {
+    // TEST results are combined using max across modules, so "no replica" is reported as VELOC_SUCCESS
+    int interval = active ? cfg.get_tuning().partner_interval : -1;
+    if (interval < 0)
+	return VELOC_SUCCESS;
+
+    switch (c.command) {
+    case command_t::INIT: {
+	std::unique_lock<std::mutex> lock(history_mutex);
+	last_timestamp[c.unique_id] = std::chrono::system_clock::now() + std::chrono::seconds(interval);
+	return VELOC_SUCCESS;
+    }
+
+    case command_t::TEST:
+	DBG("obtain latest partner version for " << c.name);
+	try {
+	    int version = latest_rpc.on(partner).timed(timeout, c);
+	    return std::max(version, (int)VELOC_SUCCESS);
+	} catch (tl::timeout &e) {
+	    ERROR("partner did not answer the query for " << c.name << " within " << timeout.count() << " ms");
+	    return VELOC_SUCCESS;
+	} catch (std::exception &e) {
+	    ERROR("cannot query partner for " << c.name << ": " << e.what());
+	    return VELOC_SUCCESS;
+	}
+
+    case command_t::CHECKPOINT:
+	if (!cfg.keeps_local(c.name))
+	    return VELOC_SUCCESS;
+	if (interval > 0) {
+	    std::unique_lock<std::mutex> lock(history_mutex);
+	    auto t = std::chrono::system_clock::now();
+	    if (t < last_timestamp[c.unique_id])
+		return VELOC_SUCCESS;
+	    last_timestamp[c.unique_id] = t + std::chrono::seconds(interval);
+	}
+	DBG("replicate " << c.stem() << " to partner");
+	return replicate(c);
+
+    case command_t::RESTART:
+	if (access(c.filename(cfg.get_scratch()).c_str(), R_OK) == 0)
+	    return VELOC_SUCCESS;
+	DBG("recover " << c.stem() << " from partner");
+	// not fatal: the transfer module can still fall back to the persistent storage
+	if (recover(c) != VELOC_SUCCESS)
+	    INFO("cannot recover " << c.stem() << " from partner, falling back to persistent storage");
+	return VELOC_SUCCESS;
+
+    default:
+	return VELOC_SUCCESS;
+    }
+}
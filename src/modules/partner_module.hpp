@@ -0,0 +1,51 @@
+#ifndef __PARTNER_MODULE_HPP
+#define __PARTNER_MODULE_HPP
+
+#include "common/config.hpp"
+#include "common/command.hpp"
+#include "common/status.hpp"
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+
+#include <mpi.h>
+#include <thallium.hpp>
+
+namespace tl = thallium;
+
+// partner replication: every backend keeps a copy of the local checkpoints of another backend that lives in
+// a different failure domain. The partner pulls the files using RDMA (thallium bulk), so that a single node
+// loss can be recovered without going to the persistent storage and without the cost of erasure coding.
+class partner_module_t {
+    config_t cfg;
+    MPI_Comm comm;
+    bool active = true;
+    size_t chunk_size;
+    // a partner that does not answer an RPC within this delay is considered lost
+    std::chrono::milliseconds timeout;
+    std::string store;
+    tl::engine engine;
+    tl::remote_procedure store_rpc, query_rpc, latest_rpc, fetch_rpc;
+    tl::endpoint partner;
+    std::mutex history_mutex;
+    std::map<int, std::chrono::system_clock::time_point> last_timestamp;
+    typedef std::map<std::string, std::deque<int> > replica_history_t;
+    replica_history_t replica_history;
+
+    int replicate(const command_t &c);
+    int recover(const command_t &c);
+
+    // RPC handlers, invoked by the backend for which we hold the replicas
+    void on_store(const tl::request &req, const command_t &c, size_t offset, size_t len, size_t total, tl::bulk &b);
+    void on_query(const tl::request &req, const command_t &c);
+    void on_latest(const tl::request &req, const command_t &c);
+    void on_fetch(const tl::request &req, const command_t &c, size_t offset, size_t len, tl::bulk &b);
+public:
+    partner_module_t(const config_t &c, MPI_Comm cm);
+    ~partner_module_t();
+    int process_command(const command_t &c);
+};
+
+#endif //__PARTNER_MODULE_HPP
@@ -0,0 +1,238 @@
+#include "rs_codec.hpp"
+
+#include <stdexcept>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define __RS_X86
+#endif
+
+// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d) and generator 2
+struct gf_tables_t {
+    uint8_t exp[512], log[256];
+    uint8_t mul[256][256];
+
+    gf_tables_t() {
+	unsigned int x = 1;
+	for (int i = 0; i < 255; i++) {
+	    exp[i] = x;
+	    log[x] = i;
+	    x <<= 1;
+	    if (x & 0x100)
+		x ^= 0x11d;
+	}
+	for (int i = 255; i < 512; i++)
+	    exp[i] = exp[i - 255];
+	log[0] = 0;
+	for (int a = 0; a < 256; a++)
+	    for (int b = 0; b < 256; b++)
+		mul[a][b] = (a == 0 || b == 0) ? 0 : exp[log[a] + log[b]];
+    }
+};
+
+static const gf_tables_t gf;
+
+uint8_t rs_codec_t::mul(uint8_t a, uint8_t b) {
+    return gf.mul[a][b];
+}
+
+uint8_t rs_codec_t::inv(uint8_t a) {
+    if (a == 0)
+	throw std::domain_error("GF(2^8): zero has no inverse");
+    return gf.exp[255 - gf.log[a]];
+}
+
+static void mul_add_scalar(uint8_t coef, const uint8_t *src, uint8_t *dst, size_t len) {
+    const uint8_t *t = gf.mul[coef];
+    for (size_t i = 0; i < len; i++)
+	dst[i] ^= t[src[i]];
+}
+
+#ifdef __RS_X86
+// split the multiplication table by nibbles, so that 16/32/64 products are looked up with a single shuffle
+static void nibble_tables(uint8_t coef, uint8_t lo[16], uint8_t hi[16]) {
+    for (int x = 0; x < 16; x++) {
+	lo[x] = gf.mul[coef][x];
+	hi[x] = gf.mul[coef][x << 4];
+    }
+}
+
+__attribute__((target("avx2")))
+static void mul_add_avx2(uint8_t coef, const uint8_t *src, uint8_t *dst, size_t len) {
+    uint8_t lo[16], hi[16];
+    nibble_tables(coef, lo, hi);
+    __m256i tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lo));
+    __m256i thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hi));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+	__m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(v, mask)),
+				     _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(v, 4), mask)));
+	__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+	_mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, p));
+    }
+    mul_add_scalar(coef, src + i, dst + i, len - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void mul_add_avx512(uint8_t coef, const uint8_t *src, uint8_t *dst, size_t len) {
+    uint8_t lo[16], hi[16];
+    nibble_tables(coef, lo, hi);
+    __m512i tlo = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)lo));
+    __m512i thi = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *)hi));
+    __m512i mask = _mm512_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+	__m512i v = _mm512_loadu_si512((const void *)(src + i));
+	__m512i p = _mm512_xor_si512(_mm512_shuffle_epi8(tlo, _mm512_and_si512(v, mask)),
+				     _mm512_shuffle_epi8(thi, _mm512_and_si512(_mm512_srli_epi64(v, 4), mask)));
+	__m512i d = _mm512_loadu_si512((const void *)(dst + i));
+	_mm512_storeu_si512((void *)(dst + i), _mm512_xor_si512(d, p));
+    }
+    mul_add_scalar(coef, src + i, dst + i, len - i);
+}
+#endif
+
+typedef void (*mul_add_t)(uint8_t, const uint8_t *, uint8_t *, size_t);
+
+static mul_add_t best_kernel(std::string &name) {
+#ifdef __RS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+	name = "avx512";
+	return mul_add_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+	name = "avx2";
+	return mul_add_avx2;
+    }
+#endif
+    name = "scalar";
+    return mul_add_scalar;
+}
+
+static std::string kernel_name;
+static mul_add_t kernel = best_kernel(kernel_name);
+
+bool rs_codec_t::set_kernel(const std::string &name) {
+    if (name == "auto") {
+	kernel = best_kernel(kernel_name);
+	return true;
+    }
+    if (name == "scalar") {
+	kernel = mul_add_scalar;
+	kernel_name = name;
+	return true;
+    }
+#ifdef __RS_X86
+    __builtin_cpu_init();
+    if (name == "avx2" && __builtin_cpu_supports("avx2")) {
+	kernel = mul_add_avx2;
+	kernel_name = name;
+	return true;
+    }
+    if (name == "avx512" && __builtin_cpu_supports("avx512bw")) {
+	kernel = mul_add_avx512;
+	kernel_name = name;
+	return true;
+    }
+#endif
+    return false;
+}
+
+std::string rs_codec_t::get_kernel() {
+    return kernel_name;
+}
+
+void rs_codec_t::mul_add(uint8_t coef, const uint8_t *src, uint8_t *dst, size_t len) {
+    if (coef == 0)
+	return;
+    if (coef == 1) {
+	for (size_t i = 0; i < len; i++)
+	    dst[i] ^= src[i];
+	return;
+    }
+    kernel(coef, src, dst, len);
+}
+
+void rs_codec_t::combine(const uint8_t *coefs, const uint8_t *const *srcs, unsigned int n, uint8_t *dst, size_t len) {
+    // work on blocks that fit in L1, so that dst is not streamed through memory once per source
+    const size_t BLOCK = 16 << 10;
+    memset(dst, 0, len);
+    for (size_t off = 0; off < len; off += BLOCK) {
+	size_t block = std::min(BLOCK, len - off);
+	for (unsigned int i = 0; i < n; i++)
+	    mul_add(coefs[i], srcs[i] + off, dst + off, block);
+    }
+}
+
+rs_codec_t::rs_codec_t(unsigned int data, unsigned int parity) : k(data), m(parity), matrix((data + parity) * data, 0) {
+    if (k == 0 || m == 0 || k + m > 256)
+	throw std::invalid_argument("Reed-Solomon code needs k > 0, m > 0 and k + m <= 256");
+    for (unsigned int i = 0; i < k; i++)
+	matrix[i * k + i] = 1;
+    // Cauchy matrix: M[j][i] = 1 / (x_j + y_i), with x_j = k + j and y_i = i all distinct
+    for (unsigned int j = 0; j < m; j++)
+	for (unsigned int i = 0; i < k; i++)
+	    matrix[(k + j) * k + i] = inv((k + j) ^ i);
+}
+
+void rs_codec_t::encode(const uint8_t *const *data, uint8_t *const *parity, size_t len) const {
+    for (unsigned int j = 0; j < m; j++)
+	combine(row(k + j), data, k, parity[j], len);
+}
+
+bool rs_codec_t::invert(std::vector<uint8_t> &a, unsigned int n) const {
+    // Gauss-Jordan elimination on [a | I]
+    std::vector<uint8_t> b(n * n, 0);
+    for (unsigned int i = 0; i < n; i++)
+	b[i * n + i] = 1;
+    for (unsigned int col = 0; col < n; col++) {
+	unsigned int pivot = col;
+	while (pivot < n && a[pivot * n + col] == 0)
+	    pivot++;
+	if (pivot == n)
+	    return false;
+	if (pivot != col)
+	    for (unsigned int j = 0; j < n; j++) {
+		std::swap(a[pivot * n + j], a[col * n + j]);
+		std::swap(b[pivot * n + j], b[col * n + j]);
+	    }
+	uint8_t f = inv(a[col * n + col]);
+	for (unsigned int j = 0; j < n; j++) {
+	    a[col * n + j] = mul(a[col * n + j], f);
+	    b[col * n + j] = mul(b[col * n + j], f);
+	}
+	for (unsigned int r = 0; r < n; r++) {
+	    uint8_t g = a[r * n + col];
+	    if (r == col || g == 0)
+		continue;
+	    for (unsigned int j = 0; j < n; j++) {
+		a[r * n + j] ^= mul(g, a[col * n + j]);
+		b[r * n + j] ^= mul(g, b[col * n + j]);
+	    }
+	}
+    }
+    a.swap(b);
+    return true;
+}
+
+bool rs_codec_t::decode_coefficients(const std::vector<unsigned int> &sources, unsigned int target,
+				     std::vector<uint8_t> &coefs) const {
+    if (sources.size() != k || target >= k + m)
+	return false;
+    // target = row(target) * A^-1 * sources, where A holds the generator rows of the sources
+    std::vector<uint8_t> a(k * k);
+    for (unsigned int i = 0; i < k; i++)
+	memcpy(&a[i * k], row(sources[i]), k);
+    if (!invert(a, k))
+	return false;
+    coefs.assign(k, 0);
+    const uint8_t *t = row(target);
+    for (unsigned int i = 0; i < k; i++)
+	for (unsigned int j = 0; j < k; j++)
+	    coefs[i] ^= mul(t[j], a[j * k + i]);
+    return true;
+}
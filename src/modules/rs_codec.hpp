@@ -0,0 +1,40 @@
+#ifndef __RS_CODEC_HPP
+#define __RS_CODEC_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// systematic Reed-Solomon code over GF(2^8): k data shards, m parity shards (k + m <= 256)
+// the parity rows form a Cauchy matrix, so any k of the k + m shards are enough to recover the others
+class rs_codec_t {
+    unsigned int k, m;
+    std::vector<uint8_t> matrix; // (k + m) x k generator matrix, identity on top
+
+    bool invert(std::vector<uint8_t> &a, unsigned int n) const;
+public:
+    rs_codec_t(unsigned int k, unsigned int m);
+
+    unsigned int data_shards() const { return k; }
+    unsigned int parity_shards() const { return m; }
+    const uint8_t *row(unsigned int shard) const { return &matrix[shard * k]; }
+
+    // parity[j] = sum_i M[j][i] * data[i], for all j < m
+    void encode(const uint8_t *const *data, uint8_t *const *parity, size_t len) const;
+    // coefficients to compute shard target from the k shards listed in sources (indices in [0, k + m))
+    bool decode_coefficients(const std::vector<unsigned int> &sources, unsigned int target, std::vector<uint8_t> &coefs) const;
+
+    // dst = sum_i coefs[i] * srcs[i]
+    static void combine(const uint8_t *coefs, const uint8_t *const *srcs, unsigned int n, uint8_t *dst, size_t len);
+    // dst ^= coef * src, using the fastest kernel available on this CPU
+    static void mul_add(uint8_t coef, const uint8_t *src, uint8_t *dst, size_t len);
+
+    static uint8_t mul(uint8_t a, uint8_t b);
+    static uint8_t inv(uint8_t a);
+    // selects the kernel: "auto", "scalar", "avx2" or "avx512"; returns false if not supported by the CPU
+    static bool set_kernel(const std::string &name);
+    static std::string get_kernel();
+};
+
+#endif // __RS_CODEC_HPP
@@ -0,0 +1,501 @@
+#include "rs_module.hpp"
+#include "ec_module.hpp"
+#include "common/status.hpp"
+#include "common/tiers.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <sstream>
+#include <future>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+//#define __DEBUG
+#include "common/debug.hpp"
+
+// list of (file stem, size) making up the data of a group member, in the order they are concatenated
+typedef std::vector<std::pair<std::string, size_t> > manifest_t;
+
+// header at the beginning of the parity file, replicated on every group member
+struct rs_header_t {
+    unsigned int k = 0, m = 0;
+    size_t chunk = 0;
+    std::vector<manifest_t> nodes;
+
+    std::string serialize() const {
+	std::ostringstream out;
+	out << "veloc-rs 1 " << k << " " << m << " " << chunk << " " << nodes.size() << "\n";
+	for (auto &n : nodes) {
+	    out << n.size() << "\n";
+	    for (auto &f : n)
+		out << f.second << " " << f.first << "\n";
+	}
+	return out.str();
+    }
+    bool parse(const std::string &s) {
+	std::istringstream in(s);
+	std::string magic;
+	int format;
+	size_t no_nodes, no_files;
+	if (!(in >> magic >> format >> k >> m >> chunk >> no_nodes) || magic != "veloc-rs" || format != 1)
+	    return false;
+	nodes.assign(no_nodes, manifest_t());
+	for (auto &n : nodes) {
+	    if (!(in >> no_files))
+		return false;
+	    for (size_t i = 0; i < no_files; i++) {
+		std::pair<std::string, size_t> f;
+		if (!(in >> f.second))
+		    return false;
+		in.get();
+		std::getline(in, f.first);
+		n.push_back(f);
+	    }
+	}
+	return true;
+    }
+    // parity chunks start after the length prefix and the header itself
+    size_t data_offset() const {
+	return sizeof(uint64_t) + serialize().size();
+    }
+};
+
+// the local files of a member seen as one contiguous, zero-padded byte stream
+class rs_blob_t {
+    std::vector<int> fds;
+    std::vector<size_t> sizes;
+public:
+    bool open(const std::string &prefix, const manifest_t &manifest, bool create) {
+	for (auto &f : manifest) {
+	    std::string fname = prefix + "/" + f.first;
+	    int fd = create ? ::open(fname.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644) : ::open(fname.c_str(), O_RDONLY);
+	    if (fd == -1 || (create && ftruncate(fd, f.second) != 0)) {
+		ERROR("cannot open " << fname << " for erasure coding, error = " << std::strerror(errno));
+		return false;
+	    }
+	    fds.push_back(fd);
+	    sizes.push_back(f.second);
+	}
+	return true;
+    }
+    template<typename F> bool for_each_extent(size_t off, size_t len, F f) {
+	size_t start = 0, done = 0;
+	for (unsigned int i = 0; i < fds.size() && done < len; i++) {
+	    if (off + done < start + sizes[i]) {
+		size_t file_off = off + done - start, n = std::min(len - done, sizes[i] - file_off);
+		if (!f(fds[i], file_off, done, n))
+		    return false;
+		done += n;
+	    }
+	    start += sizes[i];
+	}
+	return true;
+    }
+    bool read(size_t off, uint8_t *buf, size_t len) {
+	memset(buf, 0, len);
+	return for_each_extent(off, len, [buf](int fd, size_t file_off, size_t buf_off, size_t n) {
+	    return pread(fd, buf + buf_off, n, file_off) == (ssize_t)n;
+	});
+    }
+    bool write(size_t off, const uint8_t *buf, size_t len) {
+	return for_each_extent(off, len, [buf](int fd, size_t file_off, size_t buf_off, size_t n) {
+	    return pwrite(fd, buf + buf_off, n, file_off) == (ssize_t)n;
+	});
+    }
+    ~rs_blob_t() {
+	for (auto fd : fds)
+	    close(fd);
+    }
+};
+
+static std::vector<std::string> allgather_strings(const std::string &local, MPI_Comm comm) {
+    int size, len = local.size();
+    MPI_Comm_size(comm, &size);
+    std::vector<int> lens(size), displs(size, 0);
+    MPI_Allgather(&len, 1, MPI_INT, lens.data(), 1, MPI_INT, comm);
+    for (int i = 1; i < size; i++)
+	displs[i] = displs[i - 1] + lens[i - 1];
+    std::vector<char> all(displs[size - 1] + lens[size - 1] + 1);
+    MPI_Allgatherv(local.data(), len, MPI_CHAR, all.data(), lens.data(), displs.data(), MPI_CHAR, comm);
+    std::vector<std::string> result;
+    for (int i = 0; i < size; i++)
+	result.push_back(std::string(all.data() + displs[i], lens[i]));
+    return result;
+}
+
+static bool write_header(int fd, const rs_header_t &h) {
+    std::string s = h.serialize();
+    uint64_t len = s.size();
+    return pwrite(fd, &len, sizeof(len), 0) == sizeof(len) &&
+	pwrite(fd, s.data(), len, sizeof(len)) == (ssize_t)len &&
+	ftruncate(fd, h.data_offset() + h.m * h.chunk) == 0;
+}
+
+static bool read_header(const std::string &fname, rs_header_t &h) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd == -1)
+	return false;
+    uint64_t len;
+    bool ok = pread(fd, &len, sizeof(len), 0) == sizeof(len) && len < (1 << 30);
+    std::string s(ok ? len : 0, 0);
+    ok = ok && pread(fd, &s[0], len, sizeof(len)) == (ssize_t)len && h.parse(s);
+    struct stat st;
+    ok = ok && fstat(fd, &st) == 0 && (size_t)st.st_size == h.data_offset() + h.m * h.chunk;
+    close(fd);
+    return ok;
+}
+
+// runs f(i) for i in [0, n) on up to threads worker threads, returns true if all calls succeeded
+template<typename F> static bool parallel_for(unsigned int n, int threads, F f) {
+    std::vector<std::future<bool> > workers;
+    unsigned int t = std::max(1, std::min(threads, (int)n));
+    for (unsigned int w = 0; w < t; w++)
+	workers.push_back(std::async(std::launch::async, [=, &f]() {
+	    bool ok = true;
+	    for (unsigned int i = w; i < n; i += t)
+		ok = f(i) && ok;
+	    return ok;
+	}));
+    bool ok = true;
+    for (auto &w : workers)
+	ok = w.get() && ok;
+    return ok;
+}
+
+rs_module_t::rs_module_t(const config_t &c, MPI_Comm cm) : cfg(c), comm(cm) {
+    int rank, ranks, data;
+    MPI_Comm_size(comm, &ranks);
+    MPI_Comm_rank(comm, &rank);
+
+    if (!cfg.get_optional("ec_parity", m) || m < 1)
+	m = 1;
+    if (!cfg.get_optional("ec_data", data) || data < 1)
+	data = std::max(ranks - m, 1);
+    int g = data + m, groups = std::max(ranks / g, 1);
+    MPI_Comm_split(comm, std::min(rank / g, groups - 1), rank, &comm_group);
+    MPI_Comm_size(comm_group, &group_size);
+    MPI_Comm_rank(comm_group, &group_rank);
+    k = group_size - m;
+
+    int piece;
+    if (!cfg.get_optional("ec_chunk_size", piece) || piece < 4096)
+	piece = 1 << 20;
+    piece_size = piece;
+    if (!cfg.get_optional("ec_threads", threads) || threads < 1)
+	threads = 4;
+    std::string simd;
+    if (cfg.get_optional("ec_simd", simd) && !rs_codec_t::set_kernel(simd))
+	ERROR("SIMD kernel " << simd << " not supported by this CPU, using " << rs_codec_t::get_kernel());
+
+    int interval;
+    if (!cfg.get_optional("ec_interval", interval))
+	INFO("EC interval not specified, every checkpoint will be protected using EC");
+    if (k < 1 || group_size > 256) {
+	INFO("group of " << group_size << " failure domains cannot tolerate " << m << " failures, EC deactivated");
+	active = false;
+    } else
+	codec = new rs_codec_t(k, m);
+    DBG("native EC initialized: k = " << k << ", m = " << m << ", kernel = " << rs_codec_t::get_kernel());
+}
+
+rs_module_t::~rs_module_t() {
+    delete codec;
+    MPI_Comm_free(&comm_group);
+}
+
+std::string rs_module_t::parity_file(const std::string &name, int version) const {
+    return cfg.get_scratch() + "/" + name + "-ec-" + std::to_string(version) + ".rs";
+}
+
+int rs_module_t::process_command(const command_t &c) {
+    int interval = active ? cfg.get_tuning().ec_interval : -1;
+    switch (c.command) {
+    case command_t::INIT:
+	last_timestamp = std::chrono::system_clock::now() + std::chrono::seconds(interval);
+	return interval >= 0 ? 1 : 0;
+
+    case command_t::TEST:
+	DBG("get latest EC version for " << c.name);
+	return get_latest_ec_version(cfg.get_scratch(), std::string(c.name) + "-ec", c.version);
+
+    default:
+	return VELOC_SUCCESS;
+    }
+}
+
+int rs_module_t::process_commands(const std::vector<command_t> &cmds) {
+    tuning_t tuning = cfg.get_tuning();
+    int interval = active ? tuning.ec_interval : -1, max_versions = tuning.max_versions;
+    // a reload may reach the backends at different times: if any of them turned EC off, all skip the encoding
+    MPI_Allreduce(MPI_IN_PLACE, &interval, 1, MPI_INT, MPI_MIN, comm);
+    if (cmds.size() == 0 || interval < 0)
+	return VELOC_SUCCESS;
+    int command = cmds[0].command;
+    ASSERT(command == command_t::CHECKPOINT || command == command_t::RESTART);
+    // streamed checkpoints without a copy in the scratch directory have nothing to encode
+    if (command == command_t::CHECKPOINT && !cfg.keeps_local(cmds[0].name))
+	return VELOC_SUCCESS;
+
+    if (command == command_t::RESTART) {
+	if (max_versions > 0) {
+	    auto &version_history = checkpoint_history[cmds[0].name];
+	    version_history.clear();
+	    version_history.push_back(cmds[0].version);
+	}
+	return rebuild(cmds[0].name, cmds[0].version);
+    }
+    if (interval > 0) {
+	auto t = std::chrono::system_clock::now();
+	int checkpoint = t >= last_timestamp, result;
+	MPI_Allreduce(&checkpoint, &result, 1, MPI_INT, MPI_LAND, comm);
+	if (result)
+	    last_timestamp = t + std::chrono::seconds(interval);
+	else
+	    return VELOC_SUCCESS;
+    }
+    int ret = encode(cmds);
+    if (ret == VELOC_SUCCESS && max_versions > 0) {
+	auto &version_history = checkpoint_history[cmds[0].name];
+	version_history.push_back(cmds[0].version);
+	if ((int)version_history.size() > max_versions) {
+	    for (auto &c : cmds)
+		tier_set_t::remove_local(c.filename(cfg.get_scratch(), version_history.front()));
+	    unlink(parity_file(cmds[0].name, version_history.front()).c_str());
+	    version_history.pop_front();
+	}
+    }
+    return ret;
+}
+
+int rs_module_t::encode(const std::vector<command_t> &cmds) {
+    TIMER_START(timer);
+    std::string scratch = cfg.get_scratch(), fname = parity_file(cmds[0].name, cmds[0].version);
+    std::vector<command_t> sorted(cmds);
+    std::sort(sorted.begin(), sorted.end(), [](const command_t &a, const command_t &b) { return a.unique_id < b.unique_id; });
+
+    // build the local manifest and exchange it with the rest of the group
+    manifest_t local;
+    size_t total = 0;
+    int ok = 1, all_ok;
+    for (auto &c : sorted) {
+	struct stat st;
+	if (stat(c.filename(scratch).c_str(), &st) != 0) {
+	    ERROR("cannot protect " << c.stem() << " using EC: " << std::strerror(errno));
+	    ok = 0;
+	    break;
+	}
+	local.push_back(std::make_pair(c.stem(), (size_t)st.st_size));
+	total += st.st_size;
+    }
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_LAND, comm_group);
+    if (!all_ok)
+	return VELOC_FAILURE;
+    rs_header_t header;
+    header.k = k;
+    header.m = m;
+    size_t max_total = 0;
+    MPI_Allreduce(&total, &max_total, 1, MPI_UNSIGNED_LONG, MPI_MAX, comm_group);
+    header.chunk = std::max((size_t)64, ((max_total + k - 1) / k + 63) / 64 * 64);
+    for (auto &s : allgather_strings(rs_header_t{0, 0, 0, {local}}.serialize(), comm_group)) {
+	rs_header_t h;
+	h.parse(s);
+	header.nodes.push_back(h.nodes.empty() ? manifest_t() : h.nodes[0]);
+    }
+
+    rs_blob_t blob;
+    std::string tmp = fname + ".tmp";
+    int fd = open(tmp.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    ok = fd != -1 && write_header(fd, header) && blob.open(scratch, local, false);
+    size_t base = header.data_offset();
+    int g = group_size;
+
+    // stream the chunks through in pieces: data members send their piece of stripe s to the m parity holders
+    // of s, which encode and append it to their parity file. Stripe s has its parity on members s .. s + m - 1
+    // and its data on members s + m .. s + g - 1, so every member owns k data chunks and m parity chunks.
+    std::vector<std::vector<uint8_t> > send(k, std::vector<uint8_t>(piece_size)),
+	recv(m * k, std::vector<uint8_t>(piece_size)), parity(m, std::vector<uint8_t>(piece_size));
+    for (size_t off = 0; off < header.chunk; off += piece_size) {
+	size_t len = std::min(piece_size, header.chunk - off);
+	std::vector<MPI_Request> reqs;
+	for (int i = 0; i < k; i++) {
+	    int s = (group_rank - m - i + 2 * g) % g;
+	    if (!blob.read(i * header.chunk + off, send[i].data(), len))
+		ok = 0;
+	    for (int j = 0; j < m; j++) {
+		reqs.emplace_back();
+		MPI_Isend(send[i].data(), len, MPI_BYTE, (s + j) % g, s, comm_group, &reqs.back());
+	    }
+	}
+	for (int j = 0; j < m; j++) {
+	    int s = (group_rank - j + g) % g;
+	    for (int i = 0; i < k; i++) {
+		reqs.emplace_back();
+		MPI_Irecv(recv[j * k + i].data(), len, MPI_BYTE, (s + m + i) % g, s, comm_group, &reqs.back());
+	    }
+	}
+	MPI_Waitall(reqs.size(), reqs.data(), MPI_STATUSES_IGNORE);
+	bool written = parallel_for(m, threads, [&](unsigned int j) {
+	    std::vector<const uint8_t *> srcs;
+	    for (int i = 0; i < k; i++)
+		srcs.push_back(recv[j * k + i].data());
+	    rs_codec_t::combine(codec->row(k + j), srcs.data(), k, parity[j].data(), len);
+	    return pwrite(fd, parity[j].data(), len, base + j * header.chunk + off) == (ssize_t)len;
+	});
+	ok = ok && written;
+    }
+    if (fd != -1) {
+	ok = ok && fsync(fd) == 0;
+	close(fd);
+    }
+    ok = ok && rename(tmp.c_str(), fname.c_str()) == 0;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_LAND, comm_group);
+    TIMER_STOP(timer, "native EC encode of " << fname << ", chunk size = " << header.chunk);
+    if (all_ok)
+	return VELOC_SUCCESS;
+    ERROR("native EC encoding failed for checkpoint " << fname);
+    unlink(tmp.c_str());
+    return VELOC_FAILURE;
+}
+
+int rs_module_t::rebuild(const std::string &name, int version) {
+    TIMER_START(timer);
+    std::string scratch = cfg.get_scratch(), fname = parity_file(name, version);
+    int g = group_size;
+
+    // a member is lost if its parity file or any of its data files is missing or truncated
+    rs_header_t header;
+    int intact = read_header(fname, header) && (int)header.nodes.size() == g;
+    for (unsigned int i = 0; intact && i < header.nodes[group_rank].size(); i++) {
+	struct stat st;
+	auto &f = header.nodes[group_rank][i];
+	intact = stat((scratch + "/" + f.first).c_str(), &st) == 0 && (size_t)st.st_size == f.second;
+    }
+    std::vector<int> alive(g);
+    MPI_Allgather(&intact, 1, MPI_INT, alive.data(), 1, MPI_INT, comm_group);
+    int lost = std::count(alive.begin(), alive.end(), 0);
+    if (lost == 0)
+	return VELOC_SUCCESS;
+    if (lost > m) {
+	ERROR("cannot rebuild " << fname << ": " << lost << " failure domains lost, at most " << m << " tolerated");
+	return VELOC_FAILURE;
+    }
+    int root = std::find(alive.begin(), alive.end(), 1) - alive.begin();
+    std::string hs = header.serialize();
+    uint64_t hlen = hs.size();
+    MPI_Bcast(&hlen, 1, MPI_UINT64_T, root, comm_group);
+    hs.resize(hlen);
+    MPI_Bcast(&hs[0], hlen, MPI_CHAR, root, comm_group);
+    if (!intact && !header.parse(hs))
+	FATAL("received corrupted EC header for " << fname);
+    if ((int)header.k != k || (int)header.m != m) {
+	ERROR("EC layout of " << fname << " (k = " << header.k << ", m = " << header.m << ") does not match the current group");
+	return VELOC_FAILURE;
+    }
+
+    int ok = 1, all_ok;
+    rs_blob_t blob;
+    size_t base = header.data_offset();
+    std::string tmp = fname + ".tmp";
+    int fd = intact ? open(fname.c_str(), O_RDONLY) : open(tmp.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    ok = fd != -1 && (intact || write_header(fd, header)) && blob.open(scratch, header.nodes[group_rank], !intact);
+
+    // shard t of stripe s: t < k is the data chunk of member s + m + t, otherwise parity t - k of member s + t - k
+    auto shard_owner = [&](int s, int t) { return t < k ? (s + m + t) % g : (s + t - k) % g; };
+    struct target_t {
+	int stripe, shard;
+	std::vector<unsigned int> sources;
+	std::vector<uint8_t> coefs;
+	std::vector<std::vector<uint8_t> > bufs;
+	std::vector<uint8_t> out;
+    };
+    std::vector<target_t> targets;       // shards this member has to rebuild
+    std::vector<std::pair<int, int> > outgoing; // (stripe, shard) this member has to send, with the destinations below
+    std::vector<std::vector<int> > destinations;
+    for (int s = 0; s < g; s++) {
+	std::vector<unsigned int> sources;
+	std::vector<int> missing;
+	for (int t = 0; t < k + m; t++)
+	    if (alive[shard_owner(s, t)]) {
+		if ((int)sources.size() < k)
+		    sources.push_back(t);
+	    } else
+		missing.push_back(t);
+	if (missing.empty())
+	    continue;
+	std::vector<int> dest;
+	for (auto t : missing) {
+	    dest.push_back(shard_owner(s, t));
+	    if (shard_owner(s, t) == group_rank) {
+		target_t target;
+		target.stripe = s;
+		target.shard = t;
+		target.sources = sources;
+		if (!codec->decode_coefficients(sources, t, target.coefs))
+		    FATAL("cannot invert EC decoding matrix for stripe " << s);
+		target.bufs.assign(k, std::vector<uint8_t>(piece_size));
+		target.out.resize(piece_size);
+		targets.push_back(target);
+	    }
+	}
+	for (auto t : sources)
+	    if (shard_owner(s, t) == group_rank) {
+		outgoing.push_back(std::make_pair(s, t));
+		destinations.push_back(dest);
+	    }
+    }
+
+    // the lost members rebuild their stripes in parallel, each of them decoding its shards on several threads
+    std::vector<std::vector<uint8_t> > send(outgoing.size(), std::vector<uint8_t>(piece_size));
+    for (size_t off = 0; off < header.chunk; off += piece_size) {
+	size_t len = std::min(piece_size, header.chunk - off);
+	std::vector<MPI_Request> reqs;
+	for (unsigned int i = 0; i < outgoing.size(); i++) {
+	    int s = outgoing[i].first, t = outgoing[i].second;
+	    if (t < k)
+		ok = blob.read(((group_rank - s - m + 2 * g) % g) * header.chunk + off, send[i].data(), len) && ok;
+	    else
+		ok = pread(fd, send[i].data(), len, base + ((group_rank - s + g) % g) * header.chunk + off) == (ssize_t)len && ok;
+	    // every member owns a single shard of each stripe, so the stripe alone tells the messages of a sender
+	    // apart. Unlike a tag made of the stripe and the shard, it stays below the 32767 that MPI_TAG_UB is
+	    // guaranteed to reach (a group has at most 256 members).
+	    for (auto d : destinations[i]) {
+		reqs.emplace_back();
+		MPI_Isend(send[i].data(), len, MPI_BYTE, d, s, comm_group, &reqs.back());
+	    }
+	}
+	for (auto &target : targets)
+	    for (int i = 0; i < k; i++) {
+		reqs.emplace_back();
+		MPI_Irecv(target.bufs[i].data(), len, MPI_BYTE, shard_owner(target.stripe, target.sources[i]),
+			  target.stripe, comm_group, &reqs.back());
+	    }
+	MPI_Waitall(reqs.size(), reqs.data(), MPI_STATUSES_IGNORE);
+	bool written = parallel_for(targets.size(), threads, [&](unsigned int i) {
+	    target_t &target = targets[i];
+	    std::vector<const uint8_t *> srcs;
+	    for (auto &b : target.bufs)
+		srcs.push_back(b.data());
+	    rs_codec_t::combine(target.coefs.data(), srcs.data(), k, target.out.data(), len);
+	    if (target.shard < k)
+		return blob.write(target.shard * header.chunk + off, target.out.data(), len);
+	    return pwrite(fd, target.out.data(), len, base + (target.shard - k) * header.chunk + off) == (ssize_t)len;
+	});
+	ok = ok && written;
+    }
+    if (fd != -1) {
+	if (!intact)
+	    ok = ok && fsync(fd) == 0;
+	close(fd);
+    }
+    if (!intact)
+	ok = ok && rename(tmp.c_str(), fname.c_str()) == 0;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_LAND, comm_group);
+    TIMER_STOP(timer, "native EC rebuild of " << fname << ", lost failure domains = " << lost);
+    if (all_ok)
+	return VELOC_SUCCESS;
+    ERROR("native EC rebuild failed for checkpoint " << fname);
+    return VELOC_FAILURE;
+}
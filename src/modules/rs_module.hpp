@@ -0,0 +1,41 @@
+#ifndef __RS_MODULE_HPP
+#define __RS_MODULE_HPP
+
+#include "common/config.hpp"
+#include "common/command.hpp"
+#include "modules/rs_codec.hpp"
+
+#include <vector>
+#include <chrono>
+#include <deque>
+#include <map>
+
+#include <mpi.h>
+
+// built-in erasure coding, alternative to ER: the backends are split into groups of k + m failure domains
+// (one backend per failure domain, in rank order). Each group member contributes its local checkpoint files
+// as k data chunks, the parity chunks are rotated across the group (m per member), so that any m members
+// can be lost and rebuilt from the survivors.
+class rs_module_t {
+    config_t cfg;
+    MPI_Comm comm, comm_group;
+    int group_rank, group_size, k, m, threads;
+    bool active = true;
+    size_t piece_size;
+    rs_codec_t *codec = NULL;
+    std::chrono::system_clock::time_point last_timestamp;
+    typedef std::map<std::string, std::deque<int> > checkpoint_history_t;
+    checkpoint_history_t checkpoint_history;
+
+    std::string parity_file(const std::string &name, int version) const;
+    int encode(const std::vector<command_t> &cmds);
+    int rebuild(const std::string &name, int version);
+public:
+    rs_module_t(const config_t &c, MPI_Comm cm);
+    ~rs_module_t();
+
+    int process_commands(const std::vector<command_t> &cmds);
+    int process_command(const command_t &cmd);
+};
+
+#endif //__RS_MODULE_HPP
@@ -0,0 +1,340 @@
+#include "subfile_module.hpp"
+#include "common/status.hpp"
+
+#include <sstream>
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <cinttypes>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+//#define __DEBUG
+#include "common/debug.hpp"
+
+// location of a client checkpoint in the subfiles of a version
+struct subfile_entry_t {
+    int group;
+    uint64_t offset, size;
+};
+
+static uint64_t align_up(uint64_t x, uint64_t a) {
+    return (x + a - 1) / a * a;
+}
+
+static std::string gather_to_root(const std::string &local, MPI_Comm comm) {
+    int rank, size, len = local.size();
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    std::vector<int> lens(rank == 0 ? size : 0), displs(rank == 0 ? size : 0, 0);
+    MPI_Gather(&len, 1, MPI_INT, lens.data(), 1, MPI_INT, 0, comm);
+    for (int i = 1; i < (int)displs.size(); i++)
+	displs[i] = displs[i - 1] + lens[i - 1];
+    std::vector<char> all(rank == 0 ? displs[size - 1] + lens[size - 1] + 1 : 1);
+    MPI_Gatherv(local.data(), len, MPI_CHAR, all.data(), lens.data(), displs.data(), MPI_CHAR, 0, comm);
+    return rank == 0 ? std::string(all.data(), all.size() - 1) : std::string();
+}
+
+static std::string bcast_from_root(const std::string &s, MPI_Comm comm) {
+    uint64_t len = s.size();
+    MPI_Bcast(&len, 1, MPI_UINT64_T, 0, comm);
+    std::vector<char> buf(s.begin(), s.end());
+    buf.resize(len);
+    MPI_Bcast(buf.data(), len, MPI_CHAR, 0, comm);
+    return std::string(buf.begin(), buf.end());
+}
+
+static int get_latest_subfile_version(const std::string &p, const std::string &cname, int needed_version) {
+    struct dirent *dentry;
+    DIR *dir;
+    int version, ret = -1;
+    char suffix[8];
+
+    dir = opendir(p.c_str());
+    if (dir == NULL)
+	return -1;
+    while ((dentry = readdir(dir)) != NULL) {
+	std::string fname = std::string(dentry->d_name);
+	if (fname.compare(0, cname.length(), cname) == 0 &&
+	    sscanf(fname.substr(cname.length()).c_str(), ".%d.%7s", &version, suffix) == 2 &&
+	    strcmp(suffix, "idx") == 0 && (needed_version == 0 || version <= needed_version)) {
+	    if (version > ret)
+		ret = version;
+	}
+    }
+    closedir(dir);
+    return ret;
+}
+
+subfile_module_t::subfile_module_t(const config_t &c, MPI_Comm cm) : cfg(c) {
+    int rank, ranks;
+    MPI_Comm_dup(cm, &comm);
+    MPI_Comm_size(comm, &ranks);
+    MPI_Comm_rank(comm, &rank);
+
+    if (!cfg.get_optional("subfile_count", groups) || groups < 1)
+	groups = 1;
+    groups = std::min(groups, ranks);
+    group = (int)((int64_t)rank * groups / ranks);
+    MPI_Comm_split(comm, group, rank, &comm_group);
+
+    int a;
+    if (!cfg.get_optional("subfile_align", a) || a < 1)
+	a = 1 << 20;
+    align = a;
+    chunk_size = align_up(16 << 20, align);
+    DBG("subfiling initialized: " << groups << " subfiles, rank " << rank << " in group " << group);
+}
+
+subfile_module_t::~subfile_module_t() {
+    MPI_Comm_free(&comm_group);
+    MPI_Comm_free(&comm);
+}
+
+std::string subfile_module_t::subfile(const std::string &name, int version, int g) const {
+    return cfg.get_persistent() + "/" + name + "." + std::to_string(version) + "." + std::to_string(g) + ".sub";
+}
+
+std::string subfile_module_t::index_file(const std::string &name, int version) const {
+    return cfg.get_persistent() + "/" + name + "." + std::to_string(version) + ".idx";
+}
+
+int subfile_module_t::process_command(const command_t &c) {
+    switch (c.command) {
+    case command_t::INIT:
+	last_timestamp = std::chrono::system_clock::now() + std::chrono::seconds(cfg.get_tuning().persistent_interval);
+	return VELOC_SUCCESS;
+
+    case command_t::TEST:
+	// TEST results are combined using max across modules, so "no version" is reported as VELOC_SUCCESS
+	return std::max(get_latest_subfile_version(cfg.get_persistent(), c.name, c.version), (int)VELOC_SUCCESS);
+
+    default:
+	return VELOC_SUCCESS;
+    }
+}
+
+int subfile_module_t::process_commands(const std::vector<command_t> &cmds) {
+    tuning_t tuning = cfg.get_tuning();
+    int interval = tuning.persistent_interval;
+    // all backends need the same interval to issue the same collective calls, even in the middle of a reload
+    MPI_Allreduce(MPI_IN_PLACE, &interval, 1, MPI_INT, MPI_MIN, comm);
+    if (cmds.size() == 0 || interval < 0)
+	return VELOC_SUCCESS;
+    int command = cmds[0].command;
+    ASSERT(command == command_t::CHECKPOINT || command == command_t::RESTART);
+    // streamed checkpoints are written to the persistent storage by the clients, one file each
+    if (cfg.is_streamed(cmds[0].name))
+	return VELOC_SUCCESS;
+    if (command == command_t::RESTART)
+	return restore(cmds);
+    // a version kept on scratch only by one backend under backpressure is not flushed by any of them: the subfiles
+    // would miss its regions and could not be restored
+    int skip = 0;
+    for (auto &c : cmds)
+	if (c.flags & command_t::NO_PERSISTENT)
+	    skip = 1;
+    MPI_Allreduce(MPI_IN_PLACE, &skip, 1, MPI_INT, MPI_LOR, comm);
+    if (skip) {
+	INFO("subfiling of " << cmds[0].name << ", version " << cmds[0].version << " skipped under backpressure");
+	return VELOC_SUCCESS;
+    }
+
+    if (interval > 0) {
+	auto t = std::chrono::system_clock::now();
+	int checkpoint = t >= last_timestamp, result;
+	MPI_Allreduce(&checkpoint, &result, 1, MPI_INT, MPI_LAND, comm);
+	if (!result)
+	    return VELOC_SUCCESS;
+	last_timestamp = t + std::chrono::seconds(interval);
+    }
+    int ret = flush(cmds), max_versions = tuning.max_versions;
+    if (ret == VELOC_SUCCESS && max_versions > 0) {
+	auto &version_history = checkpoint_history[cmds[0].name];
+	version_history.push_back(cmds[0].version);
+	if ((int)version_history.size() > max_versions) {
+	    remove_version(cmds[0].name, version_history.front());
+	    version_history.pop_front();
+	}
+    }
+    return ret;
+}
+
+void subfile_module_t::remove_version(const std::string &name, int version) {
+    int rank, group_rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_rank(comm_group, &group_rank);
+    // the index goes first, so that a partially removed version is never picked for restart
+    if (rank == 0)
+	unlink(index_file(name, version).c_str());
+    MPI_Barrier(comm);
+    if (group_rank == 0)
+	unlink(subfile(name, version, group).c_str());
+}
+
+int subfile_module_t::flush(const std::vector<command_t> &cmds) {
+    std::string scratch = cfg.get_scratch(), name = cmds[0].name;
+    int version = cmds[0].version, error = 0;
+
+    // layout of the region of this backend: its files one after another, each starting at an aligned offset
+    std::vector<int> fds;
+    std::vector<uint64_t> sizes, offsets;
+    uint64_t total = 0;
+    for (auto &c : cmds) {
+	struct stat st;
+	int fd = open(c.filename(scratch).c_str(), O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) != 0) {
+	    ERROR("cannot open " << c.filename(scratch) << " for subfiling, error = " << std::strerror(errno));
+	    error = 1;
+	    st.st_size = 0;
+	}
+	fds.push_back(fd);
+	sizes.push_back(st.st_size);
+	offsets.push_back(total);
+	total += align_up(st.st_size, align);
+    }
+    uint64_t base = 0, rounds = (total + chunk_size - 1) / chunk_size, max_rounds, subfile_size;
+    MPI_Exscan(&total, &base, 1, MPI_UINT64_T, MPI_SUM, comm_group);
+    MPI_Allreduce(&total, &subfile_size, 1, MPI_UINT64_T, MPI_SUM, comm_group);
+    int group_rank;
+    MPI_Comm_rank(comm_group, &group_rank);
+    if (group_rank == 0)
+	base = 0;
+    MPI_Allreduce(&rounds, &max_rounds, 1, MPI_UINT64_T, MPI_MAX, comm_group);
+
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "striping_unit", std::to_string(align).c_str());
+    MPI_Info_set(info, "romio_cb_write", "enable");
+    std::string fname = subfile(name, version, group);
+    MPI_File fh;
+    int ret = MPI_File_open(comm_group, fname.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, info, &fh);
+    MPI_Info_free(&info);
+    TRACE_IO(IO_BEGIN, "subfile", total);
+    if (ret != MPI_SUCCESS) {
+	ERROR("cannot open subfile " << fname);
+	error = 1;
+    } else {
+	// a subfile left by an earlier attempt with more data must not keep its trailing bytes
+	if (MPI_File_set_size(fh, subfile_size) != MPI_SUCCESS) {
+	    ERROR("cannot truncate subfile " << fname);
+	    error = 1;
+	}
+	// every member takes part in every round (possibly with no data), as required by the collective writes
+	std::vector<char> buf(chunk_size);
+	for (uint64_t r = 0; r < max_rounds; r++) {
+	    uint64_t start = r * chunk_size, len = start < total ? std::min(chunk_size, total - start) : 0;
+	    memset(buf.data(), 0, len);
+	    for (size_t i = 0; i < fds.size(); i++) {
+		uint64_t from = std::max(start, offsets[i]), to = std::min(start + len, offsets[i] + sizes[i]);
+		if (from < to && fds[i] != -1 &&
+		    pread(fds[i], buf.data() + from - start, to - from, from - offsets[i]) != (ssize_t)(to - from)) {
+		    ERROR("cannot read " << cmds[i].filename(scratch) << " for subfiling, error = " << std::strerror(errno));
+		    error = 1;
+		}
+	    }
+	    MPI_Status status;
+	    if (MPI_File_write_at_all(fh, base + start, buf.data(), len, MPI_BYTE, &status) != MPI_SUCCESS)
+		error = 1;
+	}
+	MPI_File_close(&fh);
+    }
+    TRACE_IO(IO_END, "subfile", error ? 0 : total);
+    for (auto fd : fds)
+	if (fd != -1)
+	    close(fd);
+
+    // the index is written by the first backend once all subfiles are complete
+    std::ostringstream entries;
+    for (size_t i = 0; i < cmds.size(); i++)
+	entries << cmds[i].unique_id << " " << group << " " << base + offsets[i] << " " << sizes[i] << "\n";
+    std::string index = gather_to_root(entries.str(), comm);
+    int global_error;
+    MPI_Allreduce(&error, &global_error, 1, MPI_INT, MPI_LOR, comm);
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (rank == 0 && !global_error) {
+	std::string iname = index_file(name, version), tmp = iname + ".tmp";
+	std::ofstream f(tmp);
+	f << "# veloc subfile index v1 " << groups << "\n" << index;
+	f.close();
+	if (!f || rename(tmp.c_str(), iname.c_str()) != 0) {
+	    ERROR("cannot write subfile index " << iname);
+	    global_error = 1;
+	}
+    }
+    MPI_Bcast(&global_error, 1, MPI_INT, 0, comm);
+    return global_error ? VELOC_FAILURE : VELOC_SUCCESS;
+}
+
+int subfile_module_t::restore(const std::vector<command_t> &cmds) {
+    std::string scratch = cfg.get_scratch(), name = cmds[0].name;
+    int version = cmds[0].version, rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // the index is read once and broadcast, instead of having every backend open it
+    std::string content;
+    if (rank == 0) {
+	std::ifstream f(index_file(name, version));
+	std::stringstream ss;
+	ss << f.rdbuf();
+	content = ss.str();
+    }
+    content = bcast_from_root(content, comm);
+    std::map<int, subfile_entry_t> index;
+    std::istringstream in(content);
+    std::string line;
+    while (std::getline(in, line)) {
+	int id;
+	subfile_entry_t e;
+	if (line.size() > 0 && line[0] != '#' &&
+	    sscanf(line.c_str(), "%d %d %" SCNu64 " %" SCNu64, &id, &e.group, &e.offset, &e.size) == 4)
+	    index[id] = e;
+    }
+
+    int ret = VELOC_SUCCESS;
+    for (auto &c : cmds) {
+	std::string local = c.filename(scratch);
+	if (access(local.c_str(), R_OK) == 0)
+	    continue;
+	auto it = index.find(c.unique_id);
+	if (it == index.end()) {
+	    INFO("no subfile entry for " << c.stem());
+	    continue;
+	}
+	std::string fname = subfile(name, version, it->second.group);
+	int fi = open(fname.c_str(), O_RDONLY), fo = open(local.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	bool ok = fi != -1 && fo != -1;
+	if (!ok)
+	    ERROR("cannot restore " << local << " from subfile " << fname << ", error = " << std::strerror(errno));
+	else {
+	    std::vector<char> buf(std::min(chunk_size, std::max(it->second.size, (uint64_t)1)));
+	    for (uint64_t off = 0; off < it->second.size; off += buf.size()) {
+		size_t len = std::min((uint64_t)buf.size(), it->second.size - off);
+		if (pread(fi, buf.data(), len, it->second.offset + off) != (ssize_t)len ||
+		    pwrite(fo, buf.data(), len, off) != (ssize_t)len) {
+		    ERROR("cannot restore " << local << " from subfile " << fname << ", error = " << std::strerror(errno));
+		    ok = false;
+		    break;
+		}
+	    }
+	}
+	if (fi != -1)
+	    close(fi);
+	if (fo != -1)
+	    close(fo);
+	if (!ok) {
+	    unlink(local.c_str());
+	    ret = VELOC_FAILURE;
+	}
+    }
+    if (cfg.get_tuning().max_versions > 0) {
+	auto &version_history = checkpoint_history[name];
+	version_history.clear();
+	version_history.push_back(version);
+    }
+    return ret;
+}
@@ -0,0 +1,39 @@
+#ifndef __SUBFILE_MODULE_HPP
+#define __SUBFILE_MODULE_HPP
+
+#include "common/config.hpp"
+#include "common/command.hpp"
+
+#include <vector>
+#include <chrono>
+#include <deque>
+#include <map>
+
+#include <mpi.h>
+
+// N-to-M flush to the persistent storage: the backends are split into M groups (consecutive ranks), each of
+// which writes the local checkpoints of its clients into a single shared subfile per version using collective
+// MPI-IO. Every file starts at an aligned offset, so that it does not share stripes with its neighbours. A
+// global index (<name>.<version>.idx) records where each client's checkpoint lives.
+class subfile_module_t {
+    config_t cfg;
+    MPI_Comm comm, comm_group;
+    int group, groups;
+    size_t align, chunk_size;
+    std::chrono::system_clock::time_point last_timestamp;
+    std::map<std::string, std::deque<int> > checkpoint_history;
+
+    std::string subfile(const std::string &name, int version, int g) const;
+    std::string index_file(const std::string &name, int version) const;
+    int flush(const std::vector<command_t> &cmds);
+    int restore(const std::vector<command_t> &cmds);
+    void remove_version(const std::string &name, int version);
+public:
+    subfile_module_t(const config_t &c, MPI_Comm cm);
+    ~subfile_module_t();
+
+    int process_commands(const std::vector<command_t> &cmds);
+    int process_command(const command_t &cmd);
+};
+
+#endif //__SUBFILE_MODULE_HPP
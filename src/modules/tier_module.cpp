@@ -0,0 +1,74 @@
+#include "tier_module.hpp"
+
+#include "common/status.hpp"
+
+//#define __DEBUG
+#include "common/debug.hpp"
+
+tier_module_t::tier_module_t(const config_t &c) : tiers(c) {
+    for (auto &t : tiers.get_tiers())
+	INFO("storage tier " << t.name << " at " << t.path << ", capacity = " << (t.capacity >> 20)
+	     << " MB, bandwidth = " << t.bandwidth << " MB/s, max versions = " << t.max_versions);
+    migration_thread = std::thread([this]() { migrate_loop(); });
+}
+
+tier_module_t::~tier_module_t() {
+    std::unique_lock<std::mutex> lock(migration_mutex);
+    stopping = true;
+    migration_cond.notify_one();
+    lock.unlock();
+    migration_thread.join();
+}
+
+void tier_module_t::migrate_loop() {
+    std::unique_lock<std::mutex> lock(migration_mutex);
+    while (true) {
+	while (!pending && !stopping)
+	    migration_cond.wait(lock);
+	if (stopping)
+	    return;
+	pending = false;
+	lock.unlock();
+	tiers.rebalance();
+	lock.lock();
+    }
+}
+
+void tier_module_t::pin(const command_t &c) {
+    if (c.command == command_t::CHECKPOINT)
+	tiers.pin(c);
+}
+
+void tier_module_t::unpin(const command_t &c) {
+    if (c.command != command_t::CHECKPOINT)
+	return;
+    tiers.unpin(c);
+    // the version may have been kept beyond the retention or capacity of its tier
+    std::unique_lock<std::mutex> lock(migration_mutex);
+    pending = true;
+    migration_cond.notify_one();
+}
+
+int tier_module_t::process_command(const command_t &c) {
+    switch (c.command) {
+    case command_t::CHECKPOINT: {
+	std::unique_lock<std::mutex> lock(migration_mutex);
+	pending = true;
+	migration_cond.notify_one();
+	return VELOC_SUCCESS;
+    }
+
+    case command_t::TEST:
+	// TEST results are combined using max across modules, so "no version" is reported as VELOC_SUCCESS
+	return std::max(tiers.latest_version(c), (int)VELOC_SUCCESS);
+
+    case command_t::RESTART:
+	// the link in the scratch directory may be gone (e.g. scratch on tmpfs), the other modules need it
+	if (!tiers.relink(c))
+	    DBG("no copy of " << c.stem() << " on the local tiers");
+	return VELOC_SUCCESS;
+
+    default:
+	return VELOC_SUCCESS;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef __TIER_MODULE_HPP
+#define __TIER_MODULE_HPP
+
+#include "common/config.hpp"
+#include "common/command.hpp"
+#include "common/tiers.hpp"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// keeps the local tiers within their capacity and retention: every checkpoint wakes up a background thread
+// that moves older versions down the hierarchy. TEST and RESTART find the versions on any tier. The versions
+// accepted but not yet processed by all modules are pinned, so that no flush loses its source.
+class tier_module_t {
+    tier_set_t tiers;
+    std::thread migration_thread;
+    std::mutex migration_mutex;
+    std::condition_variable migration_cond;
+    bool pending = false, stopping = false;
+
+    void migrate_loop();
+public:
+    tier_module_t(const config_t &c);
+    ~tier_module_t();
+    int process_command(const command_t &c);
+    // a checkpoint was accepted / processed by all modules
+    void pin(const command_t &c);
+    void unpin(const command_t &c);
+};
+
+#endif // __TIER_MODULE_HPP
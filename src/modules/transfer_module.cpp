@@ -1,4 +1,5 @@
 #include "transfer_module.hpp"
+#include "flush_coordinator.hpp"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -11,43 +12,94 @@
 
 #include <cerrno>
 #include <cstring>
+#include <algorithm>
+#include <thread>
 
 #include "axl.h"
 
 #define __DEBUG
 #include "common/debug.hpp"
 
-static int posix_transfer_file(const std::string &source, const std::string &dest) {
+void transfer_module_t::pace(size_t bytes) {
+    // read for every chunk, so that a reload of the configuration applies to the flushes in progress
+    int bandwidth = cfg.get_tuning().flush_bandwidth;
+    if (bandwidth <= 0)
+	return;
+    std::unique_lock<std::mutex> lock(pace_mutex);
+    auto start = std::max(next_chunk, std::chrono::steady_clock::now());
+    next_chunk = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+	std::chrono::duration<double>((double)bytes / ((double)bandwidth * (1 << 20))));
+    lock.unlock();
+    std::this_thread::sleep_until(start);
+}
+
+int transfer_module_t::posix_transfer_file(const std::string &source, const std::string &dest, const cancel_t &cancelled) {
+    // copy into a hidden file next to the destination and rename it when complete, so that a torn copy never
+    // shows up as a checkpoint. With a journal, the copy resumes from the last chunk recorded as durable.
+    // The copy stops between two chunks once it is cancelled.
+    size_t slash = dest.rfind('/');
+    std::string tmp = dest.substr(0, slash + 1) + "." + dest.substr(slash + 1) + ".partial";
     int fi = open(source.c_str(), O_RDONLY);
     if (fi == -1) {
 	ERROR("cannot open source " << source << "; error = " << std::strerror(errno));
 	return VELOC_FAILURE;
     }
-    int fo = open(dest.c_str(), O_CREAT | O_WRONLY, 0644);
+    struct stat st, st_tmp;
+    fstat(fi, &st);
+    size_t size = st.st_size, offset = journal != NULL ? journal->get_offset(source, dest) : 0;
+    if (offset > size || stat(tmp.c_str(), &st_tmp) != 0 || (size_t)st_tmp.st_size < offset)
+	offset = 0;
+    else if (offset > 0)
+	INFO("resuming transfer of " << source << " to " << dest << " at offset " << offset);
+    int fo = open(tmp.c_str(), O_CREAT | O_WRONLY | (offset == 0 ? O_TRUNC : 0), 0644);
     if (fo == -1) {
 	close(fi);
-	ERROR("cannot open destination " << dest << "; error = " << std::strerror(errno));
+	ERROR("cannot open destination " << tmp << "; error = " << std::strerror(errno));
 	return VELOC_FAILURE;
     }
-    struct stat st;
-    stat(source.c_str(), &st);
-    size_t remaining = st.st_size;
-    while (remaining > 0) {
-	ssize_t transferred = sendfile(fo, fi, NULL, remaining);
-	if (transferred == -1) {
-	    close(fi);
+    bool success = lseek(fo, offset, SEEK_SET) == (off_t)offset;
+    while (success && offset < size) {
+	if (cancelled && cancelled()) {
 	    close(fo);
-	    ERROR("cannot copy " <<  source << " to " << dest << "; error = " << std::strerror(errno));
-	    return VELOC_FAILURE;
-	} else
-	    remaining -= transferred;
+	    close(fi);
+	    unlink(tmp.c_str());
+	    if (journal != NULL)
+		journal->finished(dest);
+	    INFO("transfer of " << source << " to " << dest << " cancelled at offset " << offset);
+	    return VELOC_SUCCESS;
+	}
+	size_t len = std::min(chunk_size, size - offset);
+	pace(len);
+	off_t in_offset = offset;
+	for (size_t remaining = len; success && remaining > 0; ) {
+	    ssize_t transferred = sendfile(fo, fi, &in_offset, remaining);
+	    if (transferred <= 0)
+		success = false;
+	    else
+		remaining -= transferred;
+	}
+	if (success && journal != NULL) {
+	    success = fdatasync(fo) == 0;
+	    if (success)
+		journal->progress(source, dest, offset + len);
+	}
+	offset += len;
     }
+    if (ftruncate(fo, size) != 0 || close(fo) != 0)
+	success = false;
     close(fi);
-    close(fo);
+    if (success && rename(tmp.c_str(), dest.c_str()) != 0)
+	success = false;
+    if (!success) {
+	ERROR("cannot copy " <<  source << " to " << dest << "; error = " << std::strerror(errno));
+	return VELOC_FAILURE;
+    }
+    if (journal != NULL)
+	journal->finished(dest);
     return VELOC_SUCCESS;
 }
 
-transfer_module_t::transfer_module_t(const config_t &c) : cfg(c), axl_type(AXL_XFER_NULL) {
+transfer_module_t::transfer_module_t(const config_t &c) : cfg(c), store(c), axl_type(AXL_XFER_NULL) {
     std::string axl_config, axl_type_str;
 
     std::map<std::string, axl_xfer_t> axl_type_strs = {
@@ -59,12 +111,13 @@ transfer_module_t::transfer_module_t(const config_t &c) : cfg(c), axl_type(AXL_X
         {"AXL_XFER_ASYNC_CPPR", AXL_XFER_ASYNC_CPPR},
     };
 
-    if (!cfg.get_optional("persistent_interval", interval)) {
+    int interval;
+    if (!cfg.get_optional("persistent_interval", interval))
 	INFO("Persistence interval not specified, every checkpoint will be persisted");
-	interval = 0;
-    }
-    if (!cfg.get_optional("max_versions", max_versions))
-	max_versions = 0;
+    int subfiles;
+    subfiling = cfg.get_optional("subfile_count", subfiles) && subfiles > 0;
+    int chunk;
+    chunk_size = cfg.get_optional("transfer_chunk_size", chunk) && chunk > 0 ? chunk : 64 << 20;
 
     /* Did the user specify an axl_type in the config file? */
     if (cfg.get_optional("axl_type", axl_type_str)) {
@@ -120,14 +173,70 @@ static int axl_transfer_file(axl_xfer_t type, const std::string &source, const s
     return VELOC_SUCCESS;
 }
 
-int transfer_module_t::transfer_file(const std::string &source, const std::string &dest) {
+int transfer_module_t::transfer_file(const std::string &source, const std::string &dest, const cancel_t &cancelled) {
+    struct stat st;
+    uint64_t size = stat(source.c_str(), &st) == 0 ? st.st_size : 0;
+    int ret;
+    TRACE_IO(IO_BEGIN, "transfer", size);
     if (use_axl)
-	return axl_transfer_file(axl_type, source, dest);
+	ret = axl_transfer_file(axl_type, source, dest);
     else
-	return posix_transfer_file(source, dest);
+	ret = posix_transfer_file(source, dest, cancelled);
+    TRACE_IO(IO_END, "transfer", ret == VELOC_SUCCESS ? size : 0);
+    return ret;
+}
+
+void transfer_module_t::announce(const command_t &c) {
+    if (c.command != command_t::CHECKPOINT || (c.flags & command_t::NO_PERSISTENT))
+	return;
+    std::unique_lock<std::mutex> lock(unflushed_mutex);
+    auto &versions = unflushed[std::make_pair(c.unique_id, c.name)];
+    versions.insert(c.version);
+    // only the newest versions can supersede the pending ones
+    while (versions.size() > MAX_ANNOUNCED)
+	versions.erase(versions.begin());
+}
+
+bool transfer_module_t::superseded(const command_t &c, int max_versions) {
+    // with max_versions, a version followed by as many newer ones would be removed right after its flush. The newer
+    // ones count even if already flushed, since they finished first.
+    if (max_versions <= 0)
+	return false;
+    std::unique_lock<std::mutex> lock(unflushed_mutex);
+    auto it = unflushed.find(std::make_pair(c.unique_id, c.name));
+    if (it == unflushed.end())
+	return false;
+    return std::distance(it->second.upper_bound(c.version), it->second.end()) >= max_versions;
 }
 
-static int get_latest_version(const std::string &p, const command_t &c) {
+void transfer_module_t::forget(const command_t &c) {
+    std::unique_lock<std::mutex> lock(unflushed_mutex);
+    auto it = unflushed.find(std::make_pair(c.unique_id, c.name));
+    if (it == unflushed.end())
+	return;
+    it->second.erase(c.version);
+    if (it->second.empty())
+	unflushed.erase(it);
+}
+
+void transfer_module_t::remove_version(const command_t &c, int version) {
+    std::string remote = c.filename(cfg.get_persistent(), version);
+    unlink(remote.c_str());
+    store.remove(chunk_store_t::manifest_name(remote));
+}
+
+int transfer_module_t::push_version(const command_t &c, int max_versions) {
+    std::unique_lock<std::mutex> lock(history_mutex);
+    auto &version_history = checkpoint_history[c.unique_id][c.name];
+    version_history.push_back(c.version);
+    if ((int)version_history.size() <= max_versions)
+	return -1;
+    int oldest = version_history.front();
+    version_history.pop_front();
+    return oldest;
+}
+
+int get_latest_version(const std::string &p, const command_t &c) {
     struct dirent *dentry;
     DIR *dir;
     int id, version, ret = -1;
@@ -149,56 +258,150 @@ static int get_latest_version(const std::string &p, const command_t &c) {
     return ret;
 }
 
+// holds a token of the flush coordinator, if any, for the lifetime of a flush
+class flush_token_t {
+    flush_coordinator_t *coordinator;
+    bool held = false;
+public:
+    flush_token_t(flush_coordinator_t *fc) : coordinator(fc) {
+	resume();
+    }
+    ~flush_token_t() {
+	suspend();
+    }
+    // a paused flush lets the other backends use its token in the meantime
+    void suspend() {
+	if (coordinator != NULL && held)
+	    coordinator->release();
+	held = false;
+    }
+    void resume() {
+	if (coordinator != NULL && !held)
+	    coordinator->acquire();
+	held = true;
+    }
+};
+
+int transfer_module_t::flush(const command_t &c, const std::string &local, const std::string &remote,
+			      int interval, int max_versions) {
+    struct stat st;
+    size_t size = stat(local.c_str(), &st) == 0 ? st.st_size : 0;
+    bytes_written += size;
+    // streamed checkpoints are already on the persistent storage, only the old versions need to be removed
+    if (cfg.is_streamed(c.name) && c.original.empty()) {
+	int oldest = max_versions > 0 ? push_version(c, max_versions) : -1;
+	if (oldest >= 0)
+	    remove_version(c, oldest);
+	if (stat(remote.c_str(), &st) == 0)
+	    bytes_flushed += st.st_size;
+	return VELOC_SUCCESS;
+    }
+    // with subfiling, checkpoints with default names are flushed collectively by the subfile module
+    if (interval < 0 || (subfiling && c.original.empty()))
+	return VELOC_SUCCESS;
+    // the queue was full when this version arrived, it stays on scratch only
+    if (c.flags & command_t::NO_PERSISTENT) {
+	DBG("flush of " << local << " skipped under backpressure");
+	return VELOC_SUCCESS;
+    }
+    // with a persistence interval, the newer versions may not be flushed at all
+    bool coalesce = interval == 0 && c.original.empty() && !store.enabled();
+    if (coalesce && superseded(c, max_versions)) {
+	INFO("flush of " << local << " cancelled, superseded by newer versions");
+	bytes_superseded += size;
+	return VELOC_SUCCESS;
+    }
+    if (interval > 0) {
+	std::unique_lock<std::mutex> lock(history_mutex);
+	auto t = std::chrono::system_clock::now();
+	if (t < last_timestamp[c.unique_id])
+	    return VELOC_SUCCESS;
+	else
+	    last_timestamp[c.unique_id] = t + std::chrono::seconds(interval);
+    }
+    // remove old versions if needed
+    int oldest = max_versions > 0 ? push_version(c, max_versions) : -1;
+    if (oldest >= 0)
+	remove_version(c, oldest);
+    // the restart is over, the chunks fetched for it are no longer needed
+    store.clear_cache();
+    DBG("transfer file " << local << " to " << remote);
+    flush_token_t token(coordinator);
+    auto pause = [&]() {
+	if (gate != NULL && gate->closed()) {
+	    token.suspend();
+	    gate->pause();
+	    token.resume();
+	}
+    };
+    if (c.original[0] == 0) {
+	if (store.enabled()) {
+	    if (store.flush(local, chunk_store_t::manifest_name(remote)) == VELOC_FAILURE)
+	        return VELOC_FAILURE;
+	    // a full copy left by an earlier flush of the same version would shadow the manifest
+	    unlink(remote.c_str());
+	} else {
+	    bool cancelled = false;
+	    auto check = [&]() {
+		pause();
+		return cancelled = coalesce && superseded(c, max_versions);
+	    };
+	    if (transfer_file(local, remote, check) == VELOC_FAILURE)
+	        return VELOC_FAILURE;
+	    if (cancelled) {
+	        bytes_superseded += size;
+	        return VELOC_SUCCESS;
+	    }
+	}
+	bytes_flushed += size;
+	return VELOC_SUCCESS;
+    } else {
+	// at this point, we in file-based mode with custom file names
+	auto check = [&]() {
+	    pause();
+	    return false;
+	};
+	if (transfer_file(local, c.original, check) == VELOC_FAILURE)
+	    return VELOC_FAILURE;
+	bytes_flushed += size;
+	unlink(remote.c_str());
+	if (symlink(c.original.c_str(), remote.c_str()) != 0) {
+	    ERROR("cannot create symlink " << remote.c_str() << " pointing at " << c.original << ", error: " << std::strerror(errno));
+	    return VELOC_FAILURE;
+	} else
+	    return VELOC_SUCCESS;	
+    }
+}
+
 int transfer_module_t::process_command(const command_t &c) {
-    std::string local = c.filename(cfg.get("scratch")),
-	remote = c.filename(cfg.get("persistent"));
+    std::string local = c.filename(cfg.get_scratch()),
+	remote = c.filename(cfg.get_persistent());
+    tuning_t tuning = cfg.get_tuning();
+    int interval = tuning.persistent_interval, max_versions = tuning.max_versions;
 
     switch (c.command) {
     case command_t::INIT:
 	if (interval < 0)
 	    return VELOC_SUCCESS;
-	last_timestamp[c.unique_id] = std::chrono::system_clock::now() + std::chrono::seconds(interval);
+	{
+	    std::unique_lock<std::mutex> lock(history_mutex);
+	    last_timestamp[c.unique_id] = std::chrono::system_clock::now() + std::chrono::seconds(interval);
+	}
 	return VELOC_SUCCESS;
 	
     case command_t::TEST:
 	DBG("obtain latest version for " << c.name);
-	return std::max(get_latest_version(cfg.get("scratch"), c),
-			get_latest_version(cfg.get("persistent"), c));
-	
-    case command_t::CHECKPOINT:
-	if (interval < 0) 
-	    return VELOC_SUCCESS;
-	if (interval > 0) {
-	    auto t = std::chrono::system_clock::now();
-	    if (t < last_timestamp[c.unique_id])
-		return VELOC_SUCCESS;
-	    else
-		last_timestamp[c.unique_id] = t + std::chrono::seconds(interval);
-	}
-	// remove old versions if needed
-	if (max_versions > 0) {
-	    auto &version_history = checkpoint_history[c.unique_id][c.name];
-	    version_history.push_back(c.version);
-	    if ((int)version_history.size() > max_versions) {
-		unlink(c.filename(cfg.get("persistent"), version_history.front()).c_str());
-		version_history.pop_front();
-	    }
-	}
-	DBG("transfer file " << local << " to " << remote);
-	if (c.original[0] == 0)
-	    return transfer_file(local, remote);
-	else {
-	    // at this point, we in file-based mode with custom file names
-	    if (transfer_file(local, c.original) == VELOC_FAILURE)
-		return VELOC_FAILURE;
-	    unlink(remote.c_str());
-	    if (symlink(c.original.c_str(), remote.c_str()) != 0) {
-		ERROR("cannot create symlink " << remote.c_str() << " pointing at " << c.original << ", error: " << std::strerror(errno));
-		return VELOC_FAILURE;
-	    } else
-		return VELOC_SUCCESS;	
-	}
+	return std::max(get_latest_version(cfg.get_scratch(), c),
+			get_latest_version(cfg.get_persistent(), c));
 	
+    case command_t::CHECKPOINT: {
+	int ret = flush(c, local, remote, interval, max_versions);
+	// a failed version does not stand in for the older ones
+	if (ret != VELOC_SUCCESS)
+	    forget(c);
+	return ret;
+    }
+
     case command_t::RESTART:
 	if (interval < 0)
 	    return VELOC_SUCCESS;
@@ -207,18 +410,44 @@ int transfer_module_t::process_command(const command_t &c) {
 	    INFO("request to transfer file " << remote << " to " << local << " ignored as destination already exists");
 	    return VELOC_SUCCESS;
 	}
-	if (access(remote.c_str(), R_OK) != 0) {
-	    ERROR("request to transfer file " << remote << " to " << local << " failed: source does not exist");
-	    return VELOC_FAILURE;
-	}
 	if (max_versions > 0) {
+	    std::unique_lock<std::mutex> lock(history_mutex);
 	    auto &version_history = checkpoint_history[c.unique_id][c.name];
 	    version_history.clear();
 	    version_history.push_back(c.version);
 	}
+	// deduplicated checkpoints are assembled from their chunks, even if deduplication was turned off since
+	if (access(remote.c_str(), R_OK) != 0 && access(chunk_store_t::manifest_name(remote).c_str(), R_OK) == 0)
+	    return store.restore(chunk_store_t::manifest_name(remote), local);
+	if (access(remote.c_str(), R_OK) != 0) {
+	    ERROR("request to transfer file " << remote << " to " << local << " failed: source does not exist");
+	    return VELOC_FAILURE;
+	}
 	return transfer_file(remote, local);
 	
     default:
 	return VELOC_SUCCESS;
     }
 }
+
+void transfer_module_t::resume(journal_t *j) {
+    journal = j;
+    if (journal == NULL)
+	return;
+    // flushes that were in progress when the previous backend stopped
+    for (auto &t : journal->get_transfers())
+	if (access(t.second.source.c_str(), R_OK) == 0)
+	    transfer_file(t.second.source, t.first);
+	else
+	    journal->finished(t.first);
+    // checkpoints that were accepted, but never completed
+    for (auto &c : journal->get_pending()) {
+	if (c.command == command_t::CHECKPOINT && access(c.filename(cfg.get_scratch()).c_str(), R_OK) == 0 &&
+	    access(c.filename(cfg.get_persistent()).c_str(), F_OK) != 0 &&
+	    access(chunk_store_t::manifest_name(c.filename(cfg.get_persistent())).c_str(), F_OK) != 0) {
+	    INFO("flushing " << c.stem() << ", accepted by the previous backend");
+	    process_command(c);
+	}
+	journal->completed(c);
+    }
+}
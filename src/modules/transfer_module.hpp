@@ -4,27 +4,87 @@
 #include "common/config.hpp"
 #include "common/command.hpp"
 #include "common/status.hpp"
+#include "common/journal.hpp"
+#include "common/chunk_store.hpp"
+#include "common/priority_gate.hpp"
 
 #include <chrono>
 #include <deque>
 #include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <functional>
 
 #include "axl.h"
 
+class flush_coordinator_t;
+
+// latest version of the checkpoint of c (up to c.version, if set) available in directory p, -1 if none
+int get_latest_version(const std::string &p, const command_t &c);
+
 class transfer_module_t {
     const config_t &cfg;
-    bool use_axl = false;
+    bool use_axl = false, subfiling = false;
+    size_t chunk_size;
+    journal_t *journal = NULL;
+    priority_gate_t *gate = NULL;
+    flush_coordinator_t *coordinator = NULL;
+    chunk_store_t store;
     axl_xfer_t axl_type;
-    int interval, max_versions;
+    // the flushes of different clients run concurrently
+    std::mutex history_mutex;
     std::map<int, std::chrono::system_clock::time_point> last_timestamp;
     typedef std::map<std::string, std::deque<int> > checkpoint_history_t;
     std::map<int, checkpoint_history_t> checkpoint_history;
+    std::atomic<uint64_t> bytes_written{0}, bytes_flushed{0}, bytes_superseded{0};
+    // the chunks of all the flushes take turns at flush_bandwidth, each one starts no earlier than this
+    std::mutex pace_mutex;
+    std::chrono::steady_clock::time_point next_chunk;
+    // newest versions of each checkpoint (by client and name) accepted by the backend, minus the failed ones
+    static const size_t MAX_ANNOUNCED = 64;
+    std::mutex unflushed_mutex;
+    std::map<std::pair<int, std::string>, std::set<int> > unflushed;
 
-    int transfer_file(const std::string &source, const std::string &dest);
+    // called between two chunks of a copy, which stops if it returns true
+    typedef std::function<bool ()> cancel_t;
+    int transfer_file(const std::string &source, const std::string &dest, const cancel_t &cancelled = nullptr);
+    int posix_transfer_file(const std::string &source, const std::string &dest, const cancel_t &cancelled);
+    void pace(size_t bytes);
+    void remove_version(const command_t &c, int version);
+    // adds the version of c to the history of its checkpoint, returns the version that falls out of it or -1
+    int push_version(const command_t &c, int max_versions);
+    bool superseded(const command_t &c, int max_versions);
+    void forget(const command_t &c);
+    int flush(const command_t &c, const std::string &local, const std::string &remote, int interval, int max_versions);
 public:
     transfer_module_t(const config_t &c);
     ~transfer_module_t();
     int process_command(const command_t &c);
+    // a checkpoint request was accepted: older versions that would not be retained need not be flushed anymore
+    void announce(const command_t &c);
+    // records the progress of the flushes in the journal, after finishing those left by a previous backend
+    void resume(journal_t *j);
+    // the flushes pause at the chunk boundaries while the gate is taken by interactive commands
+    void set_gate(priority_gate_t *g) {
+	gate = g;
+    }
+    // the flushes wait for a token of the coordinator, which caps the number of backends flushing at once
+    void set_coordinator(flush_coordinator_t *fc) {
+	coordinator = fc;
+    }
+    uint64_t get_bytes_written() const {
+	return bytes_written;
+    }
+    uint64_t get_bytes_flushed() const {
+	return bytes_flushed;
+    }
+    uint64_t get_bytes_superseded() const {
+	return bytes_superseded;
+    }
+    uint64_t get_bytes_deduplicated() const {
+	return store.get_bytes_deduplicated();
+    }
 };
 
 #endif //__TRANSFER_MODULE_HPP
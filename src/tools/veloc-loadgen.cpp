@@ -0,0 +1,264 @@
+#include "common/config.hpp"
+#include "common/command.hpp"
+#include "common/command_log.hpp"
+#include "common/status.hpp"
+
+#include <thallium.hpp>
+#include <thallium/serialization/stl/string.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <random>
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace tl = thallium;
+
+typedef std::chrono::steady_clock gen_clock_t;
+
+static const char *COMMAND_NAMES[] = {"INIT", "CHECKPOINT", "RESTART", "TEST"};
+
+struct options_t {
+    std::string address = "tcp://127.0.0.1:1234", pattern = "burst", replay, output, name = "loadgen";
+    uint16_t provider_id = 22;
+    int clients = 16, checkpoints = 10, interval = 1000, id_base = 0;
+    size_t size = 1 << 20, size_max = 0;
+    double speed = 1.0;
+    bool keep = false;
+};
+
+// drives the backend RPCs the same way veloc_client_t does in async mode
+class emulated_client_t {
+    tl::remote_procedure &enqueue, &wait_completion, &init;
+    tl::provider_handle &ph;
+    const std::string &scratch;
+public:
+    int id;
+    std::vector<double> latency[4];
+    size_t bytes = 0;
+    std::vector<command_t> created;
+
+    emulated_client_t(tl::remote_procedure &eq, tl::remote_procedure &wc, tl::remote_procedure &in,
+		      tl::provider_handle &p, const std::string &s, int i) :
+	enqueue(eq), wait_completion(wc), init(in), ph(p), scratch(s), id(i) { }
+
+    void connect() {
+	init.on(ph)(std::to_string(id));
+    }
+    bool write_scratch(const command_t &c, size_t size) {
+	static const std::vector<char> buffer(1 << 20, 0);
+	int fd = open(c.filename(scratch).c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	if (fd == -1)
+	    return false;
+	for (size_t written = 0; written < size; written += buffer.size())
+	    if (write(fd, buffer.data(), std::min(buffer.size(), size - written)) == -1) {
+		close(fd);
+		return false;
+	    }
+	close(fd);
+	bytes += size;
+	created.push_back(c);
+	return true;
+    }
+    // enqueues the command and waits for the backend to complete it, measuring the end-to-end latency
+    int run(const command_t &c) {
+	auto start = gen_clock_t::now();
+	enqueue.on(ph)(c);
+	int ret = wait_completion.on(ph)(std::to_string(id), true);
+	if (c.command >= 0 && c.command < 4)
+	    latency[c.command].push_back(std::chrono::duration<double, std::micro>(gen_clock_t::now() - start).count());
+	return ret;
+    }
+};
+
+static void synthetic_client(emulated_client_t &client, const options_t &opt, gen_clock_t::time_point start) {
+    std::mt19937_64 rng(client.id);
+    std::uniform_int_distribution<size_t> size_dist(opt.size, std::max(opt.size, opt.size_max));
+    std::uniform_int_distribution<int> jitter(0, std::max(opt.interval - 1, 0));
+    int n = std::max(opt.clients, 1);
+
+    client.connect();
+    client.run(command_t(client.id, command_t::INIT, 0, ""));
+    client.run(command_t(client.id, command_t::TEST, 0, opt.name));
+    for (int k = 1; k <= opt.checkpoints; k++) {
+	int offset = 0;
+	if (opt.pattern == "staggered")
+	    offset = (client.id - opt.id_base) * opt.interval / n;
+	else if (opt.pattern == "random")
+	    offset = jitter(rng);
+	std::this_thread::sleep_until(start + std::chrono::milliseconds((k - 1) * opt.interval + offset));
+	command_t c(client.id, command_t::CHECKPOINT, k, opt.name);
+	if (!client.write_scratch(c, size_dist(rng))) {
+	    std::cerr << "client " << client.id << ": cannot write scratch file " << c.stem() << std::endl;
+	    return;
+	}
+	if (client.run(c) != VELOC_SUCCESS)
+	    std::cerr << "client " << client.id << ": checkpoint " << c.stem() << " failed" << std::endl;
+    }
+}
+
+static void replay_client(emulated_client_t &client, const std::vector<command_record_t> &records,
+			  const options_t &opt, gen_clock_t::time_point start) {
+    client.connect();
+    for (auto &r : records) {
+	if (opt.speed > 0)
+	    std::this_thread::sleep_until(start + std::chrono::microseconds((uint64_t)(r.ts / opt.speed)));
+	command_t c = r.cmd;
+	c.unique_id = client.id;
+	if (c.command == command_t::CHECKPOINT && !client.write_scratch(c, r.size)) {
+	    std::cerr << "client " << client.id << ": cannot write scratch file " << c.stem() << std::endl;
+	    return;
+	}
+	client.run(c);
+    }
+}
+
+static void report(std::ostream &out, std::vector<emulated_client_t> &clients, double duration) {
+    size_t bytes = 0;
+    for (auto &c : clients)
+	bytes += c.bytes;
+    out << "{\n  \"clients\": " << clients.size() << ",\n  \"duration_s\": " << duration
+	<< ",\n  \"checkpoint_mb_s\": " << bytes / duration / 1e6 << ",\n  \"latency_us\": {";
+    bool first = true;
+    for (int cmd = 0; cmd < 4; cmd++) {
+	std::vector<double> all;
+	for (auto &c : clients)
+	    all.insert(all.end(), c.latency[cmd].begin(), c.latency[cmd].end());
+	if (all.empty())
+	    continue;
+	std::sort(all.begin(), all.end());
+	double mean = 0;
+	for (auto l : all)
+	    mean += l;
+	mean /= all.size();
+	auto p = [&all](double q) { return all[std::min(all.size() - 1, (size_t)(q * all.size()))]; };
+	out << (first ? "\n" : ",\n") << "    \"" << COMMAND_NAMES[cmd] << "\": {\"count\": " << all.size()
+	    << ", \"mean\": " << mean << ", \"p50\": " << p(0.5) << ", \"p90\": " << p(0.9)
+	    << ", \"p99\": " << p(0.99) << ", \"max\": " << all.back() << "}";
+	first = false;
+    }
+    out << "\n  }\n}" << std::endl;
+}
+
+static void usage(const char *prog) {
+    std::cout << "Usage: " << prog << " <veloc_config> [options]" << std::endl
+	      << "  -n <clients>            number of emulated clients (default: 16)" << std::endl
+	      << "  -c <checkpoints>        checkpoints per client (default: 10)" << std::endl
+	      << "  -i <interval_ms>        time between checkpoints (default: 1000)" << std::endl
+	      << "  -s <bytes>              checkpoint size (default: 1 MiB)" << std::endl
+	      << "  -S <bytes>              maximum checkpoint size, sizes are random in [-s, -S]" << std::endl
+	      << "  -p burst|staggered|random  arrival pattern of checkpoints (default: burst)" << std::endl
+	      << "  -r <command_log>        replay a log recorded by the backend (record_commands option)" << std::endl
+	      << "  -x <factor>             replay speedup, 0 replays as fast as possible (default: 1)" << std::endl
+	      << "  -b <id>                 unique id of the first emulated client (default: 0)" << std::endl
+	      << "  -a <address>            backend address (default: tcp://127.0.0.1:1234)" << std::endl
+	      << "  -o <file>               write the JSON report to a file instead of stdout" << std::endl
+	      << "  -k                      keep the generated checkpoint files" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    options_t opt;
+    if (argc < 2) {
+	usage(argv[0]);
+	return 1;
+    }
+    for (int i = 2; i < argc; i++) {
+	std::string arg = argv[i];
+	bool has_value = i + 1 < argc;
+	if (arg == "-k")
+	    opt.keep = true;
+	else if (!has_value) {
+	    usage(argv[0]);
+	    return 1;
+	} else if (arg == "-n")
+	    opt.clients = atoi(argv[++i]);
+	else if (arg == "-c")
+	    opt.checkpoints = atoi(argv[++i]);
+	else if (arg == "-i")
+	    opt.interval = atoi(argv[++i]);
+	else if (arg == "-s")
+	    opt.size = strtoull(argv[++i], NULL, 10);
+	else if (arg == "-S")
+	    opt.size_max = strtoull(argv[++i], NULL, 10);
+	else if (arg == "-p")
+	    opt.pattern = argv[++i];
+	else if (arg == "-r")
+	    opt.replay = argv[++i];
+	else if (arg == "-x")
+	    opt.speed = atof(argv[++i]);
+	else if (arg == "-b")
+	    opt.id_base = atoi(argv[++i]);
+	else if (arg == "-a")
+	    opt.address = argv[++i];
+	else if (arg == "-o")
+	    opt.output = argv[++i];
+	else {
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+    if (opt.pattern != "burst" && opt.pattern != "staggered" && opt.pattern != "random") {
+	std::cerr << "unknown pattern " << opt.pattern << std::endl;
+	return 1;
+    }
+
+    try {
+	config_t cfg(argv[1]);
+	std::string scratch = cfg.get_scratch(), persistent = cfg.get_persistent();
+	std::map<int, std::vector<command_record_t> > streams;
+	if (!opt.replay.empty()) {
+	    for (auto &r : command_log_t::load(opt.replay))
+		streams[r.cmd.unique_id].push_back(r);
+	    opt.clients = streams.size();
+	}
+
+	tl::engine engine(opt.address.substr(0, opt.address.find(':')), THALLIUM_CLIENT_MODE);
+	tl::remote_procedure enqueue = engine.define("enqueue").disable_response();
+	tl::remote_procedure wait_completion = engine.define("wait_completion");
+	tl::remote_procedure init = engine.define("init");
+	tl::provider_handle ph(engine.lookup(opt.address), opt.provider_id);
+
+	std::vector<emulated_client_t> clients;
+	clients.reserve(opt.clients);
+	for (int i = 0; i < opt.clients; i++)
+	    clients.emplace_back(enqueue, wait_completion, init, ph, scratch, opt.id_base + i);
+
+	std::vector<std::thread> threads;
+	auto start = gen_clock_t::now();
+	if (opt.replay.empty()) {
+	    for (auto &c : clients)
+		threads.emplace_back(synthetic_client, std::ref(c), std::cref(opt), start);
+	} else {
+	    auto it = streams.begin();
+	    for (auto &c : clients)
+		threads.emplace_back(replay_client, std::ref(c), std::cref((it++)->second), std::cref(opt), start);
+	}
+	for (auto &t : threads)
+	    t.join();
+	double duration = std::chrono::duration<double>(gen_clock_t::now() - start).count();
+
+	if (!opt.keep)
+	    for (auto &c : clients)
+		for (auto &cmd : c.created) {
+		    unlink(cmd.filename(scratch).c_str());
+		    unlink(cmd.filename(persistent).c_str());
+		}
+	if (opt.output.empty())
+	    report(std::cout, clients, duration);
+	else {
+	    std::ofstream f(opt.output);
+	    report(f, clients, duration);
+	}
+    } catch (std::exception &e) {
+	std::cerr << "load generator failed: " << e.what() << std::endl;
+	return 2;
+    }
+    return 0;
+}
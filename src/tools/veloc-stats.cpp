@@ -0,0 +1,89 @@
+#include "common/stats.hpp"
+
+#include <thallium.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+
+namespace tl = thallium;
+
+static const char *DEFAULT_ADDRESS = "tcp://127.0.0.1:1234";
+static const uint16_t DEFAULT_PROVIDER_ID = 22;
+
+static void print_stats(const backend_stats_t &s, const backend_stats_t *prev) {
+    double rate = s.commands_per_sec();
+    if (prev != NULL && s.uptime > prev->uptime)
+	rate = (s.completed - prev->completed) / (s.uptime - prev->uptime);
+    std::cout << "uptime: " << std::fixed << std::setprecision(1) << s.uptime << " s, "
+	      << "enqueued: " << s.enqueued << ", completed: " << s.completed
+	      << ", commands/s: " << std::setprecision(2) << rate << std::endl;
+    std::cout << "bytes written: " << s.bytes_written << ", bytes flushed: " << s.bytes_flushed
+	      << ", bytes deduplicated: " << s.bytes_deduplicated
+	      << ", bytes superseded: " << s.bytes_superseded << std::endl;
+    std::cout << "queues (client: pending/progress):";
+    for (auto &q : s.queues)
+	std::cout << " " << q.id << ": " << q.pending << "/" << q.progress;
+    std::cout << std::endl;
+    for (auto &h : s.modules) {
+	std::cout << "module " << h.name << ": count = " << h.count
+		  << ", avg = " << (h.count > 0 ? h.sum_us / h.count : 0) << " us"
+		  << ", p50 <= " << h.percentile(0.5) << " us"
+		  << ", p99 <= " << h.percentile(0.99) << " us"
+		  << ", max = " << h.max_us << " us" << std::endl;
+	for (unsigned int i = 0; i < h.buckets.size(); i++)
+	    if (h.buckets[i] > 0)
+		std::cout << "    [" << histogram_t::bucket_low(i) << ", "
+			  << histogram_t::bucket_low(i + 1) << ") us: " << h.buckets[i] << std::endl;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::string address = DEFAULT_ADDRESS;
+    uint16_t provider_id = DEFAULT_PROVIDER_ID;
+    int interval = 0;
+    bool reload = false;
+
+    for (int i = 1; i < argc; i++) {
+	if (!strcmp(argv[i], "-a") && i + 1 < argc)
+	    address = argv[++i];
+	else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+	    provider_id = atoi(argv[++i]);
+	else if (!strcmp(argv[i], "-i") && i + 1 < argc)
+	    interval = atoi(argv[++i]);
+	else if (!strcmp(argv[i], "-r"))
+	    reload = true;
+	else {
+	    std::cout << "Usage: " << argv[0] << " [-a <backend_address>] [-p <provider_id>] [-i <refresh_seconds>] [-r]" << std::endl;
+	    return 1;
+	}
+    }
+
+    try {
+	tl::engine engine(address.substr(0, address.find(':')), THALLIUM_CLIENT_MODE);
+	tl::remote_procedure get_stats = engine.define("get_stats");
+	tl::provider_handle ph(engine.lookup(address), provider_id);
+	if (reload) {
+	    // ask the backend to re-read the tuning parameters from its configuration file
+	    tl::remote_procedure reload_config = engine.define("reload_config");
+	    int ret = reload_config.on(ph)();
+	    std::cout << "config reload " << (ret == 0 ? "succeeded" : "failed, see backend log") << std::endl;
+	    return ret == 0 ? 0 : 3;
+	}
+	backend_stats_t prev = get_stats.on(ph)();
+	print_stats(prev, NULL);
+	while (interval > 0) {
+	    std::this_thread::sleep_for(std::chrono::seconds(interval));
+	    backend_stats_t s = get_stats.on(ph)();
+	    std::cout << std::endl;
+	    print_stats(s, &prev);
+	    prev = s;
+	}
+    } catch (std::exception &e) {
+	std::cerr << "cannot query backend at " << address << ": " << e.what() << std::endl;
+	return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "common/trace.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdio>
+
+using namespace veloc_trace;
+
+static const char *COMMAND_NAMES[] = {"INIT", "CHECKPOINT", "RESTART", "TEST"};
+static const char *LOG_LEVELS[] = {"DEBUG", "INFO", "ERROR"};
+
+static std::string command_name(int command) {
+    if (command >= 0 && command < (int)(sizeof(COMMAND_NAMES) / sizeof(COMMAND_NAMES[0])))
+	return COMMAND_NAMES[command];
+    return std::to_string(command);
+}
+
+static void print_event(std::ostream &out, const event_t &e, uint32_t pid, bool &first) {
+    static const char *phases[] = {"i", "i", "i", "B", "E", "B", "E", "X", "i"};
+    if (e.type > LOG)
+	return;
+    std::string label(e.label, strnlen(e.label, LABEL_SIZE));
+    char ts[32];
+    snprintf(ts, sizeof(ts), "%.3f", e.ts / 1000.0);
+
+    out << (first ? "\n" : ",\n");
+    first = false;
+    out << "{\"name\":\"" << label;
+    if (e.type <= COMPLETE)
+	out << " " << command_name(e.command);
+    if (e.type == LOG)
+	out << ":" << e.arg << " " << (e.command <= LOG_ERROR ? LOG_LEVELS[e.command] : "LOG");
+    out << "\",\"ph\":\"" << phases[e.type] << "\",\"ts\":" << ts
+	<< ",\"pid\":" << pid << ",\"tid\":" << e.tid;
+    if (e.type <= COMPLETE || e.type == LOG)
+	out << ",\"s\":\"t\"";
+    if (e.type == SPAN)
+	out << ",\"dur\":" << e.arg / 1000.0;
+    out << ",\"args\":{";
+    if (e.id >= 0)
+	out << "\"id\":" << e.id << ",\"version\":" << e.version << ",\"command\":\"" << command_name(e.command) << "\",";
+    switch (e.type) {
+    case COMPLETE:
+    case MODULE_END:
+	out << "\"status\":" << (int64_t)e.arg;
+	break;
+    case IO_BEGIN:
+    case IO_END:
+	out << "\"bytes\":" << e.arg;
+	break;
+    case LOG:
+	out << "\"line\":" << e.arg;
+	break;
+    default:
+	out << "\"arg\":" << e.arg;
+    }
+    out << "}}";
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+	std::cout << "Usage: " << argv[0] << " <trace_file> [<trace_file> ...] > trace.json" << std::endl
+		  << "Converts VeloC binary traces into the Chrome trace format (chrome://tracing, Perfetto)" << std::endl;
+	return 1;
+    }
+    bool first = true;
+    std::cout << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (int i = 1; i < argc; i++) {
+	std::ifstream f(argv[i], std::ifstream::binary);
+	file_header_t header;
+	if (!f.read((char *)&header, sizeof(header)) || header.magic != TRACE_MAGIC) {
+	    std::cerr << "skipping " << argv[i] << ": not a VeloC trace file" << std::endl;
+	    continue;
+	}
+	if (header.version != TRACE_VERSION || header.event_size != sizeof(event_t)) {
+	    std::cerr << "skipping " << argv[i] << ": unsupported trace version " << header.version << std::endl;
+	    continue;
+	}
+	event_t e;
+	while (f.read((char *)&e, sizeof(e)))
+	    print_event(std::cout, e, header.pid, first);
+    }
+    std::cout << "\n]}" << std::endl;
+    return 0;
+}
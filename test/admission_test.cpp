@@ -0,0 +1,114 @@
+// Admission test: a client engine sends checkpoint requests to the queue of a backend engine in the same process, on
+// the loopback interface, beyond the capacity of the queue. Checks each policy for full queues: block waits for room,
+// skip_persistent keeps the new request on scratch only, drop_oldest the oldest pending version of the same
+// checkpoint; at twice the capacity, every policy waits. Checks the global capacity shared by the clients as well.
+//
+//   admission_test
+
+#include "common/command.hpp"
+#include "common/ipc_queue.hpp"
+
+#include <iostream>
+#include <vector>
+#include <thread>
+
+static const uint16_t PROVIDER_ID = 23, CAPACITY = 2;
+static const std::chrono::milliseconds SETTLE(200);
+
+class client_t {
+    tl::remote_procedure init, enqueue_ordered, queue_depth;
+    tl::provider_handle ph;
+    int id;
+    uint64_t seq = 0;
+public:
+    client_t(tl::engine &e, const tl::provider_handle &p, int i) :
+	init(e.define("init")), enqueue_ordered(e.define("enqueue_ordered")), queue_depth(e.define("queue_depth")),
+	ph(p), id(i) {
+	init.on(ph)(std::to_string(id));
+    }
+    int send(int version, const std::string &name = "admission") {
+	return enqueue_ordered.on(ph)(command_t(id, command_t::CHECKPOINT, version, name), seq++);
+    }
+    int depth() {
+	return queue_depth.on(ph)(std::to_string(id));
+    }
+    tl::async_response post(int version, const std::string &name = "admission") {
+	return enqueue_ordered.on(ph).async(command_t(id, command_t::CHECKPOINT, version, name), seq++);
+    }
+};
+
+// dequeues and completes count requests, returns the versions that will not be flushed
+static std::vector<int> drain(veloc_ipc::shm_queue_t<command_t> &queue, int count) {
+    std::vector<int> skipped;
+    for (int i = 0; i < count; i++) {
+	command_t c;
+	auto f = queue.dequeue_any(c);
+	if (c.flags & command_t::NO_PERSISTENT)
+	    skipped.push_back(c.version);
+	f(VELOC_SUCCESS);
+    }
+    return skipped;
+}
+
+int main(int argc, char *argv[]) {
+    tl::engine backend("tcp://127.0.0.1", THALLIUM_SERVER_MODE, true, 4);
+    veloc_ipc::shm_queue_t<command_t> queue(backend, PROVIDER_ID);
+    tl::engine engine("tcp", THALLIUM_CLIENT_MODE, true);
+    tl::provider_handle ph(engine.lookup(std::string(backend.self())), PROVIDER_ID);
+    bool ok = true;
+
+    // block: the request beyond the capacity is queued once another one completes
+    {
+	queue.set_capacity(CAPACITY, 0, veloc_ipc::BLOCK_WHEN_FULL);
+	client_t client(engine, ph, 0);
+	ok &= client.send(0) == 1 && client.send(1) == 2;
+	auto r = client.post(2);
+	std::this_thread::sleep_for(SETTLE);
+	ok &= client.depth() == CAPACITY;
+	ok &= drain(queue, 1).empty();
+	ok &= (int)r.wait() == CAPACITY && drain(queue, 2).empty();
+    }
+
+    // skip_persistent: the requests beyond the capacity are flagged, the one at twice the capacity waits
+    {
+	queue.set_capacity(CAPACITY, 0, veloc_ipc::SKIP_PERSISTENT);
+	client_t client(engine, ph, 1);
+	ok &= client.send(0) == 1 && client.send(1) == 2 && client.send(2) == 3 && client.send(3) == 4;
+	auto r = client.post(4);
+	std::this_thread::sleep_for(SETTLE);
+	ok &= client.depth() == 2 * CAPACITY && drain(queue, 1).empty();
+	r.wait();
+	std::vector<int> skipped = drain(queue, 4);
+	if (skipped != std::vector<int>{2, 3, 4}) {
+	    std::cerr << "skip_persistent flagged " << skipped.size() << " requests, expected versions 2, 3 and 4" << std::endl;
+	    ok = false;
+	}
+    }
+
+    // drop_oldest: the oldest pending version of the same checkpoint is flagged, not the new one nor other checkpoints
+    {
+	queue.set_capacity(CAPACITY, 0, veloc_ipc::DROP_OLDEST);
+	client_t client(engine, ph, 2);
+	ok &= client.send(0, "other") == 1 && client.send(1) == 2 && client.send(2) == 3;
+	std::vector<int> skipped = drain(queue, 3);
+	if (skipped != std::vector<int>{1}) {
+	    std::cerr << "drop_oldest flagged " << skipped.size() << " requests, expected version 1" << std::endl;
+	    ok = false;
+	}
+    }
+
+    // global capacity: the requests of all clients count, a client under its own capacity waits as well
+    {
+	queue.set_capacity(0, CAPACITY, veloc_ipc::BLOCK_WHEN_FULL);
+	client_t first(engine, ph, 3), second(engine, ph, 4), third(engine, ph, 5);
+	ok &= first.send(0) == 1 && second.send(0) == 1;
+	auto r = third.post(0);
+	std::this_thread::sleep_for(SETTLE);
+	ok &= third.depth() == 0;
+	ok &= drain(queue, 1).empty();
+	ok &= (int)r.wait() == 1 && drain(queue, 2).empty();
+    }
+
+    std::cout << "admission test: " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
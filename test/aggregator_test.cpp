@@ -0,0 +1,99 @@
+// Aggregation test on a single machine: every MPI process is a backend with two emulated clients, one of which
+// skips some versions on some backends, so that the groups of those versions only proceed when their deadline
+// expires, at different times on different backends. The collective processing of a group checks that all backends
+// process the same group; at the end, all backends must have processed the same groups in the same order.
+//
+//   mpirun -np <n> aggregator_test
+
+#include "modules/client_aggregator.hpp"
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <vector>
+
+static const int CLIENTS_PER_BACKEND = 2, VERSIONS = 6, TIMEOUT = 1;
+
+int main(int argc, char *argv[]) {
+    int rank, ranks, provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    if (provided != MPI_THREAD_MULTIPLE) {
+	std::cerr << "MPI does not support MPI_THREAD_MULTIPLE" << std::endl;
+	MPI_Finalize();
+	return 1;
+    }
+
+    int ok = true;
+    // the (command, version) of every group processed, in order, by the agreement thread
+    std::mutex sequence_mutex;
+    std::vector<int> sequence;
+    bool matched = true;
+    {
+	client_aggregator_t agg(
+	    [&](const std::vector<command_t> &cmds) {
+		// a group processed by some backends only would make this collective call mismatch
+		int key[2] = {cmds[0].command * 1000 + cmds[0].version, -(cmds[0].command * 1000 + cmds[0].version)}, all[2];
+		MPI_Allreduce(key, all, 2, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+		std::unique_lock<std::mutex> lock(sequence_mutex);
+		if (all[0] != key[0] || all[1] != key[1]) {
+		    std::cerr << "backend " << rank << " processed version " << cmds[0].version << " while another one"
+			      << " processed a different group" << std::endl;
+		    matched = false;
+		}
+		sequence.push_back(key[0]);
+		return VELOC_SUCCESS;
+	    },
+	    [](const command_t &c) { return VELOC_SUCCESS; }, MPI_COMM_WORLD, TIMEOUT);
+	for (int i = 0; i < CLIENTS_PER_BACKEND; i++)
+	    agg.process_command(command_t(rank * CLIENTS_PER_BACKEND + i, command_t::INIT, 0, ""));
+
+	for (int v = 1; v <= VERSIONS; v++) {
+	    std::this_thread::sleep_for(std::chrono::milliseconds(50 * rank));
+	    for (int i = 0; i < CLIENTS_PER_BACKEND; i++) {
+		// the second client is a straggler for a different subset of the versions on every backend
+		if (i == 1 && (v + rank) % 3 == 0)
+		    continue;
+		command_t c(rank * CLIENTS_PER_BACKEND + i, command_t::CHECKPOINT, v, "aggregator_test");
+		ok &= agg.process_command(c) == VELOC_SUCCESS;
+	    }
+	}
+	// the groups left incomplete expire in the meantime
+	std::this_thread::sleep_for(std::chrono::seconds(2 * TIMEOUT));
+	// every backend restarts from the last version, the request that completes the group waits for its processing
+	for (int i = 0; i < CLIENTS_PER_BACKEND; i++) {
+	    command_t c(rank * CLIENTS_PER_BACKEND + i, command_t::RESTART, VERSIONS, "aggregator_test");
+	    ok &= agg.process_command(c) == VELOC_SUCCESS;
+	}
+	std::unique_lock<std::mutex> lock(sequence_mutex);
+	if (sequence.empty() || sequence.back() != command_t::RESTART * 1000 + VERSIONS) {
+	    std::cerr << "backend " << rank << " answered the restart before processing it" << std::endl;
+	    ok = false;
+	}
+    }
+    ok &= matched;
+
+    int count = sequence.size(), min_count, max_count;
+    MPI_Allreduce(&count, &min_count, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce(&count, &max_count, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (min_count != max_count) {
+	std::cerr << "backend " << rank << " processed " << count << " groups, others between " << min_count
+		  << " and " << max_count << std::endl;
+	ok = false;
+    } else {
+	std::vector<int> first(sequence);
+	MPI_Bcast(first.data(), count, MPI_INT, 0, MPI_COMM_WORLD);
+	ok &= first == sequence;
+    }
+    for (size_t i = 1; i < sequence.size(); i++)
+	ok &= sequence[i] > sequence[i - 1];
+
+    int all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    if (rank == 0)
+	std::cout << "aggregation test with " << ranks << " backends, " << count << " groups processed: "
+		  << (all_ok ? "passed" : "FAILED") << std::endl;
+    MPI_Finalize();
+    return all_ok ? 0 : 1;
+}
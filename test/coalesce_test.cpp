@@ -0,0 +1,87 @@
+// Coalescing test: with max_versions = 1, a client announces several versions of the same checkpoint before the
+// backend gets to flush them. Checks that only the newest version is flushed, that a flush interrupted by a newer
+// version leaves no partial file behind, and that every byte is accounted for as either flushed or superseded.
+//
+//   coalesce_test [<work_dir>]
+
+#include "modules/transfer_module.hpp"
+#include "common/status.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+static const size_t SMALL_SIZE = 4 << 20, LARGE_SIZE = 64 << 20;
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+static bool write_file(const std::string &f, size_t size, char fill) {
+    std::vector<char> buf(size, fill);
+    std::ofstream out(f, std::ios::binary);
+    out.write(buf.data(), buf.size());
+    return out.good();
+}
+
+static bool exists(const std::string &f) {
+    return access(f.c_str(), F_OK) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp/veloc-coalesce-test";
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    std::string scratch = dir + "/scratch", persistent = dir + "/persistent";
+    mkdir(dir.c_str(), 0755);
+    mkdir(scratch.c_str(), 0755);
+    mkdir(persistent.c_str(), 0755);
+    std::string cfg_file = dir + "/veloc.cfg";
+    {
+	std::ofstream f(cfg_file);
+	f << "scratch = " << scratch << "\npersistent = " << persistent << "\nmode = async\n"
+	  << "max_versions = 1\ntransfer_chunk_size = 4096\n";
+    }
+    config_t cfg(cfg_file);
+
+    bool ok = true;
+    {
+	transfer_module_t transfer(cfg);
+	std::vector<command_t> cmds;
+	for (int v = 1; v <= 6; v++) {
+	    cmds.push_back(command_t(0, command_t::CHECKPOINT, v, "coalesce"));
+	    ok &= write_file(cmds.back().filename(scratch), v == 5 ? LARGE_SIZE : SMALL_SIZE, 'a' + v);
+	}
+
+	// versions 1 to 3 are superseded by the time they are processed, version 4 is the newest one
+	for (int v = 1; v <= 4; v++)
+	    transfer.announce(cmds[v - 1]);
+	for (int v = 1; v <= 4; v++)
+	    ok &= transfer.process_command(cmds[v - 1]) == VELOC_SUCCESS;
+	for (int v = 1; v <= 3; v++)
+	    ok &= !exists(cmds[v - 1].filename(persistent));
+	ok &= exists(cmds[3].filename(persistent));
+	ok &= transfer.get_bytes_superseded() == 3 * SMALL_SIZE && transfer.get_bytes_flushed() == SMALL_SIZE;
+
+	// version 6 arrives while version 5 is being flushed, which either stops early or completes
+	transfer.announce(cmds[4]);
+	std::thread flusher([&]() { ok &= transfer.process_command(cmds[4]) == VELOC_SUCCESS; });
+	transfer.announce(cmds[5]);
+	flusher.join();
+	bool interrupted = !exists(cmds[4].filename(persistent));
+	ok &= !exists(persistent + "/." + cmds[4].stem() + ".partial");
+	ok &= transfer.process_command(cmds[5]) == VELOC_SUCCESS;
+	ok &= exists(cmds[5].filename(persistent)) && !exists(cmds[4].filename(persistent));
+	ok &= transfer.get_bytes_superseded() + transfer.get_bytes_flushed() == 5 * SMALL_SIZE + LARGE_SIZE;
+	std::cout << "flush of the large version " << (interrupted ? "interrupted" : "completed before the newer version")
+		  << ", " << transfer.get_bytes_superseded() << " bytes superseded" << std::endl;
+    }
+
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    std::cout << "coalesce test: " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+// Flush coordination test on a single machine: every MPI process is a backend with its own scratch directory and
+// its own thallium engine on the loopback interface, all of them share the persistent directory. The backends flush
+// at the same time, each with two concurrent flushes; checks that at most <writers> backends hold a token at once,
+// that the flushes of a backend share its token and that all checkpoints reach the persistent directory. Then the
+// first <writers> backends pause their flushes for interactive commands: the others must be able to flush meanwhile,
+// i.e. a paused flush does not keep its token.
+//
+//   mpirun -np <n> coordinator_test [<writers>] [<work_dir>]
+
+#include "modules/flush_coordinator.hpp"
+#include "modules/transfer_module.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+static const int ROUNDS = 5, FLUSHES_PER_BACKEND = 2, MAX_UNPAUSED_FLUSH = 10;
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+static void write_checkpoint(const command_t &c, const std::string &scratch, int rank) {
+    std::ofstream f(c.filename(scratch), std::ios::binary);
+    std::vector<char> data(1 << 20, 'a' + rank % 26);
+    f.write(data.data(), data.size());
+}
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char *argv[]) {
+    int rank, ranks, provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    int writers = argc > 1 ? atoi(argv[1]) : 1;
+    std::string root = argc > 2 ? argv[2] : "/tmp/veloc-coordinator-test";
+    std::string dir = root + "/backend-" + std::to_string(rank), persistent = root + "/persistent";
+    mkdir(root.c_str(), 0755);
+    mkdir(persistent.c_str(), 0755);
+    mkdir(dir.c_str(), 0755);
+    mkdir((dir + "/scratch").c_str(), 0755);
+    std::string cfg_file = dir + "/veloc.cfg";
+    {
+	std::ofstream f(cfg_file);
+	f << "scratch = " << dir << "/scratch\npersistent = " << persistent << "\nmode = async\n"
+	  << "flush_writers = " << writers << "\ncoordinator_address = tcp://127.0.0.1\n";
+    }
+    config_t cfg(cfg_file);
+
+    int ok = true;
+    // start and end of every period during which this backend held a token
+    std::vector<double> periods;
+    int max_shared = 0;
+    {
+	flush_coordinator_t coordinator(cfg, MPI_COMM_WORLD, writers);
+	MPI_Barrier(MPI_COMM_WORLD);
+	for (int r = 0; r < ROUNDS; r++) {
+	    std::mutex periods_mutex;
+	    int active = 0;
+	    double start = 0;
+	    std::vector<std::thread> flushes;
+	    for (int f = 0; f < FLUSHES_PER_BACKEND; f++)
+		flushes.push_back(std::thread([&]() {
+		    coordinator.acquire();
+		    {
+			std::unique_lock<std::mutex> lock(periods_mutex);
+			if (active++ == 0)
+			    start = now();
+			max_shared = std::max(max_shared, active);
+		    }
+		    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		    {
+			std::unique_lock<std::mutex> lock(periods_mutex);
+			if (--active == 0) {
+			    periods.push_back(start);
+			    periods.push_back(now());
+			}
+		    }
+		    coordinator.release();
+		}));
+	    for (auto &t : flushes)
+		t.join();
+	}
+
+	// the same through the transfer module
+	transfer_module_t transfer(cfg);
+	transfer.set_coordinator(&coordinator);
+	command_t c(rank, command_t::CHECKPOINT, 1, "coordinator_test");
+	write_checkpoint(c, cfg.get_scratch(), rank);
+	ok &= transfer.process_command(c) == VELOC_SUCCESS && access(c.filename(persistent).c_str(), R_OK) == 0;
+	if (max_shared < 2) {
+	    std::cerr << "the flushes of backend " << rank << " never shared its token" << std::endl;
+	    ok = false;
+	}
+
+	// the first backends pause in the middle of a flush, long enough to take all the tokens if they kept them
+	priority_gate_t gate(std::chrono::seconds(60));
+	transfer.set_gate(&gate);
+	c.version = 2;
+	write_checkpoint(c, cfg.get_scratch(), rank);
+	std::thread paused;
+	if (rank < writers) {
+	    gate.enter();
+	    paused = std::thread([&]() { ok &= transfer.process_command(c) == VELOC_SUCCESS; });
+	    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+	if (rank >= writers) {
+	    double start = now();
+	    ok &= transfer.process_command(c) == VELOC_SUCCESS;
+	    if (now() - start > MAX_UNPAUSED_FLUSH) {
+		std::cerr << "backend " << rank << " waited for the token of a paused flush" << std::endl;
+		ok = false;
+	    }
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+	if (rank < writers) {
+	    gate.leave();
+	    paused.join();
+	}
+	ok &= access(c.filename(persistent).c_str(), R_OK) == 0;
+    }
+
+    // the periods of all backends, sorted by time, never overlap more than <writers> deep
+    int count = periods.size();
+    std::vector<int> counts(ranks), displs(ranks);
+    MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    for (int i = 1; i < ranks; i++)
+	displs[i] = displs[i - 1] + counts[i - 1];
+    std::vector<double> all(rank == 0 ? displs[ranks - 1] + counts[ranks - 1] : 0);
+    MPI_Gatherv(periods.data(), count, MPI_DOUBLE, all.data(), counts.data(), displs.data(), MPI_DOUBLE, 0,
+		MPI_COMM_WORLD);
+    if (rank == 0) {
+	std::vector<std::pair<double, int> > events;
+	for (size_t i = 0; i < all.size(); i += 2) {
+	    events.push_back(std::make_pair(all[i], 1));
+	    events.push_back(std::make_pair(all[i + 1], -1));
+	}
+	// at equal times, the end of a period comes first
+	std::sort(events.begin(), events.end());
+	int depth = 0, max_depth = 0;
+	for (auto &e : events)
+	    max_depth = std::max(max_depth, depth += e.second);
+	if (max_depth > writers) {
+	    std::cerr << max_depth << " backends flushed at the same time, expected at most " << writers << std::endl;
+	    ok = false;
+	}
+	std::cout << "at most " << max_depth << " of " << ranks << " backends flushed at the same time" << std::endl;
+    }
+
+    int all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (rank == 0) {
+	nftw(root.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+	std::cout << "flush coordination test with " << ranks << " backends and " << writers << " writers: "
+		  << (all_ok ? "passed" : "FAILED") << std::endl;
+    }
+    MPI_Finalize();
+    return all_ok ? 0 : 1;
+}
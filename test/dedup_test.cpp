@@ -0,0 +1,139 @@
+// Deduplication test on a single machine: every MPI process is a backend with its own scratch directory, all of
+// them share the persistent directory. The checkpoints of the emulated clients replicate the same large array
+// after a private header of varying size, so the shared chunks are found at different offsets. Checks that the
+// replicated data is stored once, wipes the scratch directories and restores the checkpoints from the manifests.
+//
+//   mpirun -np <n> dedup_test [node|job] [<work_dir>]
+//
+// With dedup = node, every backend must run on its own node (or use -np 1), since the store is named after it.
+
+#include "modules/transfer_module.hpp"
+#include "common/status.hpp"
+
+#include <mpi.h>
+
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+static const int CLIENTS_PER_BACKEND = 3;
+static const size_t REPLICATED_SIZE = 8 << 20, CHUNK_SIZE = 64 << 10;
+
+static uint64_t chunk_bytes = 0;
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+static int count_chunks(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    if (type == FTW_F)
+	chunk_bytes += sbuf->st_size;
+    return 0;
+}
+
+// private header followed by the replicated array, which changes with the version
+static std::vector<char> expected_content(int id, int version) {
+    std::mt19937 rng(id * 1000 + version), shared(version);
+    std::vector<char> data(rng() % 100000 + REPLICATED_SIZE);
+    size_t header = data.size() - REPLICATED_SIZE;
+    for (size_t i = 0; i < header; i++)
+	data[i] = rng();
+    for (size_t i = header; i < data.size(); i++)
+	data[i] = shared();
+    return data;
+}
+
+static bool check_files(const std::vector<command_t> &cmds, const std::string &scratch) {
+    for (auto &c : cmds) {
+	std::ifstream f(c.filename(scratch), std::ifstream::binary);
+	std::vector<char> expected = expected_content(c.unique_id, c.version), actual(expected.size() + 1);
+	f.read(actual.data(), actual.size());
+	if ((size_t)f.gcount() != expected.size() || !std::equal(expected.begin(), expected.end(), actual.begin())) {
+	    std::cerr << "content mismatch for " << c.stem() << std::endl;
+	    return false;
+	}
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int rank, ranks;
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    std::string mode = argc > 1 ? argv[1] : "job";
+    std::string root = argc > 2 ? argv[2] : "/tmp/veloc-dedup-test";
+    std::string dir = root + "/backend-" + std::to_string(rank);
+
+    mkdir(root.c_str(), 0755);
+    mkdir((root + "/persistent").c_str(), 0755);
+    mkdir(dir.c_str(), 0755);
+    std::string cfg_file = dir + "/veloc.cfg";
+    {
+	std::ofstream f(cfg_file);
+	f << "scratch = " << dir << "/scratch\npersistent = " << root << "/persistent\nmode = async\n"
+	  << "dedup = " << mode << "\ndedup_chunk_size = " << CHUNK_SIZE << "\nmax_versions = 1\n";
+    }
+    config_t cfg(cfg_file);
+    std::string scratch = cfg.get_scratch();
+    mkdir(scratch.c_str(), 0755);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    int ok = 1;
+    std::vector<command_t> checkpoints, restarts;
+    {
+	transfer_module_t module(cfg);
+	for (int version : {1, 2}) {
+	    checkpoints.clear();
+	    for (int i = 0; i < CLIENTS_PER_BACKEND; i++) {
+		int id = rank * CLIENTS_PER_BACKEND + i;
+		checkpoints.push_back(command_t(id, command_t::CHECKPOINT, version, "dedup_test"));
+		std::vector<char> data = expected_content(id, version);
+		std::ofstream(checkpoints.back().filename(scratch), std::ofstream::binary).write(data.data(), data.size());
+		ok &= module.process_command(checkpoints.back()) == VELOC_SUCCESS;
+	    }
+	}
+	// each backend found the replicated array of its second and third client in the store
+	ok &= module.get_bytes_deduplicated() >= (CLIENTS_PER_BACKEND - 1) * (REPLICATED_SIZE - 8 * CHUNK_SIZE);
+	for (auto &c : checkpoints)
+	    restarts.push_back(command_t(c.unique_id, command_t::RESTART, c.version, c.name));
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (rank == 0) {
+	nftw((root + "/persistent/.chunks").c_str(), count_chunks, 128, FTW_PHYS);
+	// with dedup = node, the chunks of version 1 were collected; with dedup = job, they are kept
+	uint64_t versions = mode == "node" ? 1 : 2;
+	uint64_t bound = versions * (REPLICATED_SIZE + ranks * CLIENTS_PER_BACKEND * (100000 + 8 * CHUNK_SIZE));
+	if (chunk_bytes > bound) {
+	    std::cerr << "chunk store holds " << chunk_bytes << " bytes, expected at most " << bound << std::endl;
+	    ok = 0;
+	}
+    }
+
+    // every backend loses its local storage
+    nftw(scratch.c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    mkdir(scratch.c_str(), 0755);
+    MPI_Barrier(MPI_COMM_WORLD);
+    {
+	transfer_module_t module(cfg);
+	ok &= module.process_command(command_t(rank * CLIENTS_PER_BACKEND, command_t::TEST, 0, "dedup_test")) == 2;
+	for (auto &c : restarts)
+	    ok &= module.process_command(c) == VELOC_SUCCESS;
+	ok &= check_files(checkpoints, scratch);
+    }
+
+    int all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    if (rank == 0) {
+	nftw(root.c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+	std::cout << "deduplication test with " << ranks << " backends and dedup = " << mode << ": "
+		  << (all_ok ? "passed" : "FAILED") << std::endl;
+    }
+    MPI_Finalize();
+    return all_ok ? 0 : 1;
+}
@@ -41,6 +41,8 @@ double doWork(int numprocs, int rank, int M, int nbLines, double *g, double *h)
             h[(i*M)+j] = g[(i*M)+j];
         }
     }
+    // the halo exchange is sensitive to the flushes of the backend
+    VELOC_Hint_phase(VELOC_PHASE_COMMUNICATE);
     if (rank > 0) {
         MPI_Isend(g+M, M, MPI_DOUBLE, rank-1, WORKTAG, MPI_COMM_WORLD, &req1[0]);
         MPI_Irecv(h,   M, MPI_DOUBLE, rank-1, WORKTAG, MPI_COMM_WORLD, &req1[1]);
@@ -55,6 +57,7 @@ double doWork(int numprocs, int rank, int M, int nbLines, double *g, double *h)
     if (rank < numprocs - 1) {
         MPI_Waitall(2,req2,status2);
     }
+    VELOC_Hint_phase(VELOC_PHASE_COMPUTE);
     for(i = 1; i < (nbLines-1); i++) {
         for(j = 0; j < M; j++) {
             g[(i*M)+j] = 0.25*(h[((i-1)*M)+j]+h[((i+1)*M)+j]+h[(i*M)+j-1]+h[(i*M)+j+1]);
@@ -123,8 +126,11 @@ int main(int argc, char *argv[]) {
         localerror = doWork(nbProcs, rank, M, nbLines, g, h);
         if (((i % ITER_OUT) == 0) && (rank == 0))
 	    printf("Step : %d, error = %f\n", i, globalerror);
-        if ((i % REDUCE) == 0)
+        if ((i % REDUCE) == 0) {
+	    VELOC_Hint_phase(VELOC_PHASE_COMMUNICATE);
 	    MPI_Allreduce(&localerror, &globalerror, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+	    VELOC_Hint_phase(VELOC_PHASE_COMPUTE);
+	}
         if (globalerror < PRECISION)
 	    break;
 	i++;
@@ -0,0 +1,82 @@
+// Queue ordering test: a client engine sends pipelined requests to the queue of a backend engine in the same process,
+// on the loopback interface, in a scrambled order. Checks that they are dequeued in the order of their sequence
+// numbers, that requests left over from a previous client process are dropped by init, and that the first request
+// sent right after init is never lost.
+//
+//   ipc_queue_test [<rounds>]
+
+#include "common/command.hpp"
+#include "common/ipc_queue.hpp"
+
+#include <iostream>
+#include <vector>
+
+static const uint16_t PROVIDER_ID = 22;
+static const int PIPELINE = 8;
+
+// dequeues and completes count requests, returns their versions in the order they were dequeued
+static std::vector<int> drain(veloc_ipc::shm_queue_t<command_t> &queue, int count) {
+    std::vector<int> versions;
+    for (int i = 0; i < count; i++) {
+	command_t c;
+	auto f = queue.dequeue_any(c);
+	versions.push_back(c.version);
+	f(VELOC_SUCCESS);
+    }
+    return versions;
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 100;
+    tl::engine backend("tcp://127.0.0.1", THALLIUM_SERVER_MODE, true, 4);
+    veloc_ipc::shm_queue_t<command_t> queue(backend, PROVIDER_ID);
+    tl::engine client("tcp", THALLIUM_CLIENT_MODE, true);
+    tl::remote_procedure init = client.define("init"), enqueue_ordered = client.define("enqueue_ordered"),
+	queue_depth = client.define("queue_depth");
+    tl::provider_handle ph(client.lookup(std::string(backend.self())), PROVIDER_ID);
+
+    bool ok = true;
+    // a previous client process with the same id left requests that arrived early and will never be followed
+    init.on(ph)(std::string("0"));
+    int depth = enqueue_ordered.on(ph)(command_t(0, command_t::CHECKPOINT, 100, "stale"), (uint64_t)3);
+    ok &= depth == 0;
+
+    // the new process sends a pipeline of requests, received in any order
+    init.on(ph)(std::string("0"));
+    std::vector<int> order = {5, 2, 0, 7, 1, 6, 3, 4};
+    std::vector<tl::async_response> sent;
+    for (int seq : order)
+	sent.push_back(enqueue_ordered.on(ph).async(command_t(0, command_t::CHECKPOINT, seq, "ordered"), (uint64_t)seq));
+    for (auto &r : sent)
+	r.wait();
+    int queued = queue_depth.on(ph)(std::string("0"));
+    if (queued != PIPELINE) {
+	std::cerr << queued << " requests queued, expected " << PIPELINE << std::endl;
+	ok = false;
+    }
+    std::vector<int> versions = drain(queue, queued), expected;
+    for (int i = 0; i < PIPELINE; i++)
+	expected.push_back(i);
+    if (versions != expected) {
+	std::cerr << "requests dequeued out of order or stale ones kept:";
+	for (auto v : versions)
+	    std::cerr << " " << v;
+	std::cerr << std::endl;
+	ok = false;
+    }
+
+    // every new client process sends its first request right after init: it is queued, never dropped
+    for (int r = 0; r < rounds; r++) {
+	init.on(ph)(std::string("1"));
+	depth = enqueue_ordered.on(ph)(command_t(1, command_t::CHECKPOINT, r, "first"), (uint64_t)0);
+	if (depth != 1) {
+	    std::cerr << "first request of client process " << r << " was not queued" << std::endl;
+	    ok = false;
+	    break;
+	}
+	ok &= drain(queue, 1) == std::vector<int>{r};
+    }
+
+    std::cout << "ipc queue test: " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+// Journal test: accepts and completes commands and records flush progress in a journal small enough to be compacted
+// (and grown) many times, then drops it as if the backend crashed and checks that a new journal on the same file
+// resumes exactly the commands left pending and the transfers left unfinished.
+//
+//   journal_test [<work_dir>]
+
+#include "common/journal.hpp"
+
+#include <iostream>
+#include <set>
+
+#include <ftw.h>
+#include <sys/stat.h>
+
+static const int COMMANDS = 2000;
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp/veloc-journal-test";
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    mkdir(dir.c_str(), 0755);
+    std::string fname = dir + "/journal";
+
+    bool ok = true;
+    std::set<int> live;
+    {
+	journal_t journal(fname, 4096);
+	for (int i = 0; i < COMMANDS; i++) {
+	    command_t c(i % 16, command_t::CHECKPOINT, i, "journal");
+	    journal.accepted(c);
+	    journal.progress(c.filename("/scratch"), c.filename("/persistent"), i * 4096);
+	    // every third command stays pending, every fifth transfer stays interrupted
+	    if (i % 3 != 0)
+		journal.completed(c);
+	    else
+		live.insert(i);
+	    if (i % 5 != 0)
+		journal.finished(c.filename("/persistent"));
+	}
+	ok &= journal.get_pending().empty() && journal.get_transfers().empty();
+    }
+
+    journal_t journal(fname, 4096);
+    std::set<int> pending;
+    for (auto &c : journal.get_pending())
+	ok &= c.name == "journal" && c.unique_id == c.version % 16 && pending.insert(c.version).second;
+    if (pending != live) {
+	std::cerr << "resumed " << pending.size() << " pending commands, expected " << live.size() << std::endl;
+	ok = false;
+    }
+    int transfers = 0;
+    for (int i = 0; i < COMMANDS; i += 5) {
+	command_t c(i % 16, command_t::CHECKPOINT, i, "journal");
+	size_t offset = journal.get_offset(c.filename("/scratch"), c.filename("/persistent"));
+	if (offset != (size_t)i * 4096) {
+	    std::cerr << "transfer of version " << i << " resumes at " << offset << ", expected " << i * 4096 << std::endl;
+	    ok = false;
+	}
+	transfers++;
+    }
+    ok &= journal.get_transfers().size() == (size_t)transfers;
+    // a different source never resumes the transfer of another one
+    command_t c(0, command_t::CHECKPOINT, 0, "journal");
+    ok &= journal.get_offset("/elsewhere", c.filename("/persistent")) == 0;
+    std::cout << "resumed " << pending.size() << " pending commands and " << journal.get_transfers().size()
+	      << " interrupted transfers" << std::endl;
+
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    std::cout << "journal test: " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+// Partner replication test on a single machine: every MPI process is a backend in its own failure domain,
+// with its own scratch directory and its own thallium engine listening on the loopback interface. Replicates
+// the checkpoints of emulated clients, wipes the scratch of one backend and recovers it from its partner.
+//
+//   mpirun -np <n> partner_test [<work_dir>]
+
+#include "modules/partner_module.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+static const int CLIENTS_PER_BACKEND = 2;
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+// deterministic content for a client checkpoint, larger than a chunk to exercise the chunked transfers
+static std::vector<char> expected_content(int id, int version) {
+    std::mt19937 rng(id * 1000 + version);
+    std::vector<char> data(10000 + rng() % 50000);
+    for (auto &c : data)
+	c = rng();
+    return data;
+}
+
+static bool check_files(const std::vector<command_t> &cmds, const std::string &scratch) {
+    for (auto &c : cmds) {
+	std::ifstream f(c.filename(scratch), std::ifstream::binary);
+	std::vector<char> expected = expected_content(c.unique_id, c.version), actual(expected.size() + 1);
+	f.read(actual.data(), actual.size());
+	if ((size_t)f.gcount() != expected.size() || !std::equal(expected.begin(), expected.end(), actual.begin())) {
+	    std::cerr << "content mismatch for " << c.stem() << std::endl;
+	    return false;
+	}
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int rank, ranks, provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    std::string dir = std::string(argc > 1 ? argv[1] : "/tmp/veloc-partner-test") + "/backend-" + std::to_string(rank);
+    if (ranks < 2) {
+	std::cerr << "need at least 2 processes" << std::endl;
+	MPI_Finalize();
+	return 1;
+    }
+
+    mkdir(dir.substr(0, dir.rfind('/')).c_str(), 0755);
+    mkdir(dir.c_str(), 0755);
+    std::string cfg_file = dir + "/veloc.cfg";
+    {
+	std::ofstream f(cfg_file);
+	f << "scratch = " << dir << "/scratch\npersistent = " << dir << "/persistent\nmode = async\n"
+	  << "failure_domain = domain-" << rank << "\npartner_interval = 0\npartner_chunk_size = 4096\n"
+	  << "partner_address = tcp://127.0.0.1\nmax_versions = 1\n";
+    }
+    config_t cfg(cfg_file);
+    std::string scratch = cfg.get_scratch();
+    mkdir(scratch.c_str(), 0755);
+
+    int ok = 1;
+    std::vector<command_t> checkpoints, restarts;
+    {
+	partner_module_t partner(cfg, MPI_COMM_WORLD);
+	for (int version : {1, 2})
+	    for (int i = 0; i < CLIENTS_PER_BACKEND; i++) {
+		int id = rank * CLIENTS_PER_BACKEND + i;
+		command_t c(id, command_t::CHECKPOINT, version, "partner_test");
+		std::vector<char> data = expected_content(id, version);
+		std::ofstream(c.filename(scratch), std::ofstream::binary).write(data.data(), data.size());
+		ok &= partner.process_command(c) == VELOC_SUCCESS;
+		if (version == 2) {
+		    checkpoints.push_back(c);
+		    restarts.push_back(command_t(id, command_t::RESTART, version, "partner_test"));
+		}
+	    }
+	MPI_Barrier(MPI_COMM_WORLD);
+    }
+
+    // backend 0 loses its node: both its own checkpoints and the replicas it holds for others are gone
+    if (rank == 0) {
+	nftw(scratch.c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+	mkdir(scratch.c_str(), 0755);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    {
+	partner_module_t partner(cfg, MPI_COMM_WORLD);
+	ok &= partner.process_command(command_t(rank * CLIENTS_PER_BACKEND, command_t::TEST, 0, "partner_test")) == 2;
+	for (auto &c : restarts)
+	    ok &= partner.process_command(c) == VELOC_SUCCESS;
+	ok &= check_files(checkpoints, scratch);
+	// max_versions = 1: only the latest replica of the previous backend is kept (backend 0 lost them all)
+	command_t prev(((rank + ranks - 1) % ranks) * CLIENTS_PER_BACKEND, command_t::CHECKPOINT, 2, "partner_test");
+	if (rank != 0)
+	    ok &= access(prev.filename(scratch + "/partner").c_str(), R_OK) == 0 &&
+		access(prev.filename(scratch + "/partner", 1).c_str(), F_OK) != 0;
+	MPI_Barrier(MPI_COMM_WORLD);
+    }
+
+    int all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    if (rank == 0)
+	std::cout << "partner replication test with " << ranks << " backends: "
+		  << (all_ok ? "passed" : "FAILED") << std::endl;
+    MPI_Finalize();
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+// Phase test: clients hint their phases with sequence numbers, some of the hints arrive out of order. Checks that
+// the gate of the flushes is held exactly while a client is in a communication or I/O phase, that stale hints are
+// dropped, and that the watchdog releases the gate held by a client that stopped making progress.
+//
+//   phase_test [<work_dir>]
+
+#include "common/phase_tracker.hpp"
+#include "modules/client_watchdog.hpp"
+#include "include/veloc.h"
+
+#include <iostream>
+#include <fstream>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp/veloc-phase-test";
+    mkdir(dir.c_str(), 0755);
+    std::string cfg_file = dir + "/veloc.cfg";
+    {
+	std::ofstream f(cfg_file);
+	f << "scratch = " << dir << "/scratch\npersistent = " << dir << "/persistent\nmode = async\n"
+	  << "watchdog_interval = 1\n";
+    }
+    config_t cfg(cfg_file);
+
+    bool ok = true;
+    priority_gate_t gate;
+    {
+	phase_tracker_t phases(gate);
+	// two clients communicate, the gate stays closed until both are back to computing
+	ok &= phases.hint(1, VELOC_PHASE_COMMUNICATE, 10) && gate.closed();
+	ok &= phases.hint(2, VELOC_PHASE_IO, 5) && gate.closed();
+	ok &= phases.hint(1, VELOC_PHASE_COMPUTE, 11) && gate.closed();
+	// a stale hint of the second client does not reopen the gate, the next one does
+	ok &= !phases.hint(2, VELOC_PHASE_COMPUTE, 4) && gate.closed();
+	ok &= phases.hint(2, VELOC_PHASE_COMPUTE, 6) && !gate.closed();
+	// the end of a communication phase overtakes its start: the client stays in its compute phase
+	ok &= phases.hint(1, VELOC_PHASE_COMPUTE, 13) && !phases.hint(1, VELOC_PHASE_COMMUNICATE, 12);
+	if (gate.closed() || phases.is_busy(1)) {
+	    std::cerr << "a reordered hint left client 1 in a communication phase" << std::endl;
+	    ok = false;
+	}
+	// a client starting over no longer holds the gate, the hints of its previous process stay stale
+	ok &= phases.hint(3, VELOC_PHASE_IO, 100) && gate.closed();
+	phases.clear(3);
+	ok &= !gate.closed() && !phases.hint(3, VELOC_PHASE_IO, 99) && !gate.closed();
+	// the gate held at destruction is given back
+	ok &= phases.hint(4, VELOC_PHASE_COMMUNICATE, 1) && gate.closed();
+    }
+    ok &= !gate.closed();
+
+    // a client dies in a communication phase: its watchdog timeout reopens the gate
+    {
+	phase_tracker_t phases(gate);
+	client_watchdog_t watchdog(cfg);
+	watchdog.set_expiry_hook([&](int id) { phases.clear(id); });
+	ok &= watchdog.process_command(command_t(5, command_t::INIT, 0, "")) == VELOC_SUCCESS;
+	ok &= phases.hint(5, VELOC_PHASE_COMMUNICATE, 1) && gate.closed();
+	auto start = std::chrono::steady_clock::now();
+	while (gate.closed() && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+	    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	if (gate.closed() || watchdog.get_expired() != 1) {
+	    std::cerr << "the watchdog timeout of client 5 did not reopen the gate" << std::endl;
+	    ok = false;
+	}
+    }
+
+    unlink(cfg_file.c_str());
+    rmdir(dir.c_str());
+    std::cout << "phase test: " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
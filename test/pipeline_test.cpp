@@ -0,0 +1,86 @@
+// Pipeline test: two module managers emulate two backends with a single module thread each. Each manager has a
+// collective module that meets the one of the other manager, and an independent module of the same stage that keeps
+// the only module thread busy until the collective module is done. Checks that the collective modules run on the
+// thread of the command rather than waiting behind it, and that all the modules of the stage complete.
+//
+//   pipeline_test
+
+#include "modules/module_manager.hpp"
+#include "common/status.hpp"
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+static const std::chrono::seconds TIMEOUT(10);
+
+// a two-party rendezvous standing in for the collective calls of the backends
+struct rendezvous_t {
+    std::mutex mutex;
+    std::condition_variable cond;
+    int arrived = 0;
+
+    bool meet() {
+	std::unique_lock<std::mutex> lock(mutex);
+	arrived++;
+	cond.notify_all();
+	return cond.wait_for(lock, TIMEOUT, [this] { return arrived >= 2; });
+    }
+};
+
+struct backend_t {
+    module_manager_t modules;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool collective_done = false;
+    std::thread::id collective_thread;
+
+    backend_t(rendezvous_t &peers) {
+	modules.set_parallelism(1);
+	// holds the module thread until the collective module of the same stage completed
+	modules.add_module("blocker", [this](const command_t &c) {
+	    std::unique_lock<std::mutex> lock(mutex);
+	    return cond.wait_for(lock, TIMEOUT, [this] { return collective_done; }) ? VELOC_SUCCESS : VELOC_FAILURE;
+	});
+	modules.add_module("collective", [this, &peers](const command_t &c) {
+	    bool met = peers.meet();
+	    std::unique_lock<std::mutex> lock(mutex);
+	    collective_thread = std::this_thread::get_id();
+	    collective_done = true;
+	    cond.notify_all();
+	    return met ? VELOC_SUCCESS : VELOC_FAILURE;
+	}, module_manager_t::deps_t(), true);
+	modules.add_module("last", [](const command_t &c) { return VELOC_SUCCESS; });
+    }
+};
+
+int main(int argc, char *argv[]) {
+    rendezvous_t peers;
+    backend_t backends[2] = {backend_t(peers), backend_t(peers)};
+    bool ok[2] = {false, false};
+    std::thread::id callers[2];
+    std::thread threads[2];
+    for (int i = 0; i < 2; i++)
+	threads[i] = std::thread([&, i]() {
+	    callers[i] = std::this_thread::get_id();
+	    ok[i] = backends[i].modules.notify_command(command_t(i, command_t::CHECKPOINT, 1, "pipeline")) == VELOC_SUCCESS;
+	});
+    for (auto &t : threads)
+	t.join();
+
+    bool passed = true;
+    for (int i = 0; i < 2; i++) {
+	if (!ok[i]) {
+	    std::cerr << "the modules of backend " << i << " did not complete" << std::endl;
+	    passed = false;
+	}
+	if (backends[i].collective_thread != callers[i]) {
+	    std::cerr << "the collective module of backend " << i << " did not run on the thread of the command" << std::endl;
+	    passed = false;
+	}
+    }
+    std::cout << "pipeline test: " << (passed ? "passed" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
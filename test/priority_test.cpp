@@ -0,0 +1,91 @@
+// Priority test: a large checkpoint is flushed in small chunks while an interactive command holds the gate. Checks
+// that the flush makes no progress while the gate is held, resumes as soon as it is released, and that a flush
+// paused for too long proceeds anyway.
+//
+//   priority_test [<work_dir>]
+
+#include "modules/transfer_module.hpp"
+#include "common/status.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+static const size_t CKPT_SIZE = 64 << 20, SMALL_SIZE = 1 << 20;
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+static void write_file(const std::string &f, size_t size) {
+    std::vector<char> buf(size, 'p');
+    std::ofstream out(f, std::ios::binary);
+    out.write(buf.data(), buf.size());
+}
+
+static off_t file_size(const std::string &f) {
+    struct stat st;
+    return stat(f.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp/veloc-priority-test";
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    std::string scratch = dir + "/scratch", persistent = dir + "/persistent";
+    mkdir(dir.c_str(), 0755);
+    mkdir(scratch.c_str(), 0755);
+    mkdir(persistent.c_str(), 0755);
+    std::string cfg_file = dir + "/veloc.cfg";
+    {
+	std::ofstream f(cfg_file);
+	f << "scratch = " << scratch << "\npersistent = " << persistent << "\nmode = async\n"
+	  << "transfer_chunk_size = 4096\n";
+    }
+    config_t cfg(cfg_file);
+
+    bool ok = true;
+    {
+	transfer_module_t transfer(cfg);
+	priority_gate_t gate(std::chrono::milliseconds(5000));
+	transfer.set_gate(&gate);
+	command_t c(0, command_t::CHECKPOINT, 1, "priority");
+	write_file(c.filename(scratch), CKPT_SIZE);
+	std::string remote = c.filename(persistent), partial = persistent + "/." + c.stem() + ".partial";
+
+	// the interactive command starts while the flush is under way
+	gate.enter();
+	std::thread flusher([&]() { ok &= transfer.process_command(c) == VELOC_SUCCESS; });
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	off_t before = file_size(partial);
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	off_t after = file_size(partial);
+	if (after != before || file_size(remote) >= 0) {
+	    std::cerr << "flush progressed from " << before << " to " << after << " bytes while paused" << std::endl;
+	    ok = false;
+	}
+	auto released = std::chrono::steady_clock::now();
+	gate.leave();
+	flusher.join();
+	double resume_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - released).count();
+	ok &= file_size(remote) == (off_t)CKPT_SIZE;
+	std::cout << "flush paused at " << before << " bytes, completed " << resume_time << " s after the release"
+		  << std::endl;
+
+	// an interactive command that never ends does not starve the flush
+	gate.set_max_pause(std::chrono::milliseconds(1));
+	c.version = 2;
+	write_file(c.filename(scratch), SMALL_SIZE);
+	gate.enter();
+	ok &= transfer.process_command(c) == VELOC_SUCCESS && file_size(c.filename(persistent)) == (off_t)SMALL_SIZE;
+	gate.leave();
+    }
+
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    std::cout << "priority test: " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+// Reload test: the flushes of a backend are capped by flush_bandwidth, which is changed in the configuration file while
+// they run. Checks that the cap is respected by concurrent flushes, that a reload lifts it, that an invalid value is
+// rejected, and that the module threads can be grown from several threads at once while commands use them.
+//
+//   reload_test [<work_dir>]
+
+#include "modules/module_manager.hpp"
+#include "common/status.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+static const size_t CKPT_SIZE = 4 << 20;
+static const int BANDWIDTH = 16, FLUSHES = 2;
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+static void write_config(const std::string &cfg_file, const std::string &dir, const std::string &bandwidth) {
+    std::ofstream f(cfg_file);
+    f << "scratch = " << dir << "/scratch\npersistent = " << dir << "/persistent\nmode = async\n"
+      << "transfer_chunk_size = 262144\nflush_bandwidth = " << bandwidth << "\n";
+}
+
+// flushes FLUSHES checkpoints concurrently, returns the time it took in seconds
+static double flush_all(transfer_module_t &transfer, const config_t &cfg, int version, bool &ok) {
+    std::vector<std::thread> flushes;
+    std::atomic<int> failed(0);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < FLUSHES; i++) {
+	command_t c(i, command_t::CHECKPOINT, version, "reload");
+	std::vector<char> data(CKPT_SIZE, 'r');
+	std::ofstream(c.filename(cfg.get_scratch()), std::ios::binary).write(data.data(), data.size());
+	flushes.push_back(std::thread([&transfer, &failed, c]() { failed += transfer.process_command(c) != VELOC_SUCCESS; }));
+    }
+    for (auto &t : flushes)
+	t.join();
+    ok &= failed == 0;
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp/veloc-reload-test";
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    mkdir(dir.c_str(), 0755);
+    mkdir((dir + "/scratch").c_str(), 0755);
+    mkdir((dir + "/persistent").c_str(), 0755);
+    std::string cfg_file = dir + "/veloc.cfg";
+    write_config(cfg_file, dir, std::to_string(BANDWIDTH));
+    config_t cfg(cfg_file);
+
+    bool ok = true;
+    {
+	transfer_module_t transfer(cfg);
+	// the cap is shared by the flushes of the backend
+	double capped = flush_all(transfer, cfg, 1, ok), expected = (double)FLUSHES * CKPT_SIZE / (BANDWIDTH << 20);
+	if (capped < 0.9 * expected) {
+	    std::cerr << "capped flushes took " << capped << " s, expected at least " << expected << " s" << std::endl;
+	    ok = false;
+	}
+	// a negative cap is rejected, the previous one stays
+	write_config(cfg_file, dir, "-1");
+	ok &= !cfg.reload() && cfg.get_tuning().flush_bandwidth == BANDWIDTH;
+	write_config(cfg_file, dir, "0");
+	ok &= cfg.reload() && cfg.get_tuning().flush_bandwidth == 0;
+	double uncapped = flush_all(transfer, cfg, 2, ok);
+	if (uncapped > expected / 2) {
+	    std::cerr << "flushes took " << uncapped << " s once the cap was lifted" << std::endl;
+	    ok = false;
+	}
+	std::cout << "flushes took " << capped << " s capped at " << BANDWIDTH << " MB/s, " << uncapped << " s uncapped"
+		  << std::endl;
+    }
+
+    // the module threads grow from the reload RPC and the polling thread at the same time, while commands run
+    {
+	module_manager_t modules;
+	for (int i = 0; i < 3; i++)
+	    modules.add_module("noop-" + std::to_string(i), [](const command_t &) { return VELOC_SUCCESS; });
+	std::vector<std::thread> reloads, commands;
+	std::atomic<int> failed(0);
+	for (int i = 0; i < 4; i++)
+	    commands.push_back(std::thread([&modules, &failed, i]() {
+		for (int v = 0; v < 1000; v++)
+		    failed += modules.notify_command(command_t(i, command_t::CHECKPOINT, v, "reload")) != VELOC_SUCCESS;
+	    }));
+	for (unsigned int i = 1; i <= 8; i++)
+	    reloads.push_back(std::thread([&modules, i]() { modules.set_parallelism(i); }));
+	for (auto &t : reloads)
+	    t.join();
+	for (auto &t : commands)
+	    t.join();
+	ok &= failed == 0;
+    }
+
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    std::cout << "reload test: " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+// Native erasure coding test on a single machine: every MPI process is a failure domain with its own
+// scratch directory. Encodes the checkpoints of emulated clients, wipes up to m domains, rebuilds them
+// from the survivors and checks that the rebuilt files are identical.
+//
+//   mpirun -np <k + m> rs_ec_test [<parity>] [<work_dir>]
+
+#include "modules/rs_module.hpp"
+#include "common/status.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+static const int CLIENTS_PER_DOMAIN = 2;
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+// deterministic content for a client checkpoint, sizes differ across clients to exercise padding
+static std::vector<char> expected_content(int id, int version) {
+    std::mt19937 rng(id * 1000 + version);
+    std::vector<char> data(10000 + rng() % 50000);
+    for (auto &c : data)
+	c = rng();
+    return data;
+}
+
+static bool check_files(const std::vector<command_t> &cmds, const std::string &scratch) {
+    for (auto &c : cmds) {
+	std::ifstream f(c.filename(scratch), std::ifstream::binary);
+	std::vector<char> expected = expected_content(c.unique_id, c.version), actual(expected.size() + 1);
+	f.read(actual.data(), actual.size());
+	if ((size_t)f.gcount() != expected.size() || !std::equal(expected.begin(), expected.end(), actual.begin())) {
+	    std::cerr << "content mismatch for " << c.stem() << std::endl;
+	    return false;
+	}
+    }
+    return true;
+}
+
+static int run_step(rs_module_t &ec, const std::vector<command_t> &cmds, const char *step, int expected) {
+    int ret = ec.process_commands(cmds), rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (ret != expected)
+	std::cerr << "rank " << rank << ": " << step << " returned " << ret << ", expected " << expected << std::endl;
+    return ret == expected;
+}
+
+int main(int argc, char *argv[]) {
+    int rank, ranks;
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    int m = argc > 1 ? atoi(argv[1]) : 2;
+    std::string dir = std::string(argc > 2 ? argv[2] : "/tmp/veloc-rs-test") + "/domain-" + std::to_string(rank);
+    if (ranks <= m) {
+	if (rank == 0)
+	    std::cerr << "need more than " << m << " processes" << std::endl;
+	MPI_Finalize();
+	return 1;
+    }
+
+    mkdir(dir.substr(0, dir.rfind('/')).c_str(), 0755);
+    mkdir(dir.c_str(), 0755);
+    std::string cfg_file = dir + "/veloc.cfg";
+    {
+	std::ofstream f(cfg_file);
+	f << "scratch = " << dir << "/scratch\npersistent = " << dir << "/persistent\nmode = async\n"
+	  << "ec_engine = native\nec_parity = " << m << "\nec_chunk_size = 4096\nec_threads = 2\n";
+    }
+    config_t cfg(cfg_file);
+    std::string scratch = cfg.get_scratch();
+
+    int ok = 1;
+    for (int version : {1, 2}) {
+	std::vector<command_t> checkpoints, restarts;
+	for (int i = 0; i < CLIENTS_PER_DOMAIN; i++) {
+	    int id = rank * CLIENTS_PER_DOMAIN + i;
+	    checkpoints.push_back(command_t(id, command_t::CHECKPOINT, version, "rs_test"));
+	    restarts.push_back(command_t(id, command_t::RESTART, version, "rs_test"));
+	    std::vector<char> data = expected_content(id, version);
+	    std::ofstream f(checkpoints.back().filename(scratch), std::ofstream::binary);
+	    f.write(data.data(), data.size());
+	}
+	{
+	    rs_module_t ec(cfg, MPI_COMM_WORLD);
+	    ok &= run_step(ec, checkpoints, "encode", VELOC_SUCCESS);
+	}
+	// version 1 loses the maximum number of tolerated domains, version 2 loses one too many
+	int failed = version == 1 ? m : m + 1;
+	bool victim = rank < failed;
+	if (victim)
+	    nftw(scratch.c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+	MPI_Barrier(MPI_COMM_WORLD);
+	rs_module_t ec(cfg, MPI_COMM_WORLD);
+	if (version == 1) {
+	    mkdir(scratch.c_str(), 0755);
+	    ok &= run_step(ec, restarts, "rebuild", VELOC_SUCCESS);
+	    ok &= check_files(checkpoints, scratch);
+	    ok &= ec.process_command(command_t(rank, command_t::TEST, 0, "rs_test")) == version;
+	} else {
+	    mkdir(scratch.c_str(), 0755);
+	    ok &= run_step(ec, restarts, "rebuild with too many failures", VELOC_FAILURE);
+	}
+    }
+
+    int all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    if (rank == 0)
+	std::cout << "native EC test with " << ranks << " failure domains, m = " << m << ": "
+		  << (all_ok ? "passed" : "FAILED") << std::endl;
+    MPI_Finalize();
+    return all_ok ? 0 : 1;
+}
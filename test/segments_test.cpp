@@ -0,0 +1,157 @@
+// Multi-segment test: registers regions through every overload of the C++ interface (spans, pointers, vectors, single
+// objects, lists of vectors with empty and more than IOV_MAX rows, structures of arrays) in synchronous mode, then
+// checks that a checkpoint restores all of them, that a selective recovery leaves the other regions alone, that a
+// region protected again after a resize is saved with its new layout, and that a region too small is rejected.
+//
+//   segments_test [<work_dir>]
+
+#include "include/veloc.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <array>
+#include <vector>
+
+#include <ftw.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+struct particles_t {
+    std::vector<double> x, y;
+    std::vector<int> type;
+};
+
+struct header_t {
+    int step;
+    double time;
+    char label[12];
+};
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+struct state_t {
+    std::array<double, 100> grid;
+    int raw[37];
+    std::vector<float> field;
+    header_t header;
+    std::vector<std::vector<int> > rows, many_rows;
+    particles_t particles;
+    std::vector<char> empty;
+
+    state_t(int seed) : field(1000), rows(5), many_rows(3 * IOV_MAX) {
+	for (size_t i = 0; i < grid.size(); i++)
+	    grid[i] = seed * 0.5 + i;
+	for (int i = 0; i < 37; i++)
+	    raw[i] = seed * 37 + i;
+	for (size_t i = 0; i < field.size(); i++)
+	    field[i] = seed - (float)i;
+	header = header_t{seed, seed * 0.25, "step"};
+	// rows of different lengths, some of them empty
+	for (size_t r = 0; r < rows.size(); r++)
+	    rows[r].assign(r % 2 == 0 ? r * 3 : 0, seed + r);
+	for (size_t r = 0; r < many_rows.size(); r++)
+	    many_rows[r].assign(1 + r % 3, seed * r);
+	particles.x.assign(10, seed + 0.1);
+	particles.y.assign(10, seed + 0.2);
+	particles.type.assign(10, seed);
+    }
+    void protect() {
+	veloc::protect(0, veloc::span<double>(grid.data(), grid.size()));
+	veloc::protect(1, raw, 37);
+	veloc::protect(2, field);
+	veloc::protect(3, header);
+	veloc::protect(4, rows);
+	veloc::protect(5, many_rows);
+	veloc::protect_all(6, veloc::span<double>(particles.x), veloc::span<double>(particles.y),
+			   veloc::span<int>(particles.type));
+	veloc::protect(7, empty);
+    }
+    // overwrites the contents, keeps the layout
+    void scramble() {
+	grid.fill(-1);
+	std::fill(raw, raw + 37, -1);
+	std::fill(field.begin(), field.end(), -1);
+	header = header_t{-1, -1, "garbage"};
+	for (auto *vv : {&rows, &many_rows})
+	    for (auto &v : *vv)
+		std::fill(v.begin(), v.end(), -1);
+	std::fill(particles.x.begin(), particles.x.end(), -1);
+	std::fill(particles.y.begin(), particles.y.end(), -1);
+	std::fill(particles.type.begin(), particles.type.end(), -1);
+    }
+    bool operator==(const state_t &o) const {
+	return grid == o.grid && std::equal(raw, raw + 37, o.raw) && field == o.field && header.step == o.header.step &&
+	    header.time == o.header.time && std::string(header.label) == o.header.label && rows == o.rows &&
+	    many_rows == o.many_rows && particles.x == o.particles.x && particles.y == o.particles.y &&
+	    particles.type == o.particles.type;
+    }
+};
+
+static bool restart(const char *name, int version, int mode = VELOC_RECOVER_ALL, std::vector<int> ids = {}) {
+    return VELOC_Restart_begin(name, version) == VELOC_SUCCESS &&
+	VELOC_Recover_selective(mode, ids.data(), ids.size()) == VELOC_SUCCESS &&
+	VELOC_Restart_end(1) == VELOC_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    MPI_Init(&argc, &argv);
+    std::string dir = argc > 1 ? argv[1] : "/tmp/veloc-segments-test";
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    mkdir(dir.c_str(), 0755);
+    mkdir((dir + "/scratch").c_str(), 0755);
+    mkdir((dir + "/persistent").c_str(), 0755);
+    std::string cfg_file = dir + "/veloc.cfg";
+    {
+	std::ofstream f(cfg_file);
+	f << "scratch = " << dir << "/scratch\npersistent = " << dir << "/persistent\nmode = sync\n"
+	  << "ec_interval = -1\nec_engine = native\npersistent_interval = -1\n";
+    }
+    if (VELOC_Init(MPI_COMM_WORLD, cfg_file.c_str()) != VELOC_SUCCESS) {
+	std::cerr << "cannot initialize VELOC" << std::endl;
+	return 1;
+    }
+
+    bool ok = true;
+    state_t state(1), expected(1);
+    state.protect();
+    ok &= VELOC_Checkpoint("segments", 1) == VELOC_SUCCESS;
+
+    // every region comes back
+    state.scramble();
+    if (!restart("segments", 1) || !(state == expected)) {
+	std::cerr << "full restart does not match the checkpoint" << std::endl;
+	ok = false;
+    }
+
+    // a selective recovery of the lists of vectors leaves the other regions alone
+    state.scramble();
+    ok &= restart("segments", 1, VELOC_RECOVER_SOME, {4, 5});
+    ok &= state.rows == expected.rows && state.many_rows == expected.many_rows && state.raw[0] == -1 &&
+	state.field[0] == -1 && state.particles.type[0] == -1;
+    ok &= restart("segments", 1, VELOC_RECOVER_REST, {4, 5}) && state == expected;
+
+    // the rows grow: protected again, the region is saved with its new layout
+    state.rows[1].assign(7, 42);
+    state.rows.push_back(std::vector<int>(3, 43));
+    state.protect();
+    expected = state;
+    ok &= VELOC_Checkpoint("segments", 2) == VELOC_SUCCESS;
+    state.scramble();
+    if (!restart("segments", 2) || !(state == expected)) {
+	std::cerr << "restart after a resize does not match the checkpoint" << std::endl;
+	ok = false;
+    }
+
+    // the field shrinks: version 2 no longer fits
+    state.field.resize(10);
+    state.protect();
+    ok &= !restart("segments", 2);
+
+    VELOC_Finalize(0);
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    std::cout << "segments test: " << (ok ? "passed" : "FAILED") << std::endl;
+    MPI_Finalize();
+    return ok ? 0 : 1;
+}
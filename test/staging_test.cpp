@@ -0,0 +1,81 @@
+// Staging arena test: the parent creates the arenas, forked children attach to them through /proc like the
+// clients of a backend do. Everybody allocates, fills, checks and releases buffers concurrently; a buffer that
+// was handed out twice shows up as corrupted content.
+//
+//   staging_test [<processes>] [<iterations>]
+
+#include "common/staging.hpp"
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+static const size_t ARENA_SIZE = 64 << 20, BLOCK_SIZE = 64 << 10;
+
+static bool run(staging_t &staging, int id, int iterations) {
+    std::mt19937 rng(id);
+    std::vector<std::pair<uint64_t, size_t> > owned;
+    staging_arena_t *arena = staging.local();
+    for (int i = 0; i < iterations; i++) {
+	size_t len = 1 + rng() % (4 * BLOCK_SIZE);
+	uint64_t off = arena->allocate(len);
+	if (off != 0) {
+	    std::fill((char *)arena->address(off), (char *)arena->address(off) + len, (char)id);
+	    owned.push_back(std::make_pair(off, len));
+	}
+	if (owned.size() > 8 || (off == 0 && !owned.empty())) {
+	    auto &b = owned.front();
+	    char *p = (char *)arena->address(b.first);
+	    for (size_t j = 0; j < b.second; j++)
+		if (p[j] != (char)id) {
+		    std::cerr << "process " << id << ": buffer at offset " << b.first << " overwritten" << std::endl;
+		    return false;
+		}
+	    arena->release(b.first, b.second);
+	    owned.erase(owned.begin());
+	}
+    }
+    for (auto &b : owned)
+	arena->release(b.first, b.second);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int processes = argc > 1 ? atoi(argv[1]) : 4;
+    int iterations = argc > 2 ? atoi(argv[2]) : 10000;
+    staging_t staging;
+    if (!staging.create(ARENA_SIZE, BLOCK_SIZE)) {
+	std::cerr << "cannot create staging arenas" << std::endl;
+	return 1;
+    }
+    // exercise the arena of the first NUMA node only, so that all processes compete for the same bitmap
+    staging_info_t info = staging.get_info();
+    info.fds.resize(1);
+    std::vector<pid_t> children;
+    for (int i = 1; i < processes; i++) {
+	pid_t pid = fork();
+	if (pid == 0) {
+	    staging_t client;
+	    if (!client.attach(info))
+		_exit(1);
+	    _exit(run(client, i, iterations) ? 0 : 1);
+	}
+	children.push_back(pid);
+    }
+    staging_t self;
+    bool success = self.attach(info) && run(self, 0, iterations);
+    for (auto pid : children) {
+	int status;
+	waitpid(pid, &status, 0);
+	success = success && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    if (success && staging.get(0)->get_used() != 0) {
+	std::cerr << "leaked " << staging.get(0)->get_used() << " bytes" << std::endl;
+	success = false;
+    }
+    std::cout << (success ? "staging test passed" : "staging test failed") << std::endl;
+    return success ? 0 : 1;
+}
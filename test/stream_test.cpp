@@ -0,0 +1,150 @@
+// Streaming test: a forked client gathers a checkpoint into chunks of a staging arena and hands them over in a
+// scrambled order to the parent, which plays the backend: it checks every buffer like the stream_chunk handler does,
+// writes the chunks to the persistent storage and commits. Checks that the published checkpoint matches, that a
+// cancelled stream leaves nothing behind, and that the buffers the client did not allocate are rejected.
+//
+//   stream_test [<work_dir>]
+
+#include "common/staging.hpp"
+#include "common/stream_writer.hpp"
+#include "common/status.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <algorithm>
+#include <vector>
+
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static const size_t ARENA_SIZE = 8 << 20, BLOCK_SIZE = 64 << 10, CKPT_SIZE = (3 << 20) + 12345, CHUNK_SIZE = 100000;
+
+struct chunk_t {
+    uint64_t offset, buf, len;
+};
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+static std::vector<char> expected_content(int version) {
+    std::mt19937 rng(version);
+    std::vector<char> data(CKPT_SIZE);
+    for (auto &c : data)
+	c = rng();
+    return data;
+}
+
+// the client side: copies the checkpoint into arena buffers and sends their descriptors through the pipe
+static bool send_chunks(const staging_info_t &info, int version, int fd) {
+    staging_t client;
+    if (!client.attach(info))
+	return false;
+    staging_arena_t *arena = client.get(0);
+    std::vector<char> data = expected_content(version);
+    std::vector<chunk_t> chunks;
+    for (size_t offset = 0; offset < data.size(); offset += CHUNK_SIZE) {
+	chunk_t c = {offset, 0, std::min(CHUNK_SIZE, data.size() - offset)};
+	if ((c.buf = arena->allocate(c.len)) == 0)
+	    return false;
+	std::copy(data.begin() + offset, data.begin() + offset + c.len, (char *)arena->address(c.buf));
+	chunks.push_back(c);
+    }
+    std::shuffle(chunks.begin(), chunks.end(), std::mt19937(version));
+    for (auto &c : chunks)
+	if (write(fd, &c, sizeof(c)) != sizeof(c))
+	    return false;
+    return true;
+}
+
+// the backend side: the checks and writes of the stream_chunk handler
+static int receive_chunk(staging_arena_t *arena, stream_writer_t &streamer, const command_t &c, const chunk_t &chunk) {
+    if (!arena->allocated(chunk.buf, chunk.len))
+	return VELOC_FAILURE;
+    int ret = streamer.write(c, chunk.offset, {{arena->address(chunk.buf), chunk.len}});
+    arena->release(chunk.buf, chunk.len);
+    return ret;
+}
+
+static bool stream(staging_t &staging, stream_writer_t &streamer, const command_t &c, size_t max_chunks) {
+    int fds[2];
+    if (pipe(fds) != 0)
+	return false;
+    pid_t pid = fork();
+    if (pid == 0) {
+	close(fds[0]);
+	_exit(send_chunks(staging.get_info(), c.version, fds[1]) ? 0 : 1);
+    }
+    close(fds[1]);
+    chunk_t chunk;
+    bool success = true;
+    for (size_t n = 0; read(fds[0], &chunk, sizeof(chunk)) == sizeof(chunk); n++)
+	if (n < max_chunks)
+	    success &= receive_chunk(staging.get(0), streamer, c, chunk) == VELOC_SUCCESS;
+	else
+	    // the client gives back the buffers of the chunks that were never answered
+	    staging.get(0)->release(chunk.buf, chunk.len);
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return success && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp/veloc-stream-test";
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    std::string persistent = dir + "/persistent";
+    mkdir(dir.c_str(), 0755);
+    mkdir(persistent.c_str(), 0755);
+    std::string cfg_file = dir + "/veloc.cfg";
+    {
+	std::ofstream f(cfg_file);
+	f << "scratch = " << dir << "/scratch\npersistent = " << persistent << "\nmode = async\n";
+    }
+    config_t cfg(cfg_file);
+
+    staging_t staging;
+    if (!staging.create(ARENA_SIZE, BLOCK_SIZE)) {
+	std::cerr << "cannot create staging arenas" << std::endl;
+	return 1;
+    }
+    stream_writer_t streamer(cfg);
+    bool ok = true;
+
+    // round trip
+    command_t c(0, command_t::CHECKPOINT, 1, "stream");
+    ok &= stream(staging, streamer, c, SIZE_MAX) && streamer.commit(c, CKPT_SIZE) == VELOC_SUCCESS;
+    std::vector<char> expected = expected_content(1), actual(CKPT_SIZE + 1);
+    std::ifstream f(c.filename(persistent), std::ios::binary);
+    f.read(actual.data(), actual.size());
+    if ((size_t)f.gcount() != CKPT_SIZE || !std::equal(expected.begin(), expected.end(), actual.begin())) {
+	std::cerr << "streamed checkpoint does not match, " << f.gcount() << " bytes" << std::endl;
+	ok = false;
+    }
+
+    // a stream that fails half way is cancelled: nothing is published and the backend forgets it
+    c.version = 2;
+    ok &= stream(staging, streamer, c, 10) && streamer.commit(c, CKPT_SIZE, false) == VELOC_FAILURE;
+    ok &= access(c.filename(persistent).c_str(), F_OK) != 0 && access((persistent + "/." + c.stem() + ".partial").c_str(), F_OK) != 0;
+    ok &= streamer.commit(c, CKPT_SIZE) == VELOC_FAILURE;
+
+    // buffers that were not allocated, overlap the metadata of the arena or reach beyond it are rejected
+    staging_arena_t *arena = staging.get(0);
+    uint64_t buf = arena->allocate(BLOCK_SIZE);
+    ok &= buf != 0 && arena->allocated(buf, BLOCK_SIZE) && !arena->allocated(buf, 2 * BLOCK_SIZE);
+    ok &= !arena->allocated(0, BLOCK_SIZE) && !arena->allocated(buf + 1, 1);
+    ok &= !arena->allocated(arena->get_capacity() - BLOCK_SIZE, 2 * BLOCK_SIZE) && !arena->allocated(buf, SIZE_MAX);
+    ok &= receive_chunk(arena, streamer, c, chunk_t{0, ARENA_SIZE * 2, BLOCK_SIZE}) == VELOC_FAILURE;
+    arena->release(buf, BLOCK_SIZE);
+    if (arena->get_used() != 0) {
+	std::cerr << "leaked " << arena->get_used() << " bytes of the arena" << std::endl;
+	ok = false;
+    }
+
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    std::cout << "stream test: " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+// Strided test: protects the interior of a heat distribution grid (without its ghost rows and columns) with
+// VELOC_Mem_protect_strided and a few buffers with VELOC_Mem_protect_iov, some of them adjacent and merged into one
+// segment, some adjacent but listed in reverse order, which must not be merged. Checkpoints in synchronous mode, checks
+// that only the blocks are saved, that they are restored into the same layout while the ghost cells are left alone,
+// and that invalid registrations are rejected.
+//
+//   strided_test [<work_dir>]
+
+// for nftw
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "include/veloc.h"
+
+#define LINES 34
+#define COLUMNS 66
+#define GHOST -1.0
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+static double interior(int version, int i, int j) {
+    return version * 10000.0 + i * 100 + j;
+}
+
+static void fill(double *h, int version) {
+    int i, j;
+    for (i = 0; i < LINES; i++)
+	for (j = 0; j < COLUMNS; j++)
+	    h[i * COLUMNS + j] = i == 0 || i == LINES - 1 || j == 0 || j == COLUMNS - 1 ? GHOST : interior(version, i, j);
+}
+
+static int check(const double *h, int version) {
+    int i, j;
+    for (i = 0; i < LINES; i++)
+	for (j = 0; j < COLUMNS; j++) {
+	    int ghost = i == 0 || i == LINES - 1 || j == 0 || j == COLUMNS - 1;
+	    // the ghost cells are not part of the checkpoint, they keep what the application left in them
+	    double expected = ghost ? -2.0 : interior(version, i, j);
+	    if (h[i * COLUMNS + j] != expected) {
+		fprintf(stderr, "cell (%d, %d) is %g instead of %g\n", i, j, h[i * COLUMNS + j], expected);
+		return 0;
+	    }
+	}
+    return 1;
+}
+
+static void scramble(double *h, char *buf) {
+    int i;
+    for (i = 0; i < LINES * COLUMNS; i++)
+	h[i] = -2.0;
+    memset(buf, 0, 64);
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = argc > 1 ? argv[1] : "/tmp/veloc-strided-test";
+    char path[4096];
+    double *h = malloc(LINES * COLUMNS * sizeof(double));
+    char buf[64], expected_buf[64];
+    struct stat st;
+    int i, ok = 1;
+
+    MPI_Init(&argc, &argv);
+    nftw(dir, rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    mkdir(dir, 0755);
+    snprintf(path, sizeof(path), "%s/scratch", dir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/persistent", dir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/veloc.cfg", dir);
+    FILE *f = fopen(path, "w");
+    fprintf(f, "scratch = %s/scratch\npersistent = %s/persistent\nmode = sync\nec_interval = -1\nec_engine = native\n"
+	    "persistent_interval = -1\n", dir, dir);
+    fclose(f);
+    if (VELOC_Init(MPI_COMM_WORLD, path) != VELOC_SUCCESS) {
+	fprintf(stderr, "cannot initialize VELOC\n");
+	return 1;
+    }
+
+    // the interior: LINES - 2 blocks of COLUMNS - 2 doubles, one line apart
+    fill(h, 1);
+    ok &= VELOC_Mem_protect_strided(0, &h[COLUMNS + 1], LINES - 2, (COLUMNS - 2) * sizeof(double),
+				    COLUMNS * sizeof(double)) == VELOC_SUCCESS;
+    // [0, 16) and [16, 32) are adjacent and merged, [48, 64) comes before [32, 48) and stays a separate segment
+    for (i = 0; i < 64; i++)
+	buf[i] = expected_buf[i] = i + 1;
+    struct iovec iov[4] = {{buf, 16}, {buf + 16, 16}, {buf + 48, 16}, {buf + 32, 16}};
+    ok &= VELOC_Mem_protect_iov(1, iov, 4) == VELOC_SUCCESS;
+    // a stride equal to the block size is a contiguous region
+    double contiguous[8];
+    for (i = 0; i < 8; i++)
+	contiguous[i] = i * 0.5;
+    ok &= VELOC_Mem_protect_strided(2, contiguous, 4, 2 * sizeof(double), 2 * sizeof(double)) == VELOC_SUCCESS;
+    ok &= VELOC_Checkpoint("strided", 1) == VELOC_SUCCESS;
+
+    // the checkpoint holds the blocks only: the number of regions, then their ids and sizes, then their contents
+    size_t data = (LINES - 2) * (COLUMNS - 2) * sizeof(double) + 64 + 8 * sizeof(double);
+    snprintf(path, sizeof(path), "%s/scratch/strided-0-1.dat", dir);
+    if (stat(path, &st) != 0 || (size_t)st.st_size != sizeof(size_t) + 3 * (sizeof(int) + sizeof(size_t)) + data) {
+	fprintf(stderr, "checkpoint of %ld bytes, expected %zu bytes of data\n", (long)st.st_size, data);
+	ok = 0;
+    }
+
+    scramble(h, buf);
+    memset(contiguous, 0, sizeof(contiguous));
+    ok &= VELOC_Restart("strided", 1) == VELOC_SUCCESS;
+    ok &= check(h, 1) && memcmp(buf, expected_buf, 64) == 0;
+    for (i = 0; i < 8; i++)
+	ok &= contiguous[i] == i * 0.5;
+
+    // the stride cannot be smaller than the blocks, nor the list of segments have a negative length
+    ok &= VELOC_Mem_protect_strided(3, h, 4, 2 * sizeof(double), sizeof(double)) == VELOC_FAILURE;
+    ok &= VELOC_Mem_protect_iov(3, iov, -1) == VELOC_FAILURE;
+
+    VELOC_Finalize(0);
+    nftw(dir, rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    free(h);
+    printf("strided test: %s\n", ok ? "passed" : "FAILED");
+    MPI_Finalize();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+// Subfiling test on a single machine: every MPI process is a backend with its own scratch directory, all of them
+// share the persistent directory. Flushes the checkpoints of emulated clients into a few shared subfiles, wipes
+// the scratch directories and restores the checkpoints using the index. The subfiles of the last version replace
+// larger stale ones, which must not keep their trailing bytes. A newer version that one backend keeps on scratch
+// only, because its queue was full, is not flushed by any backend.
+//
+//   mpirun -np <n> subfile_test [<subfiles>] [<work_dir>]
+
+#include "modules/subfile_module.hpp"
+#include "common/status.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+static const int CLIENTS_PER_BACKEND = 3;
+static const off_t STALE_SIZE = 16 << 20;
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+// deterministic content for a client checkpoint, sizes are not multiples of the alignment
+static std::vector<char> expected_content(int id, int version) {
+    std::mt19937 rng(id * 1000 + version);
+    std::vector<char> data(rng() % 100000);
+    for (auto &c : data)
+	c = rng();
+    return data;
+}
+
+static std::string subfile(const std::string &root, int version, int group) {
+    return root + "/persistent/subfile_test." + std::to_string(version) + "." + std::to_string(group) + ".sub";
+}
+
+static bool check_files(const std::vector<command_t> &cmds, const std::string &scratch) {
+    for (auto &c : cmds) {
+	std::ifstream f(c.filename(scratch), std::ifstream::binary);
+	std::vector<char> expected = expected_content(c.unique_id, c.version), actual(expected.size() + 1);
+	f.read(actual.data(), actual.size());
+	if ((size_t)f.gcount() != expected.size() || !std::equal(expected.begin(), expected.end(), actual.begin())) {
+	    std::cerr << "content mismatch for " << c.stem() << std::endl;
+	    return false;
+	}
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int rank, ranks;
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    int subfiles = argc > 1 ? atoi(argv[1]) : 2;
+    std::string root = argc > 2 ? argv[2] : "/tmp/veloc-subfile-test";
+    std::string dir = root + "/backend-" + std::to_string(rank);
+
+    mkdir(root.c_str(), 0755);
+    mkdir((root + "/persistent").c_str(), 0755);
+    mkdir(dir.c_str(), 0755);
+    std::string cfg_file = dir + "/veloc.cfg";
+    {
+	std::ofstream f(cfg_file);
+	f << "scratch = " << dir << "/scratch\npersistent = " << root << "/persistent\nmode = async\n"
+	  << "subfile_count = " << subfiles << "\nsubfile_align = 4096\nmax_versions = 1\n";
+    }
+    config_t cfg(cfg_file);
+    std::string scratch = cfg.get_scratch();
+    mkdir(scratch.c_str(), 0755);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    int ok = 1;
+    std::vector<command_t> checkpoints, restarts;
+    {
+	subfile_module_t module(cfg, MPI_COMM_WORLD);
+	for (int version : {1, 2}) {
+	    // e.g. left by an earlier attempt with more clients
+	    if (version == 2 && rank == 0)
+		for (int g = 0; g < subfiles; g++) {
+		    std::string f = subfile(root, 2, g);
+		    std::ofstream(f, std::ofstream::binary).put('x');
+		    ok &= truncate(f.c_str(), STALE_SIZE) == 0;
+		}
+	    MPI_Barrier(MPI_COMM_WORLD);
+	    checkpoints.clear();
+	    for (int i = 0; i < CLIENTS_PER_BACKEND; i++) {
+		int id = rank * CLIENTS_PER_BACKEND + i;
+		checkpoints.push_back(command_t(id, command_t::CHECKPOINT, version, "subfile_test"));
+		std::vector<char> data = expected_content(id, version);
+		std::ofstream(checkpoints.back().filename(scratch), std::ofstream::binary).write(data.data(), data.size());
+	    }
+	    ok &= module.process_commands(checkpoints) == VELOC_SUCCESS;
+	}
+	for (auto &c : checkpoints)
+	    restarts.push_back(command_t(c.unique_id, command_t::RESTART, c.version, c.name));
+
+	std::vector<command_t> skipped;
+	for (int i = 0; i < CLIENTS_PER_BACKEND; i++) {
+	    int id = rank * CLIENTS_PER_BACKEND + i;
+	    skipped.push_back(command_t(id, command_t::CHECKPOINT, 3, "subfile_test"));
+	    if (rank == 0 && i == 0)
+		skipped.back().flags |= command_t::NO_PERSISTENT;
+	    std::vector<char> data = expected_content(id, 3);
+	    std::ofstream(skipped.back().filename(scratch), std::ofstream::binary).write(data.data(), data.size());
+	}
+	ok &= module.process_commands(skipped) == VELOC_SUCCESS;
+	MPI_Barrier(MPI_COMM_WORLD);
+	for (int g = 0; g < subfiles; g++)
+	    if (access(subfile(root, 3, g).c_str(), F_OK) == 0) {
+		std::cerr << "subfile " << g << " of version 3 was flushed, although kept on scratch" << std::endl;
+		ok = false;
+	    }
+	ok &= access((root + "/persistent/subfile_test.3.idx").c_str(), F_OK) != 0;
+    }
+    for (int g = 0; g < subfiles; g++) {
+	struct stat st;
+	if (stat(subfile(root, 2, g).c_str(), &st) != 0 || st.st_size >= STALE_SIZE) {
+	    std::cerr << "subfile " << g << " of version 2 kept the size of the stale one" << std::endl;
+	    ok = false;
+	}
+    }
+
+    // every backend loses its local storage
+    nftw(scratch.c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+    mkdir(scratch.c_str(), 0755);
+    MPI_Barrier(MPI_COMM_WORLD);
+    {
+	subfile_module_t module(cfg, MPI_COMM_WORLD);
+	ok &= module.process_command(command_t(rank, command_t::TEST, 0, "subfile_test")) == 2;
+	// max_versions = 1: version 1 is gone
+	ok &= module.process_command(command_t(rank, command_t::TEST, 1, "subfile_test")) == VELOC_SUCCESS;
+	ok &= module.process_commands(restarts) == VELOC_SUCCESS;
+	ok &= check_files(checkpoints, scratch);
+    }
+
+    int all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    if (rank == 0) {
+	nftw(root.c_str(), rm_file, 128, FTW_DEPTH | FTW_MOUNT | FTW_PHYS);
+	std::cout << "subfiling test with " << ranks << " backends and " << subfiles << " subfiles: "
+		  << (all_ok ? "passed" : "FAILED") << std::endl;
+    }
+    MPI_Finalize();
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+// Tier test: two tiers keep a single version of a checkpoint each, so that every new version moves the previous one
+// down and evicts the one before from the last tier. Checks that pinned versions (accepted but not yet flushed) stay
+// where they are until unpinned, and that a rebalance during a write never sees the file half written.
+//
+//   tier_test [<work_dir>]
+
+#include "common/tiers.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+static const size_t CKPT_SIZE = 1 << 20;
+
+static int rm_file(const char *f, const struct stat *sbuf, int type, struct FTW *ftwb) {
+    return remove(f);
+}
+
+static bool exists(const std::string &f) {
+    return access(f.c_str(), F_OK) == 0;
+}
+
+static bool write_file(const std::string &f, size_t size) {
+    std::vector<char> buf(size, 't');
+    std::ofstream out(f, std::ios::binary);
+    out.write(buf.data(), buf.size());
+    return out.good();
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp/veloc-tier-test";
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    std::string scratch = dir + "/scratch", fast = dir + "/fast", slow = dir + "/slow";
+    mkdir(dir.c_str(), 0755);
+    mkdir(scratch.c_str(), 0755);
+    mkdir((dir + "/persistent").c_str(), 0755);
+    std::string cfg_file = dir + "/veloc.cfg";
+    {
+	std::ofstream f(cfg_file);
+	f << "scratch = " << scratch << "\npersistent = " << dir << "/persistent\nmode = async\ntiers = fast,slow\n"
+	  << "tier_fast_path = " << fast << "\ntier_fast_bandwidth = 1000\ntier_fast_max_versions = 1\n"
+	  << "tier_slow_path = " << slow << "\ntier_slow_bandwidth = 100\ntier_slow_max_versions = 1\n";
+    }
+    config_t cfg(cfg_file);
+
+    bool ok = true;
+    tier_set_t tiers(cfg);
+    auto writer = [](const std::string &f) { return write_file(f, CKPT_SIZE); };
+    std::vector<command_t> v;
+    for (int i = 0; i <= 3; i++)
+	v.push_back(command_t(0, command_t::CHECKPOINT, i, "tier"));
+
+    // version 1 is pinned while version 2 arrives: it stays on the fast tier, then moves down once unpinned
+    tiers.pin(v[1]);
+    ok &= tiers.store(v[1], CKPT_SIZE, writer) && tiers.store(v[2], CKPT_SIZE, writer);
+    tiers.rebalance();
+    if (!exists(v[1].filename(fast)) || exists(v[1].filename(slow))) {
+	std::cerr << "pinned version 1 left the fast tier" << std::endl;
+	ok = false;
+    }
+    tiers.unpin(v[1]);
+    tiers.rebalance();
+    ok &= !exists(v[1].filename(fast)) && exists(v[1].filename(slow)) && exists(v[1].filename(scratch));
+
+    // version 1 is pinned again (e.g. checkpointed again before its flush): it is not evicted from the last tier
+    tiers.pin(v[1]);
+    tiers.pin(v[1]);
+    ok &= tiers.store(v[3], CKPT_SIZE, writer);
+    tiers.rebalance();
+    if (!exists(v[1].filename(slow)) || !exists(v[1].filename(scratch))) {
+	std::cerr << "pinned version 1 was evicted from the last tier" << std::endl;
+	ok = false;
+    }
+    ok &= exists(v[2].filename(slow)) && exists(v[3].filename(fast));
+    // the pins are counted
+    tiers.unpin(v[1]);
+    tiers.rebalance();
+    ok &= exists(v[1].filename(slow));
+    tiers.unpin(v[1]);
+    tiers.rebalance();
+    if (exists(v[1].filename(slow)) || exists(v[1].filename(scratch))) {
+	std::cerr << "unpinned version 1 was not evicted from the last tier" << std::endl;
+	ok = false;
+    }
+
+    // a rebalance in the middle of a write does not see the new version
+    command_t c(0, command_t::CHECKPOINT, 4, "tier");
+    ok &= tiers.store(c, CKPT_SIZE, [&](const std::string &f) {
+	write_file(f, CKPT_SIZE / 2);
+	tiers.rebalance();
+	if (exists(c.filename(fast)) || !exists(f) || !exists(v[3].filename(fast))) {
+	    std::cerr << "a rebalance saw the version being written" << std::endl;
+	    ok = false;
+	}
+	return write_file(f, CKPT_SIZE);
+    });
+    struct stat st;
+    ok &= stat(c.filename(scratch).c_str(), &st) == 0 && st.st_size == (off_t)CKPT_SIZE;
+
+    nftw(dir.c_str(), rm_file, 128, FTW_DEPTH | FTW_PHYS);
+    std::cout << "tier test: " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
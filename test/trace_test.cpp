@@ -0,0 +1,68 @@
+// Trace test: with tracing enabled, debug, informational and error messages are recorded as LOG events carrying their
+// level, function and line, next to the command events; with tracing disabled, nothing is recorded. Reads the binary
+// trace file back and checks its events.
+//
+//   trace_test [<work_dir>]
+
+#ifndef __INFO
+#define __INFO
+#endif
+#define __DEBUG
+#include "common/debug.hpp"
+#include "common/command.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void log_messages(int &debug_line, int &info_line, int &error_line) {
+    debug_line = __LINE__; DBG("debug message " << 1);
+    info_line = __LINE__; INFO("info message " << 2);
+    error_line = __LINE__; ERROR("error message " << 3);
+}
+
+int main(int argc, char *argv[]) {
+    std::string dir = argc > 1 ? argv[1] : "/tmp/veloc-trace-test";
+    mkdir(dir.c_str(), 0755);
+    std::string trace_file = dir + "/veloc-trace-" + std::to_string(getpid()) + ".bin";
+
+    int lines[3], ignored[3];
+    // not recorded: tracing is not enabled yet
+    log_messages(ignored[0], ignored[1], ignored[2]);
+    bool ok = veloc_trace::init(dir, 10);
+    command_t c(7, command_t::CHECKPOINT, 3, "trace");
+    TRACE_CMD(ENQUEUE, c, "enqueue", 0);
+    log_messages(lines[0], lines[1], lines[2]);
+    veloc_trace::finalize();
+
+    std::ifstream f(trace_file, std::ios::binary);
+    veloc_trace::file_header_t header;
+    ok &= f.read((char *)&header, sizeof(header)) && header.magic == veloc_trace::TRACE_MAGIC;
+    std::vector<veloc_trace::event_t> logs;
+    int enqueued = 0;
+    veloc_trace::event_t e;
+    while (f.read((char *)&e, sizeof(e)))
+	if (e.type == veloc_trace::LOG)
+	    logs.push_back(e);
+	else if (e.type == veloc_trace::ENQUEUE && e.id == 7 && e.version == 3)
+	    enqueued++;
+    ok &= enqueued == 1;
+    if (logs.size() != 3) {
+	std::cerr << logs.size() << " LOG events recorded, expected 3" << std::endl;
+	ok = false;
+    }
+    for (size_t i = 0; i < logs.size() && i < 3; i++)
+	if (logs[i].command != i || logs[i].arg != (uint64_t)lines[i] ||
+	    std::string(logs[i].label, strnlen(logs[i].label, veloc_trace::LABEL_SIZE)) != "log_messages") {
+	    std::cerr << "LOG event " << i << " has level " << logs[i].command << " and line " << logs[i].arg << std::endl;
+	    ok = false;
+	}
+
+    unlink(trace_file.c_str());
+    rmdir(dir.c_str());
+    std::cout << "trace test: " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+// Watchdog test: registers many clients with a one second timeout, keeps half of them alive with heartbeats and
+// checks that exactly the silent half times out, then that a late heartbeat revives a client.
+//
+//   watchdog_test [<clients>] [<work_dir>]
+
+#include "modules/client_watchdog.hpp"
+#include "common/status.hpp"
+
+#include <iostream>
+#include <fstream>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+int main(int argc, char *argv[]) {
+    int clients = argc > 1 ? atoi(argv[1]) : 10000;
+    std::string dir = argc > 2 ? argv[2] : "/tmp/veloc-watchdog-test";
+    mkdir(dir.c_str(), 0755);
+    std::string cfg_file = dir + "/veloc.cfg";
+    {
+	std::ofstream f(cfg_file);
+	f << "scratch = " << dir << "/scratch\npersistent = " << dir << "/persistent\nmode = async\n"
+	  << "watchdog_interval = 1\n";
+    }
+    config_t cfg(cfg_file);
+
+    bool ok = true;
+    {
+	client_watchdog_t watchdog(cfg);
+	for (int id = 0; id < clients; id++)
+	    ok &= watchdog.process_command(command_t(id, command_t::INIT, 0, "")) == VELOC_SUCCESS;
+	ok &= watchdog.process_command(command_t(clients, command_t::CHECKPOINT, 1, "watchdog_test")) == VELOC_FAILURE;
+	auto start = std::chrono::steady_clock::now();
+	double heartbeat_time = 0;
+	size_t heartbeats = 0;
+	while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(2500)) {
+	    auto t = std::chrono::steady_clock::now();
+	    for (int id = 0; id < clients; id += 2)
+		watchdog.heartbeat(id);
+	    heartbeat_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+	    heartbeats += (clients + 1) / 2;
+	    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	}
+	size_t expired = watchdog.get_expired();
+	if (expired != (size_t)clients / 2) {
+	    std::cerr << expired << " clients timed out, expected " << clients / 2 << std::endl;
+	    ok = false;
+	}
+	watchdog.heartbeat(1);
+	ok &= watchdog.get_expired() == expired - 1;
+	std::cout << "average heartbeat cost: " << heartbeat_time / heartbeats * 1e9 << " ns" << std::endl;
+    }
+
+    unlink(cfg_file.c_str());
+    rmdir(dir.c_str());
+    std::cout << "watchdog test with " << clients << " clients: " << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}